@@ -0,0 +1,290 @@
+#include "backend.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "mixed.h"
+#include "parallel.h"
+#include "pm.h"
+#include "soa.h"
+#include "threadpool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+
+static void acc_auto(const Universe *uni, Vector *a);
+
+static const ForceBackend backends[] = {
+    { "direct",     acc,            acc_pot,     acc_partial, 1 },
+    { "vectorized", acc_vectorized, NULL,        acc_partial, 1 },
+    { "parallel",   acc_parallel,   NULL,        acc_partial, 1 },
+    { "auto",       acc_auto,       NULL,        acc_partial, 1 },
+    { "mixed",      acc_mixed,      NULL,        acc_partial, 0 },
+    { "barnes_hut", acc_barnes_hut, NULL,        acc_partial, 0 },
+    { "fmm",        acc_fmm,        acc_pot_fmm, acc_partial, 0 },
+    { "pm",         acc_pm,         acc_pot_pm,  acc_partial, 0 },
+};
+
+#define BACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+// The candidates of the probe: the exact backends, except "auto" itself.
+#define CANDIDATES 3
+
+// "auto" uses the choice for the largest probed N not above the number of objects.
+static const int probe_sizes[] = { 16, 64, 256, 1024, 4096 };
+
+#define PROBES (int)(sizeof(probe_sizes) / sizeof(probe_sizes[0]))
+
+static const ForceBackend *selected = &backends[0];
+static const ForceBackend *tuned[PROBES];  // NULL until tuned, which means "direct"
+
+const ForceBackend* find_force_backend(const char *name) {
+    for (int b = 0; b < BACKENDS; ++b) {
+        if (!strcmp(name, backends[b].name)) {
+            return &backends[b];
+        }
+    }
+    return NULL;
+}
+
+const ForceBackend* force_backend(void) {
+    return selected;
+}
+
+void select_force_backend(const ForceBackend *backend) {
+    selected = backend ? backend : &backends[0];
+}
+
+const ForceBackend* tuned_force_backend(int N) {
+    int k = 0;
+    while (k + 1 < PROBES && probe_sizes[k + 1] <= N) {
+        ++k;
+    }
+    return tuned[k] ? tuned[k] : &backends[0];
+}
+
+static void acc_auto(const Universe *uni, Vector *a) {
+    tuned_force_backend(uni->N)->acc(uni, a);
+}
+
+const char* cpu_isa(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+// What makes one machine differ from another for the choice: the CPU model, its
+// vector instructions and the number of CPUs.
+static void machine(char *key, size_t size) {
+    char brand[49] = "unknown";
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int regs[12];
+    if (__get_cpuid(0x80000004, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        for (int k = 0; k < 3; ++k) {
+            __get_cpuid(0x80000002 + k, &regs[4 * k], &regs[4 * k + 1], &regs[4 * k + 2], &regs[4 * k + 3]);
+        }
+        memcpy(brand, regs, 48);
+        brand[48] = 0;
+    }
+#endif
+    // The brand string is padded with spaces on some CPUs.
+    char *start = brand;
+    while (*start == ' ') {
+        ++start;
+    }
+    snprintf(key, size, "%s %ld %s", cpu_isa(), sysconf(_SC_NPROCESSORS_ONLN), start);
+}
+
+// The path of the cache file. A default one in a cache directory that does not exist
+// yet, as on a fresh machine, gets the directory created.
+static int cache_path(const char *cache, char *path, size_t size) {
+    if (cache) {
+        snprintf(path, size, "%s", cache);
+        return 0;
+    } else if (getenv("GRAVITY_BACKEND_CACHE")) {
+        snprintf(path, size, "%s", getenv("GRAVITY_BACKEND_CACHE"));
+        return 0;
+    } else if (getenv("XDG_CACHE_HOME")) {
+        snprintf(path, size, "%s/gravity-backend", getenv("XDG_CACHE_HOME"));
+    } else if (getenv("HOME")) {
+        snprintf(path, size, "%s/.cache/gravity-backend", getenv("HOME"));
+    } else {
+        return -1;
+    }
+    char *name = strrchr(path, '/');
+    *name = 0;
+    mkdir(path, 0755);
+    *name = '/';
+    return 0;
+}
+
+// The cache is a text file:
+//   gravity-backend 1
+//   machine <vector instructions> <CPUs> <CPU model>
+//   threads <thread count>
+//   <N> <backend>, for every probed N
+// Returns 0 if it was read and written on this machine, −1 otherwise.
+static int read_cache(const char *path, const char *key) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char line[256];
+    int version = 0;
+    int ok = fgets(line, sizeof(line), f) && sscanf(line, "gravity-backend %d", &version) == 1 && version == 1;
+    ok = ok && fgets(line, sizeof(line), f) && !strncmp(line, "machine ", 8);
+    if (ok) {
+        line[strcspn(line, "\n")] = 0;
+        ok = !strcmp(line + 8, key);
+    }
+    int threads = 0;
+    ok = ok && fgets(line, sizeof(line), f) && sscanf(line, "threads %d", &threads) == 1 && threads > 0;
+
+    const ForceBackend *choice[PROBES];
+    for (int k = 0; ok && k < PROBES; ++k) {
+        int N;
+        char name[32];
+        ok = fgets(line, sizeof(line), f) && sscanf(line, "%d %31s", &N, name) == 2 && N == probe_sizes[k];
+        choice[k] = ok ? find_force_backend(name) : NULL;
+        ok = ok && choice[k] && choice[k]->exact && choice[k]->acc != acc_auto;
+    }
+    fclose(f);
+    if (!ok) {
+        return -1;
+    }
+
+    set_num_threads(threads);
+    memcpy(tuned, choice, sizeof(tuned));
+    return 0;
+}
+
+static int write_cache(const char *path, const char *key) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "gravity-backend 1\nmachine %s\nthreads %d\n", key, get_num_threads());
+    for (int k = 0; k < PROBES; ++k) {
+        fprintf(f, "%d %s\n", probe_sizes[k], tuned[k]->name);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// A disc of N equal masses on a sunflower spiral, which leaves the state of rand() alone.
+static Universe* probe_universe(int N) {
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = N;
+    uni->p = calloc(N, sizeof(Vector));
+    uni->v = calloc(N, sizeof(Vector));
+    uni->m = calloc(N, sizeof(double));
+    for (int i = 0; i < N; ++i) {
+        double r = 1e+9 * sqrt((i + 0.5) / N);
+        double phi = i * 2.399963229728653;  // the golden angle
+        uni->p[i] = (Vector) { r * cos(phi), r * sin(phi) };
+        uni->m[i] = 1e+24;
+    }
+    return uni;
+}
+
+// The best time per call of f over a few batches of about a million pair terms.
+static double probe(acc_fn f, const Universe *uni, Vector *a) {
+    int calls = max(1, (int)(1e+6 / ((double)uni->N * uni->N)));
+    double best = INFINITY;
+    for (int batch = 0; batch < 3; ++batch) {
+        double start = now();
+        for (int c = 0; c < calls; ++c) {
+            f(uni, a);
+        }
+        best = min(best, (now() - start) / calls);
+    }
+    return best;
+}
+
+static void run_probe(void) {
+    Vector *a = calloc(probe_sizes[PROBES - 1], sizeof(Vector));
+
+    // The thread count first, 1, 2, 4, ... and all CPUs, on the largest N, where
+    // threads pay off the most.
+    Universe *uni = probe_universe(probe_sizes[PROBES - 1]);
+    int cpus = max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+    int best_threads = 1;
+    double best = INFINITY;
+    for (int threads = 1; ; threads = min(2 * threads, cpus)) {
+        set_num_threads(threads);
+        double t = probe(acc_parallel, uni, a);
+        if (t < best) {
+            best = t;
+            best_threads = threads;
+        }
+        if (threads == cpus) {
+            break;
+        }
+    }
+    set_num_threads(best_threads);
+    destroy_universe(uni);
+
+    for (int k = 0; k < PROBES; ++k) {
+        uni = probe_universe(probe_sizes[k]);
+        best = INFINITY;
+        for (int b = 0; b < CANDIDATES; ++b) {
+            double t = probe(backends[b].acc, uni, a);
+            if (t < best) {
+                best = t;
+                tuned[k] = &backends[b];
+            }
+        }
+        destroy_universe(uni);
+    }
+    free(a);
+}
+
+int tune_force_backend(const char *cache) {
+    const char *name = getenv("GRAVITY_BACKEND");
+    if (name && find_force_backend(name)) {
+        select_force_backend(find_force_backend(name));
+        return 0;
+    }
+    if (name) {
+        fprintf(stderr, "GRAVITY_BACKEND: unknown backend %s, use one of", name);
+        for (int b = 0; b < BACKENDS; ++b) {
+            fprintf(stderr, " %s", backends[b].name);
+        }
+        fprintf(stderr, "\n");
+    }
+    select_force_backend(find_force_backend("auto"));
+
+    char key[128];
+    char path[4096];
+    machine(key, sizeof(key));
+    int have_path = cache_path(cache, path, sizeof(path)) == 0;
+    if (have_path && read_cache(path, key) == 0) {
+        return 0;
+    }
+
+    run_probe();
+    return have_path && write_cache(path, key) == 0 ? 1 : -1;
+}
@@ -0,0 +1,56 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "gravity.h"
+
+// A force calculation with everything the steppers take from it. Integrators created
+// with create_integrator() and block steppers use the selected backend, so a program
+// picks its forces once, at startup, instead of at every place that steps.
+typedef struct ForceBackend {
+    const char *name;
+    acc_fn acc;
+    acc_pot_fn acc_pot;          // the same forces and the potentials, or NULL
+    acc_partial_fn acc_partial;  // the forces on some objects only
+    int exact;                   // 1 if the forces are those of acc() up to rounding
+} ForceBackend;
+
+// Only "direct" may be called from several threads at once. All others keep their
+// scratch space, trees or meshes in static variables, "parallel" included, as calls
+// from inside the thread pool share its first block. Code that computes forces on
+// threads of its own, like parareal_integrate(), has to use "direct".
+
+// The backend by name: "direct", "vectorized", "parallel", "mixed", "barnes_hut",
+// "fmm", "pm", or "auto", which hands every call to the exact backend that
+// tune_force_backend() found fastest for the number of objects. "auto" has no acc_pot,
+// which only "direct" has, as the steppers would send the last stage of every step to
+// it; integrator_conserved() sums the potential energy itself instead. Backends
+// without partial forces of their own use acc_partial(). Returns NULL for an unknown
+// name.
+const ForceBackend* find_force_backend(const char *name);
+
+// The selected backend, "direct" until select_force_backend() or tune_force_backend().
+const ForceBackend* force_backend(void);
+
+// NULL selects "direct".
+void select_force_backend(const ForceBackend *backend);
+
+// The widest vector instructions of this CPU the kernels can use: "avx512", "avx2"
+// (with FMA), "sse2" or "scalar".
+const char* cpu_isa(void);
+
+// Select "auto", tuned for this machine. With GRAVITY_BACKEND set to the name of a
+// backend, select that one instead; an unknown name is reported on stderr. Otherwise
+// read the choices from the cache file, if it was written on a machine with the same
+// CPU, vector instructions and number of CPUs. Otherwise probe: time acc_parallel()
+// for thread counts up to the number of CPUs, keep the fastest count with
+// set_num_threads(), then time every exact backend at a range of N, which takes about
+// a second, and write the cache. The cache file is the path given, or with NULL
+// $GRAVITY_BACKEND_CACHE, $XDG_CACHE_HOME/gravity-backend or ~/.cache/gravity-backend,
+// whose directory is created if need be. Returns 0 if nothing was probed, 1 if the probe ran and
+// was cached, and −1 if it could not be cached.
+int tune_force_backend(const char *cache);
+
+// The backend "auto" uses for N objects.
+const ForceBackend* tuned_force_backend(int N);
+
+#endif /* BACKEND_H */
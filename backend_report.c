@@ -0,0 +1,57 @@
+#include "backend.h"
+#include "gravity.h"
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Tune the force backends for this machine, or load the tuning from the cache, then
+// time every exact backend and "auto" on random universes of growing size. "auto"
+// should be about as fast as the fastest of the others at every N.
+// usage: backend_report [cache file]
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static const char *names[] = { "direct", "vectorized", "parallel", "auto" };
+
+#define NAMES (int)(sizeof(names) / sizeof(names[0]))
+
+int main(int argc, char **argv) {
+    double start = now();
+    int tuned = tune_force_backend(argc > 1 ? argv[1] : NULL);
+    printf("%s in %.3f s, %s, %d threads\n\n", tuned > 0 ? "tuned" : tuned == 0 ? "loaded or overridden" : "tuned, not cached",
+        now() - start, cpu_isa(), get_num_threads());
+
+    printf("%6s %-10s", "N", "auto uses");
+    for (int b = 0; b < NAMES; ++b) {
+        printf(" %12s", names[b]);
+    }
+    printf("  µs per call\n");
+
+    for (int N = 16; N <= 8192; N *= 2) {
+        srand(1);
+        Universe *uni = create_random_universe(N);
+        Vector *a = calloc(N, sizeof(Vector));
+        int calls = max(1, (int)(2e+7 / ((double)N * N)));
+        printf("%6d %-10s", N, tuned_force_backend(N)->name);
+        for (int b = 0; b < NAMES; ++b) {
+            acc_fn f = find_force_backend(names[b])->acc;
+            f(uni, a);
+            start = now();
+            for (int c = 0; c < calls; ++c) {
+                f(uni, a);
+            }
+            printf(" %12.2f", (now() - start) / calls * 1e+6);
+        }
+        printf("\n");
+        free(a);
+        destroy_universe(uni);
+    }
+    return 0;
+}
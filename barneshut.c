@@ -0,0 +1,211 @@
+#include "barneshut.h"
+#include "gravity.h"
+#include "stats.h"
+#include "vmath.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Coincident bodies would otherwise split forever. Below this depth bodies
+// are chained together in the same leaf.
+#define MAX_DEPTH 48
+
+typedef struct Node {
+    double cx, cy;      // centre of the square
+    double half;        // half of the width
+    double mass;        // ∑ mᵢ
+    double abs_mass;    // ∑ |mᵢ|, to detect cancelling negative masses
+    double mx, my;      // ∑ mᵢ ⋅ pᵢ, divided by the mass once the tree is built
+    int child;          // index of the first of four children, or -1 for a leaf
+    int body;           // first body in a leaf, or -1 if empty
+} Node;
+
+static double theta = 0.5;
+
+// The tree is rebuilt on every call, but the memory is kept around.
+static Node *nodes = NULL;
+static int node_cap = 0;
+static int node_count = 0;
+static int *next_body = NULL;
+static int body_cap = 0;
+
+void set_barnes_hut_theta(double t) {
+    theta = t;
+}
+
+double get_barnes_hut_theta(void) {
+    return theta;
+}
+
+static int new_node(double cx, double cy, double half) {
+    if (node_count == node_cap) {
+        node_cap = node_cap ? 2 * node_cap : 1024;
+        nodes = realloc(nodes, node_cap * sizeof(Node));
+    }
+    nodes[node_count] = (Node) { cx, cy, half, 0, 0, 0, 0, -1, -1 };
+    return node_count++;
+}
+
+static int quadrant(const Node *n, Vector p) {
+    return (p.x >= n->cx) + 2 * (p.y >= n->cy);
+}
+
+static void split(int n) {
+    double h = nodes[n].half / 2;
+    double cx = nodes[n].cx;
+    double cy = nodes[n].cy;
+
+    // new_node may move the array, so don't hold on to pointers.
+    int first = new_node(cx - h, cy - h, h);
+    new_node(cx + h, cy - h, h);
+    new_node(cx - h, cy + h, h);
+    new_node(cx + h, cy + h, h);
+    nodes[n].child = first;
+}
+
+static void insert(const Universe *uni, int i) {
+    int n = 0;
+    int depth = 0;
+
+    for (;;) {
+        nodes[n].mass += uni->m[i];
+        nodes[n].abs_mass += fabs(uni->m[i]);
+        nodes[n].mx += uni->m[i] * uni->p[i].x;
+        nodes[n].my += uni->m[i] * uni->p[i].y;
+
+        if (nodes[n].child >= 0) {
+            n = nodes[n].child + quadrant(&nodes[n], uni->p[i]);
+            ++depth;
+            continue;
+        }
+
+        if (nodes[n].body < 0 || depth >= MAX_DEPTH) {
+            next_body[i] = nodes[n].body;
+            nodes[n].body = i;
+            return;
+        }
+
+        // Occupied leaf: push the resident body one level down and try again.
+        int other = nodes[n].body;
+        nodes[n].body = -1;
+        split(n);
+
+        int c = nodes[n].child + quadrant(&nodes[n], uni->p[other]);
+        nodes[c].mass = uni->m[other];
+        nodes[c].abs_mass = fabs(uni->m[other]);
+        nodes[c].mx = uni->m[other] * uni->p[other].x;
+        nodes[c].my = uni->m[other] * uni->p[other].y;
+        nodes[c].body = other;
+        next_body[other] = -1;
+
+        n = nodes[n].child + quadrant(&nodes[n], uni->p[i]);
+        ++depth;
+    }
+}
+
+static void build_tree(const Universe *uni) {
+    if (uni->N > body_cap) {
+        body_cap = uni->N;
+        next_body = realloc(next_body, body_cap * sizeof(int));
+    }
+
+    double xmin = uni->p[0].x, xmax = uni->p[0].x;
+    double ymin = uni->p[0].y, ymax = uni->p[0].y;
+    for (int i = 1; i < uni->N; ++i) {
+        xmin = min(xmin, uni->p[i].x);
+        xmax = max(xmax, uni->p[i].x);
+        ymin = min(ymin, uni->p[i].y);
+        ymax = max(ymax, uni->p[i].y);
+    }
+
+    // Pad the root a little so that the bodies on the edge fall inside.
+    double half = max(xmax - xmin, ymax - ymin) / 2 * 1.0001 + 1e-9;
+
+    node_count = 0;
+    new_node((xmin + xmax) / 2, (ymin + ymax) / 2, half);
+    for (int i = 0; i < uni->N; ++i) {
+        insert(uni, i);
+    }
+
+    for (int n = 0; n < node_count; ++n) {
+        if (nodes[n].mass != 0) {
+            nodes[n].mx /= nodes[n].mass;
+            nodes[n].my /= nodes[n].mass;
+        }
+    }
+}
+
+// A node can be treated as a point mass if it is far enough away, the body is
+// not inside of it, and its masses don't (nearly) cancel out. The last one only
+// happens with negative masses, where the centre of mass can lie far outside of the node.
+static int accept(const Node *n, Vector p, double dx, double dy) {
+    if (fabs(p.x - n->cx) <= n->half && fabs(p.y - n->cy) <= n->half) {
+        return 0;
+    }
+    if (fabs(n->mass) < 0.5 * n->abs_mass) {
+        return 0;
+    }
+    double s = 2 * n->half;
+    return s * s < theta * theta * (dx*dx + dy*dy);
+}
+
+// Calculate the accelerations with the Barnes-Hut approximation.
+// Nodes of width s at distance d with s / d < θ are replaced by their total mass at their centre of mass.
+// ### aᵢ ≈ ∑ₙ Mₙ ⋅ (cₙ − pᵢ) / d(cₙ, pᵢ)³
+void acc_barnes_hut(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_BARNES_HUT, 0);
+    memset(a, 0, sizeof(Vector) * uni->N);
+    if (uni->N < 2) {
+        return;
+    }
+
+    build_tree(uni);
+
+    int stack[4 * MAX_DEPTH + 8];
+    for (int i = 0; i < uni->N; ++i) {
+        Vector p = uni->p[i];
+        double ax = 0;
+        double ay = 0;
+
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node *n = &nodes[stack[--top]];
+            if (n->abs_mass == 0) {
+                continue;
+            }
+
+            if (n->child < 0) {
+                for (int j = n->body; j >= 0; j = next_body[j]) {
+                    if (j == i) {
+                        continue;
+                    }
+                    double dx = uni->p[j].x - p.x;
+                    double dy = uni->p[j].y - p.y;
+                    double d3 = 1.0 / sqrt(dx*dx + dy*dy);
+                    d3 = d3 * d3 * d3;
+                    ax += d3 * uni->m[j] * dx;
+                    ay += d3 * uni->m[j] * dy;
+                }
+                continue;
+            }
+
+            double dx = n->mx - p.x;
+            double dy = n->my - p.y;
+            if (accept(n, p, dx, dy)) {
+                double d3 = 1.0 / sqrt(dx*dx + dy*dy);
+                d3 = d3 * d3 * d3;
+                ax += d3 * n->mass * dx;
+                ay += d3 * n->mass * dy;
+            } else {
+                for (int c = 0; c < 4; ++c) {
+                    stack[top++] = n->child + c;
+                }
+            }
+        }
+
+        a[i].x = G * ax;
+        a[i].y = G * ay;
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include "gravity.h"
+
+// Set the opening angle θ. A node of width s at distance d is used as a single
+// point mass when s / d < θ. θ = 0 degenerates to the direct sum.
+void set_barnes_hut_theta(double theta);
+
+double get_barnes_hut_theta(void);
+
+void acc_barnes_hut(const Universe *uni, Vector *a);
+
+#endif /* BARNESHUT_H */
@@ -1,62 +1,296 @@
-#include "steppers.h"
+#include "integrate.h"
+#include "gravity.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "mixed.h"
+#include "parallel.h"
+#include "pm.h"
+#include "soa.h"
+#include "threadpool.h"
 
-#include <time.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0ULL
+#endif
+
+// Benchmark suite for the force backends and the steppers. Every result is one
+// record, written as CSV (the default) or JSON, so runs of different versions can
+// be compared by script.
+//
+// forces:   the time per call of every backend over a sweep of N, with the
+//           error against acc() where acc() is affordable. For the backends below
+//           O(N²), ns per pair and GFLOP/s are effective numbers: what the direct
+//           sum would need to reach the same speed.
+// steppers: a planetary system integrated for 30 days with every method at three
+//           accuracy settings, for the energy error against the cost: the
+//           tolerance of the adaptive methods, η of hermite, which picks its own
+//           steps, and the step size of the other fixed step methods
+//
+// usage: bench [--json] [--quick] [--max-n N] [--threads T]
+
+
+// The flops of one pair interaction in acc(), counting the square root and the
+// division as one each: 2 for the differences, 3 for d², 2 for 1/d, 2 for 1/d³ and
+// 5 for the update of each of the two objects.
+#define FLOPS_PER_PAIR 19
 
+#define REPETITIONS 5
+#define MIN_REPETITION_SECONDS 0.02
 
-Universe* create_random_universe(int N) {
-    Universe *uni = calloc(1, sizeof(Universe));
-    Vector *p = calloc(N, sizeof(Vector));
-    Vector *v = calloc(N, sizeof(Vector));
-    double *m = calloc(N, sizeof(double));
+// O(N²) backends are skipped when a call would take more pairs than this.
+#define MAX_DIRECT_PAIRS 5e+9
+// The error against acc() is only measured up to this N.
+#define MAX_REFERENCE_N 20000
 
+typedef struct Record {
+    const char *kind;
+    const char *name;
+    int N;
+    double setting;      // h or tol for steppers
+    double seconds;      // per call for forces, per run for steppers
+    double cycles;
+    long calls;          // force evaluations
+    long steps;
+    double error;        // rms force error, or relative energy error; NaN if not measured
+} Record;
+
+static int json = 0;
+static int records = 0;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double pairs(int N) {
+    return (double)N * (N - 1) / 2;
+}
+
+static void print_number(const char *key, double x, const char *sep) {
+    if (json && isfinite(x)) {
+        printf("\"%s\": %.6g%s", key, x, sep);
+    } else if (json) {
+        printf("\"%s\": null%s", key, sep);
+    } else if (isfinite(x)) {
+        printf("%.6g%s", x, sep);
+    } else {
+        printf("%s", sep);
+    }
+}
+
+static void emit(const Record *r) {
+    double ns_per_pair = r->seconds / max(r->calls, 1L) / pairs(r->N) * 1e+9;
+    double gflops = FLOPS_PER_PAIR / ns_per_pair;
+    double steps_per_second = r->steps > 0 ? r->steps / r->seconds : NAN;
+
+    if (json) {
+        printf("%s\n    {\"kind\": \"%s\", \"name\": \"%s\", \"N\": %d, ",
+            records ? "," : "", r->kind, r->name, r->N);
+    } else {
+        printf("%s,%s,%d,", r->kind, r->name, r->N);
+    }
+    print_number("setting", r->setting, json ? ", " : ",");
+    print_number("seconds", r->seconds, json ? ", " : ",");
+    print_number("cycles", r->cycles, json ? ", " : ",");
+    print_number("calls", r->calls, json ? ", " : ",");
+    print_number("steps", r->steps, json ? ", " : ",");
+    print_number("ns_per_pair", ns_per_pair, json ? ", " : ",");
+    print_number("gflops", gflops, json ? ", " : ",");
+    print_number("steps_per_second", steps_per_second, json ? ", " : ",");
+    print_number("error", r->error, json ? "}" : "\n");
+    fflush(stdout);
+    ++records;
+}
+
+static const struct {
+    const char *name;
+    acc_fn acc;
+    int quadratic;  // costs O(N²)
+} backends[] = {
+    { "direct", acc, 1 },
+    { "parallel", acc_parallel, 1 },
+    { "vectorized", acc_vectorized, 1 },
+    { "mixed", acc_mixed, 1 },
+    { "barnes_hut", acc_barnes_hut, 0 },
+    { "fmm", acc_fmm, 0 },
+    { "pm", acc_pm, 0 },
+};
+
+static double rms_error(const Vector *approx, const Vector *exact, int N) {
+    double sq_err = 0;
+    double sq_norm = 0;
     for (int i = 0; i < N; ++i) {
-        p[i] = (Vector) { uniform(-1e+9, 1e+9), uniform(-1e+9, 1e+9) };
-        v[i] = (Vector) { uniform(-3e+2, 3e+2), uniform(-3e+2, 3e+2) };
-        m[i] = uniform(-1e+22, 1e+25);
+        double dx = approx[i].x - exact[i].x;
+        double dy = approx[i].y - exact[i].y;
+        sq_err += dx*dx + dy*dy;
+        sq_norm += exact[i].x * exact[i].x + exact[i].y * exact[i].y;
     }
+    return sqrt(sq_err / sq_norm);
+}
 
-    uni->p = p;
-    uni->v = v;
-    uni->m = m;
-    uni->N = N;
-    return uni;
+// One warmup call, then REPETITIONS repetitions of as many calls as take at least
+// MIN_REPETITION_SECONDS. The median repetition counts.
+static void time_calls(acc_fn f, const Universe *uni, Vector *a, double *seconds, double *cyc) {
+    double start = now();
+    f(uni, a);
+    double once = now() - start;
+    int calls = max(1, (int)(MIN_REPETITION_SECONDS / max(once, 1e-9)));
+
+    double s[REPETITIONS], c[REPETITIONS];
+    for (int r = 0; r < REPETITIONS; ++r) {
+        unsigned long long c0 = cycles();
+        double t0 = now();
+        for (int k = 0; k < calls; ++k) {
+            f(uni, a);
+        }
+        s[r] = (now() - t0) / calls;
+        c[r] = (double)(cycles() - c0) / calls;
+    }
+
+    // Insertion sort; the cycles go along with their times.
+    for (int i = 1; i < REPETITIONS; ++i) {
+        for (int j = i; j > 0 && s[j] < s[j - 1]; --j) {
+            double t = s[j]; s[j] = s[j - 1]; s[j - 1] = t;
+            t = c[j]; c[j] = c[j - 1]; c[j - 1] = t;
+        }
+    }
+    *seconds = s[REPETITIONS / 2];
+    *cyc = c[REPETITIONS / 2];
+}
+
+static void bench_forces(int max_n) {
+    static const int sizes[] = { 3, 10, 30, 100, 300, 1000, 3000, 10000, 30000, 100000, 300000, 1000000 };
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])) && sizes[s] <= max_n; ++s) {
+        int N = sizes[s];
+        srand(1);
+        Universe *uni = create_random_universe(N);
+        Vector *a = calloc(N, sizeof(Vector));
+        Vector *exact = NULL;
+        if (N <= MAX_REFERENCE_N) {
+            exact = calloc(N, sizeof(Vector));
+            acc(uni, exact);
+        }
+
+        for (int b = 0; b < (int)(sizeof(backends) / sizeof(backends[0])); ++b) {
+            if (backends[b].quadratic && pairs(N) > MAX_DIRECT_PAIRS) {
+                continue;
+            }
+            Record r = { .kind = "force", .name = backends[b].name, .N = N, .setting = NAN };
+            time_calls(backends[b].acc, uni, a, &r.seconds, &r.cycles);
+            r.calls = 1;
+            r.error = exact ? rms_error(a, exact, N) : NAN;
+            emit(&r);
+        }
+
+        free(exact);
+        free(a);
+        destroy_universe(uni);
+    }
 }
 
-void destroy_universe(Universe *uni) {
-    free(uni->p);
-    free(uni->v);
-    free(uni->m);
-    free(uni);
+static long calls = 0;
+
+static void counting_acc(const Universe *uni, Vector *a) {
+    ++calls;
+    acc(uni, a);
+}
+
+// The force evaluations of the Hermite stepper.
+static void counting_acc_jerk(const Universe *uni, Vector *a, Vector *jerk) {
+    ++calls;
+    acc_jerk(uni, a, jerk);
 }
 
+static void bench_steppers(int max_n) {
+    static const int sizes[] = { 3, 30, 300, 1000 };
+    static const double tolerances[] = { 1e-6, 1e-9, 1e-12 };
+    static const double steps[] = { 86400, 86400 / 4.0, 86400 / 16.0 };
+    static const double etas[] = { 0.02, 0.01, 0.005 };
+    const double t_end = 30 * 86400;
 
-int main() {
-    // srand(time(NULL));
-    
-    int iters = 1000000;
-    int N = 20;
-    Universe *uni = create_random_universe(N);
-    double start_energy = total_energy(uni);
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])) && sizes[s] <= max_n; ++s) {
+        int N = sizes[s];
+        for (Method m = 0; m < METHOD_COUNT; ++m) {
+            for (int k = 0; k < 3; ++k) {
+                srand(1);
+                Universe *uni = create_planetary_system(N);
+                Integrator *ctx = create_integrator(N);
+                integrator_set_acc(ctx, counting_acc);
+                integrator_set_acc_jerk(ctx, counting_acc_jerk);
+                int adaptive = method_order(m) > 0;
+                double setting = adaptive ? tolerances[k] : m == METHOD_HERMITE ? etas[k] : steps[k];
+                if (m == METHOD_HERMITE) {
+                    ctx->eta = setting;
+                } else {
+                    ctx->h = adaptive ? 0 : setting;
+                }
 
-    clock_t start = clock();
-    
-    double time_passed = 0;
-    double h = 20.0;
-    for (int i = 0; i < iters; ++i) {
-        time_passed += h;
-        h = step_rkn45(uni, h);
+                double e0 = total_energy(uni);
+                calls = 0;
+                unsigned long long c0 = cycles();
+                double t0 = now();
+                long n = integrate(ctx, uni, t_end, adaptive ? setting : ctx->tol, m);
+                Record r = { .kind = "stepper", .name = method_name(m), .N = N, .setting = setting,
+                             .seconds = now() - t0, .cycles = (double)(cycles() - c0) };
+                r.calls = calls;
+                r.steps = n;
+                r.error = n < 0 ? NAN : fabs((total_energy(uni) - e0) / e0);
+                emit(&r);
+
+                destroy_integrator(ctx);
+                destroy_universe(uni);
+            }
+        }
     }
+}
 
-    clock_t end = clock();
+int main(int argc, char **argv) {
+    int quick = 0;
+    int max_n = 1000000;
+    int threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else if (!strcmp(argv[i], "--quick")) {
+            quick = 1;
+        } else if (!strcmp(argv[i], "--max-n") && i + 1 < argc) {
+            max_n = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--max-n N] [--threads T]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (quick) {
+        max_n = min(max_n, 10000);
+    }
+    set_num_threads(threads);
 
-    double real_time = (double)(end - start) / CLOCKS_PER_SEC;
-    double error = (total_energy(uni) - start_energy) / start_energy;
-    time_passed /= 86400;
+    if (json) {
+        printf("{\"threads\": %d, \"simd\": \"%s\", \"flops_per_pair\": %d, \"compiler\": \"%s\",\n"
+               " \"results\": [", get_num_threads(), acc_soa_path(), FLOPS_PER_PAIR, __VERSION__);
+    } else {
+        printf("# threads %d, simd %s, flops per pair %d, compiler %s\n",
+            get_num_threads(), acc_soa_path(), FLOPS_PER_PAIR, __VERSION__);
+        printf("kind,name,N,setting,seconds,cycles,calls,steps,ns_per_pair,gflops,steps_per_second,error\n");
+    }
 
-    printf("Simulated %f days in %f real seconds (error %E)\n", time_passed, real_time, error);
-    printf("Average %f simulated seconds per second (@%f iters/sec).\n", time_passed / real_time, iters / real_time);
+    bench_forces(max_n);
+    bench_steppers(min(max_n, quick ? 300 : 1000));
 
-    destroy_universe(uni);
+    if (json) {
+        printf("\n]}\n");
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -3,35 +3,62 @@ import numpy as np
 import timeit
 import time
 
+# Build gravitylib.so first, see the top of gravitylib.c.
+
 G = 6.67430e-11
-total_t = ctypes.c_long()
-
-class Vector(ctypes.Structure):
-    _fields_ = [("x", ctypes.c_double), ("y", ctypes.c_double)]
-
-_gravity = ctypes.CDLL("./gravitylib.so", winmode=2)
-_gravity.acc.argtypes = [
-    np.ctypeslib.ndpointer([('x', '<f8'), ('y', '<f8')], 1, flags='C_CONTIGUOUS'),
-    np.ctypeslib.ndpointer(np.double, 1, flags='C_CONTIGUOUS'),
-    ctypes.c_int,
-    np.ctypeslib.ndpointer([('x', '<f8'), ('y', '<f8')], 1, flags='C_CONTIGUOUS'),
-    #ctypes.POINTER(ctypes.c_long)
-]
-
-_gravity.acc_x_n.argtypes = [
-    np.ctypeslib.ndpointer([('x', '<f8'), ('y', '<f8')], 1, flags='C_CONTIGUOUS'),
-    np.ctypeslib.ndpointer(np.double, 1, flags='C_CONTIGUOUS'),
-    ctypes.c_int,
-    np.ctypeslib.ndpointer([('x', '<f8'), ('y', '<f8')], 1, flags='C_CONTIGUOUS'),
-    #ctypes.POINTER(ctypes.c_long),
-    ctypes.c_int
-]
-_gravity.acc_x_n.restype = ctypes.c_long
-
-def c_acc(x, m, N):
-    a = np.empty_like(x)
-    _gravity.acc(x, m, N, a)
-    return a
+
+# Positions, velocities and accelerations are (N, 2) float64 arrays, masses (N,) float64.
+# They stay owned by NumPy; the library works on them in place.
+vectors = np.ctypeslib.ndpointer(np.double, 2, flags='C_CONTIGUOUS')
+scalars = np.ctypeslib.ndpointer(np.double, 1, flags='C_CONTIGUOUS')
+
+_gravity = ctypes.CDLL("./gravitylib.so")
+_gravity.gravity_api_version.restype = ctypes.c_int
+_gravity.gravity_create.argtypes = [ctypes.c_int, vectors, vectors, scalars, ctypes.c_double]
+_gravity.gravity_create.restype = ctypes.c_void_p
+_gravity.gravity_destroy.argtypes = [ctypes.c_void_p]
+_gravity.gravity_set_method.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_gravity.gravity_set_backend.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_gravity.gravity_set_tolerance.argtypes = [ctypes.c_void_p, ctypes.c_double]
+_gravity.gravity_set_step.argtypes = [ctypes.c_void_p, ctypes.c_double]
+_gravity.gravity_time.argtypes = [ctypes.c_void_p]
+_gravity.gravity_time.restype = ctypes.c_double
+_gravity.gravity_step.argtypes = [ctypes.c_void_p, ctypes.c_long]
+_gravity.gravity_step.restype = ctypes.c_long
+_gravity.gravity_advance_to.argtypes = [ctypes.c_void_p, ctypes.c_double]
+_gravity.gravity_advance_to.restype = ctypes.c_long
+_gravity.gravity_acc.argtypes = [ctypes.c_void_p, vectors]
+_gravity.gravity_conserved.argtypes = [ctypes.c_void_p, scalars]
+
+assert _gravity.gravity_api_version() == 1
+
+
+class System:
+    def __init__(self, p, v, m, method="rkn45", tol=1e-9):
+        # Keep references, so the arrays outlive the handle.
+        self.p, self.v, self.m = p, v, m
+        self.handle = _gravity.gravity_create(len(m), p, v, m, 0.0)
+        if _gravity.gravity_set_method(self.handle, method.encode()) != 0:
+            raise ValueError("unknown method " + method)
+        _gravity.gravity_set_tolerance(self.handle, tol)
+
+    def __del__(self):
+        _gravity.gravity_destroy(self.handle)
+
+    def acc(self, a):
+        _gravity.gravity_acc(self.handle, a)
+
+    def step(self, K):
+        return _gravity.gravity_step(self.handle, K)
+
+    def advance_to(self, t_end):
+        return _gravity.gravity_advance_to(self.handle, t_end)
+
+    def energy(self):
+        out = np.empty(6)
+        _gravity.gravity_conserved(self.handle, out)
+        return out[0]
+
 
 def py_acc(x, m):
     r = x[np.newaxis, :, :] - x[:, np.newaxis, :]
@@ -43,28 +70,40 @@ def py_acc(x, m):
 
 def main():
     N = 1000
-    # c_x = np.array([(0, 0), (0, 3.85e+8)], dtype=[('x', '<f8'), ('y', '<f8')])
-    c_xx = np.random.uniform(-1e+9, 1e+9, N)
-    c_xy = np.random.uniform(-1e+9, 1e+9, N)
-    c_x = np.array(list(zip(c_xx, c_xy)), dtype=[('x', '<f8'), ('y', '<f8')])
-    #print(c_x)
-    # v = np.array([(0, 0), (1022, 0)], dtype=[('x', '<f8'), ('y', '<f8')])
-    #m = np.array([5.9724e+24, 0.07346e+24])
+    p = np.random.uniform(-1e+9, 1e+9, (N, 2))
+    v = np.random.uniform(-3e+2, 3e+2, (N, 2))
     m = np.random.uniform(1e+22, 1e+26, N)
 
-    c_t = timeit.timeit("c_acc(c_x, m, 2)", globals={"c_acc": c_acc, "c_x": c_x, "m": m}, number=100_000)
-    print("C with python calls:", c_t / 100_000)
+    system = System(p, v, m)
+    a = np.empty_like(p)
+    system.acc(a)
+    print("max relative difference C - NumPy:", np.max(np.abs(a - py_acc(p, m)) / np.abs(a)))
 
-    py_x = np.array(list(zip(c_xx, c_xy)))
-    py_t = timeit.timeit("py_acc(py_x, m)", globals={"py_acc": py_acc, "py_x": py_x, "m": m}, number=1_00)
-    print("Pure python:", py_t / 1_00)
+    c_t = timeit.timeit("system.acc(a)", globals={"system": system, "a": a}, number=100)
+    print("C acc() through ctypes:", c_t / 100)
+
+    py_t = timeit.timeit("py_acc(p, m)", globals={"py_acc": py_acc, "p": p, "m": m}, number=10)
+    print("NumPy acc():", py_t / 10)
+
+    # A small system, where the call overhead would dominate if every stage crossed into C.
+    N = 20
+    p = np.random.uniform(-1e+9, 1e+9, (N, 2))
+    v = np.random.uniform(-3e+2, 3e+2, (N, 2))
+    m = np.random.uniform(1e+22, 1e+25, N)
+    system = System(p, v, m)
+    e0 = system.energy()
+
+    steps = 100_000
+    start = time.time()
+    system.step(steps)
+    seconds = time.time() - start
+    print("rkn45, %d steps in one call: %g s per step, energy error %E"
+          % (steps, seconds / steps, (system.energy() - e0) / e0))
 
     start = time.time()
-    a = np.empty_like(c_x)
-    it = _gravity.acc_x_n(c_x, m, 2, a, 100_000)
-    end = time.time() - start
-    print("Pure C:", end / 100_000, it / 10**11)
+    for _ in range(1000):
+        system.step(1)
+    print("rkn45, one step per call: %g s per step" % ((time.time() - start) / 1000))
 
-    print(total_t.value)
 
-main()
\ No newline at end of file
+main()
@@ -0,0 +1,70 @@
+#include "gravity.h"
+#include "barneshut.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Accuracy and speed of the Barnes-Hut approximation for a range of opening angles,
+// compared against the direct sum acc().
+// usage: bh_report [N]
+
+
+static double seconds_per_call(acc_fn f, const Universe *uni, Vector *a) {
+    int calls = 0;
+    clock_t start = clock();
+    do {
+        f(uni, a);
+        ++calls;
+    } while (clock() - start < CLOCKS_PER_SEC / 4);
+    return (double)(clock() - start) / CLOCKS_PER_SEC / calls;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 10000;
+
+    Universe *uni = create_random_universe(N);
+    Vector *exact = calloc(N, sizeof(Vector));
+    Vector *approx = calloc(N, sizeof(Vector));
+    double *errors = calloc(N, sizeof(double));
+
+    double direct_time = seconds_per_call(acc, uni, exact);
+    printf("N = %d, direct acc(): %.3f ms per call\n\n", N, direct_time * 1e+3);
+    printf("theta   ms/call  speedup   median err      90%% err        max err  rms force err\n");
+
+    for (int t = 0; t <= 12; ++t) {
+        double theta = t / 10.0;
+        set_barnes_hut_theta(theta);
+        double time = seconds_per_call(acc_barnes_hut, uni, approx);
+
+        // Relative error per body, and the error relative to the rms acceleration.
+        double sq_err = 0;
+        double sq_norm = 0;
+        for (int i = 0; i < N; ++i) {
+            double dx = approx[i].x - exact[i].x;
+            double dy = approx[i].y - exact[i].y;
+            double e = sqrt(dx*dx + dy*dy);
+            errors[i] = e / length(exact[i]);
+            sq_err += e * e;
+            sq_norm += exact[i].x * exact[i].x + exact[i].y * exact[i].y;
+        }
+        qsort(errors, N, sizeof(double), compare_doubles);
+
+        printf("%5.2f %10.3f %8.2f %12.3E %12.3E %12.3E %12.3E\n",
+            theta, time * 1e+3, direct_time / time,
+            errors[N / 2], errors[N * 9 / 10], errors[N - 1], sqrt(sq_err / sq_norm));
+    }
+
+    free(errors);
+    free(approx);
+    free(exact);
+    destroy_universe(uni);
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "block.h"
+#include "backend.h"
+#include "gravity.h"
+#include "vmath.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+BlockStepper* create_block_stepper(int N, int max_rung, double eta) {
+    BlockStepper *bs = calloc(1, sizeof(BlockStepper));
+    bs->N = N;
+    bs->max_rung = max_rung;
+    bs->eta = eta;
+    bs->acc_partial = force_backend()->acc_partial;
+    bs->rung = calloc(N, sizeof(int));
+    bs->active = calloc(N, sizeof(int));
+    bs->a = calloc(N, sizeof(Vector));
+    bs->a_old = calloc(N, sizeof(Vector));
+    return bs;
+}
+
+void destroy_block_stepper(BlockStepper *bs) {
+    free(bs->rung);
+    free(bs->active);
+    free(bs->a);
+    free(bs->a_old);
+    free(bs);
+}
+
+// The smallest rung whose step h_max / 2ᵏ is at most h, or the deepest one for h = 0,
+// as for an object without acceleration whose acceleration changes.
+static int rung_for(const BlockStepper *bs, double h_max, double h) {
+    if (!(h > 0)) {
+        return bs->max_rung;
+    }
+    if (!(h < h_max)) {
+        return 0;
+    }
+    int k = (int)ceil(log2(h_max / h));
+    return min(k, bs->max_rung);
+}
+
+// The step criterion h = η ⋅ |a| / |da/dt|: the time in which the acceleration changes
+// by a fraction η of itself.
+static double criterion(const BlockStepper *bs, Vector a, Vector jerk) {
+    double j = length(jerk);
+    return j > 0 ? bs->eta * length(a) / j : INFINITY;
+}
+
+// Assign the first rungs from the accelerations and their exact time derivatives, for
+// the softened distance s = √(d² + ε²) like the force kernels:
+// ### jᵢ = ∑ⱼ mⱼ ⋅ ((vⱼ − vᵢ) / s³ − 3 ((pⱼ − pᵢ) ⋅ (vⱼ − vᵢ)) (pⱼ − pᵢ) / s⁵)
+static void initialize(BlockStepper *bs, const Universe *uni, double h_max) {
+    for (int i = 0; i < uni->N; ++i) {
+        bs->active[i] = i;
+    }
+    bs->acc_partial(uni, bs->active, uni->N, bs->a);
+    bs->interactions += (long)uni->N * (uni->N - 1);
+    double eps2 = get_softening() * get_softening();
+
+    for (int i = 0; i < uni->N; ++i) {
+        Vector jerk = { 0, 0 };
+        for (int j = 0; j < uni->N; ++j) {
+            if (j == i) {
+                continue;
+            }
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double dvx = uni->v[j].x - uni->v[i].x;
+            double dvy = uni->v[j].y - uni->v[i].y;
+            double d2 = 1.0 / (dx*dx + dy*dy + eps2);
+            double d3 = d2 * sqrt(d2);
+            double rv = 3 * (dx*dvx + dy*dvy) * d2;
+
+            jerk.x += G * uni->m[j] * d3 * (dvx - rv * dx);
+            jerk.y += G * uni->m[j] * d3 * (dvy - rv * dy);
+        }
+        bs->rung[i] = rung_for(bs, h_max, criterion(bs, bs->a[i], jerk));
+    }
+    bs->initialized = 1;
+}
+
+void step_block(BlockStepper *bs, Universe *uni, double h_max) {
+    if (uni->N != bs->N) {
+        bs->N = uni->N;
+        bs->rung = realloc(bs->rung, uni->N * sizeof(int));
+        bs->active = realloc(bs->active, uni->N * sizeof(int));
+        bs->a = realloc(bs->a, uni->N * sizeof(Vector));
+        bs->a_old = realloc(bs->a_old, uni->N * sizeof(Vector));
+        bs->initialized = 0;
+    }
+    if (!bs->initialized) {
+        initialize(bs, uni, h_max);
+    }
+
+    // Time is counted in ticks of the smallest possible step. An object on rung k
+    // is kicked every 2^(max_rung − k) ticks.
+    const long ticks = 1L << bs->max_rung;
+    const double dt = h_max / ticks;
+    double t = uni->t;
+
+    int deepest = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        deepest = max(deepest, bs->rung[i]);
+    }
+
+    long T = 0;
+    while (T < ticks) {
+        // Opening half kick for every object whose step starts now.
+        // v = v + a * h/2
+        for (int i = 0; i < uni->N; ++i) {
+            long stride = ticks >> bs->rung[i];
+            if (T % stride == 0) {
+                double h = stride * dt;
+                uni->v[i].x += bs->a[i].x * h/2;
+                uni->v[i].y += bs->a[i].y * h/2;
+            }
+        }
+
+        // Everyone drifts to the next moment that some step ends.
+        // x = x + v * dt
+        long dT = ticks >> deepest;
+        for (int i = 0; i < uni->N; ++i) {
+            uni->p[i].x += uni->v[i].x * dT * dt;
+            uni->p[i].y += uni->v[i].y * dT * dt;
+        }
+        T += dT;
+        uni->t = t + T * dt;
+
+        int n = 0;
+        for (int i = 0; i < uni->N; ++i) {
+            if (T % (ticks >> bs->rung[i]) == 0) {
+                bs->active[n++] = i;
+                bs->a_old[i] = bs->a[i];
+            }
+        }
+        bs->acc_partial(uni, bs->active, n, bs->a);
+        bs->interactions += (long)n * (uni->N - 1);
+        ++bs->substeps;
+
+        // Closing half kick, and a new rung from how much the acceleration changed.
+        // An object may always move down; it may only move up one rung at a time,
+        // and only at a moment that is also the end of a step on the higher rung.
+        for (int k = 0; k < n; ++k) {
+            int i = bs->active[k];
+            long stride = ticks >> bs->rung[i];
+            double h = stride * dt;
+            uni->v[i].x += bs->a[i].x * h/2;
+            uni->v[i].y += bs->a[i].y * h/2;
+
+            Vector jerk = { (bs->a[i].x - bs->a_old[i].x) / h, (bs->a[i].y - bs->a_old[i].y) / h };
+            int r = rung_for(bs, h_max, criterion(bs, bs->a[i], jerk));
+            if (r > bs->rung[i]) {
+                bs->rung[i] = r;
+            } else if (r < bs->rung[i] && bs->rung[i] > 0 && T % (2 * stride) == 0) {
+                bs->rung[i] -= 1;
+            }
+        }
+
+        deepest = 0;
+        for (int i = 0; i < uni->N; ++i) {
+            deepest = max(deepest, bs->rung[i]);
+        }
+    }
+
+    uni->t = t + h_max;
+}
@@ -0,0 +1,33 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "gravity.h"
+
+// Hierarchical (block) individual time steps. Every object sits on a rung k and is
+// kicked with its own step h_max / 2ᵏ, while all objects drift together. Forces are
+// only recomputed for the objects whose step ends, so a few close pairs no longer
+// force every object onto the smallest step.
+typedef struct BlockStepper {
+    int N;
+    int max_rung;        // the smallest step is h_max / 2^max_rung
+    double eta;          // accuracy parameter of the step criterion
+    acc_partial_fn acc_partial;
+
+    int *rung;
+    int *active;         // scratch list of the objects whose step ends
+    Vector *a;           // the accelerations at the last force evaluation of every object
+    Vector *a_old;
+    int initialized;
+
+    long interactions;   // pair interactions computed so far
+    long substeps;       // force evaluations of (part of) the system so far
+} BlockStepper;
+
+BlockStepper* create_block_stepper(int N, int max_rung, double eta);
+
+void destroy_block_stepper(BlockStepper *bs);
+
+// Advance the Universe by h_max. All objects are synchronised at the start and end.
+void step_block(BlockStepper *bs, Universe *uni, double h_max);
+
+#endif /* BLOCK_H */
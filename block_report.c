@@ -0,0 +1,66 @@
+#include "block.h"
+#include "integrate.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Block time steps against a shared leapfrog step on a system with a wide range of
+// orbital periods: planets from 0.05 to 30 AU around a star. The shared step uses
+// the smallest step the block stepper needed.
+// usage: block_report [N] [years] [eta]
+
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 500;
+    double years = argc > 2 ? atof(argv[2]) : 1;
+    double eta = argc > 3 ? atof(argv[3]) : 0.02;
+    double t_end = years * 365.25 * 86400;
+    double h_max = 8 * 86400;
+
+    srand(1);
+    Universe *uni = create_planetary_system(N);
+    double e0 = total_energy(uni);
+
+    BlockStepper *bs = create_block_stepper(N, 16, eta);
+    int deepest = 0;
+    while (uni->t < t_end) {
+        step_block(bs, uni, h_max);
+        for (int i = 0; i < N; ++i) {
+            deepest = max(deepest, bs->rung[i]);
+        }
+    }
+    double block_error = (total_energy(uni) - e0) / e0;
+
+    int histogram[17] = { 0 };
+    for (int i = 0; i < N; ++i) {
+        ++histogram[bs->rung[i]];
+    }
+    printf("rung occupation at the end:");
+    for (int k = 0; k <= deepest; ++k) {
+        printf(" %d", histogram[k]);
+    }
+    printf("\n\n");
+
+    srand(1);
+    Universe *shared = create_planetary_system(N);
+    Integrator *ctx = create_integrator(N);
+    ctx->h = h_max / (1 << deepest);
+    long steps = integrate(ctx, shared, t_end, 0, METHOD_LEAPFROG);
+    double shared_error = (total_energy(shared) - e0) / e0;
+    // Every leapfrog step costs one call to acc(), which computes N(N − 1)/2 pairs.
+    long shared_pairs = (steps + 1) * (long)N * (N - 1) / 2;
+
+    printf("N = %d, %.2f years, h_max = %.0f s\n", N, years, h_max);
+    printf("%-8s %12s %16s %14s\n", "mode", "smallest h", "pair terms", "energy error");
+    printf("%-8s %12.1f %16ld %14.3E\n", "block", h_max / (1 << deepest), bs->interactions, block_error);
+    printf("%-8s %12.1f %16ld %14.3E\n", "shared", ctx->h, shared_pairs, shared_error);
+    printf("block steps need %.1fx fewer pair terms\n", (double)shared_pairs / bs->interactions);
+
+    destroy_integrator(ctx);
+    destroy_block_stepper(bs);
+    destroy_universe(shared);
+    destroy_universe(uni);
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include "collide.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+// Scratch space, kept between calls: the spatial hash (the bucket of every object,
+// the objects sorted by bucket with their positions and cells, and where each
+// bucket starts), the union-find forest of the groups, and the sums over each
+// group: its size, its mass, and mass-weighted and plain sums of positions and
+// velocities.
+static int *sorted = NULL;
+static Vector *sorted_p = NULL;
+static int *start = NULL;
+static int *home = NULL;
+static int64_t *cell_x = NULL;
+static int64_t *cell_y = NULL;
+static int *parent = NULL;
+static int *group_n = NULL;
+static double *group_m = NULL;
+static Vector *group_mp = NULL;
+static Vector *group_mv = NULL;
+static Vector *group_p = NULL;
+static Vector *group_v = NULL;
+static int cap = 0;
+static int buckets = 0;
+
+static void reserve(int N) {
+    if (N <= cap) {
+        return;
+    }
+    cap = max(N, 2 * cap);
+    // A power of two, with about half of the buckets empty.
+    buckets = 1;
+    while (buckets < 2 * cap) {
+        buckets *= 2;
+    }
+
+    free(sorted);
+    free(sorted_p);
+    free(start);
+    free(home);
+    free(cell_x);
+    free(cell_y);
+    free(parent);
+    free(group_n);
+    free(group_m);
+    free(group_mp);
+    free(group_mv);
+    free(group_p);
+    free(group_v);
+    sorted = malloc(cap * sizeof(int));
+    sorted_p = malloc(cap * sizeof(Vector));
+    start = malloc((buckets + 1) * sizeof(int));
+    home = malloc(cap * sizeof(int));
+    cell_x = malloc(cap * sizeof(int64_t));
+    cell_y = malloc(cap * sizeof(int64_t));
+    parent = malloc(cap * sizeof(int));
+    group_n = malloc(cap * sizeof(int));
+    group_m = malloc(cap * sizeof(double));
+    group_mp = malloc(cap * sizeof(Vector));
+    group_mv = malloc(cap * sizeof(Vector));
+    group_p = malloc(cap * sizeof(Vector));
+    group_v = malloc(cap * sizeof(Vector));
+}
+
+// Cells far outside any sensible simulation (and NaN) are clamped, which only makes
+// their buckets more crowded.
+static int64_t cell(double x, double radius) {
+    return (int64_t)fmax(-1e+15, fmin(1e+15, floor(x / radius)));
+}
+
+// Rows of cells are hashed, and the cells of a row are consecutive buckets from
+// there, so the three neighbours of a cell in one row share a cache line of start[].
+static int bucket(int64_t x, int64_t y) {
+    uint64_t h = (uint64_t)y * 0x9e3779b97f4a7c15u;
+    return (int)(((h ^ h >> 29) + (uint64_t)x) & (buckets - 1));
+}
+
+static int find(int i) {
+    while (parent[i] != i) {
+        // Path halving.
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// The smaller index becomes the root, so a group is kept at its first member.
+static void unite(int i, int j) {
+    i = find(i);
+    j = find(j);
+    if (i < j) {
+        parent[j] = i;
+    } else if (j < i) {
+        parent[i] = j;
+    }
+}
+
+int merge_collisions(Universe *uni, double radius) {
+    int N = uni->N;
+    if (N < 2 || !(radius > 0)) {
+        return 0;
+    }
+    reserve(N);
+
+    // Counting sort of the objects by bucket.
+    for (int b = 0; b <= buckets; ++b) {
+        start[b] = 0;
+    }
+    for (int i = 0; i < N; ++i) {
+        home[i] = bucket(cell(uni->p[i].x, radius), cell(uni->p[i].y, radius));
+        start[home[i] + 1]++;
+    }
+    for (int b = 0; b < buckets; ++b) {
+        start[b + 1] += start[b];
+    }
+    for (int i = 0; i < N; ++i) {
+        // start[b] runs ahead while filling, and ends up where bucket b + 1 starts.
+        int k = start[home[i]]++;
+        sorted[k] = i;
+        sorted_p[k] = uni->p[i];
+        cell_x[k] = cell(uni->p[i].x, radius);
+        cell_y[k] = cell(uni->p[i].y, radius);
+    }
+    for (int b = buckets; b > 0; --b) {
+        start[b] = start[b - 1];
+    }
+    start[0] = 0;
+
+    // Objects closer than radius are in the same cell or in neighbouring ones. Half of
+    // the neighbours suffice, since the pair is found from the other cell otherwise.
+    static const int stencil[5][2] = { { 0, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+    int pairs = 0;
+    double r2 = radius * radius;
+    for (int i = 0; i < N; ++i) {
+        parent[i] = i;
+    }
+    // In the order of the buckets, so that the buckets looked at move along in memory.
+    for (int l = 0; l < N; ++l) {
+        int i = sorted[l];
+        Vector p = sorted_p[l];
+        for (int s = 0; s < 5; ++s) {
+            int b = bucket(cell_x[l] + stencil[s][0], cell_y[l] + stencil[s][1]);
+            for (int k = start[b]; k < start[b + 1]; ++k) {
+                // Within the bucket of the own cell, which may hold other cells too,
+                // every pair is seen twice.
+                if (0 == s && k <= l) {
+                    continue;
+                }
+                double ex = sorted_p[k].x - p.x;
+                double ey = sorted_p[k].y - p.y;
+                if (ex*ex + ey*ey < r2) {
+                    unite(i, sorted[k]);
+                    pairs++;
+                }
+            }
+        }
+    }
+
+    if (0 == pairs) {
+        return 0;
+    }
+
+    // ### m = ∑ mᵢ,  p = ∑ mᵢ ⋅ pᵢ / m,  v = ∑ mᵢ ⋅ vᵢ / m
+    for (int i = 0; i < N; ++i) {
+        group_n[i] = 0;
+        group_m[i] = 0;
+        group_mp[i] = group_mv[i] = group_p[i] = group_v[i] = (Vector) { 0, 0 };
+    }
+    for (int i = 0; i < N; ++i) {
+        int r = find(i);
+        double m = uni->m[i];
+        group_n[r]++;
+        group_m[r] += m;
+        group_mp[r].x += m * uni->p[i].x;
+        group_mp[r].y += m * uni->p[i].y;
+        group_mv[r].x += m * uni->v[i].x;
+        group_mv[r].y += m * uni->v[i].y;
+        group_p[r].x += uni->p[i].x;
+        group_p[r].y += uni->p[i].y;
+        group_v[r].x += uni->v[i].x;
+        group_v[r].y += uni->v[i].y;
+    }
+
+    // Roots only move down, so every object is read before its slot is written.
+    int n = 0;
+    for (int i = 0; i < N; ++i) {
+        if (parent[i] != i) {
+            continue;
+        }
+        double m = group_m[i];
+        int k = group_n[i];
+        if (1 == k) {
+            // Untouched, bit for bit.
+            uni->p[n] = uni->p[i];
+            uni->v[n] = uni->v[i];
+        } else if (m != 0) {
+            uni->p[n] = (Vector) { group_mp[i].x / m, group_mp[i].y / m };
+            uni->v[n] = (Vector) { group_mv[i].x / m, group_mv[i].y / m };
+        } else {
+            uni->p[n] = (Vector) { group_p[i].x / k, group_p[i].y / k };
+            uni->v[n] = (Vector) { group_v[i].x / k, group_v[i].y / k };
+        }
+        uni->m[n] = m;
+        n++;
+    }
+
+    uni->N = n;
+    return N - n;
+}
@@ -0,0 +1,20 @@
+#ifndef COLLIDE_H
+#define COLLIDE_H
+
+#include "gravity.h"
+
+// Merge every group of objects that came closer than radius to each other, directly
+// or through a chain of such pairs, into one object: masses add up, and the new
+// object sits at the centre of gravity of the group with its momentum, so momentum
+// and the centre of gravity are conserved, and kinetic energy is not (the merge is
+// inelastic). A group with a total mass of 0 keeps the average position and velocity.
+//
+// Close pairs are found with a spatial hash on a uniform grid of cells of side
+// radius, so only the objects in the 3 x 3 cells around each object are checked and
+// the cost is O(N) unless many objects crowd into one cell. The arrays of the
+// Universe are compacted in place, in order; each group lives on at the position of
+// its first member. Returns the number of objects that went away; integrators
+// notice the change of N and drop the forces they kept.
+int merge_collisions(Universe *uni, double radius);
+
+#endif /* COLLIDE_H */
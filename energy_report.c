@@ -0,0 +1,87 @@
+#include "integrate.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Long run energy error against the number of force evaluations, for the
+// symplectic steppers at a range of fixed step sizes and the RKN steppers at a
+// range of tolerances. The energy is measured with total_energy() once per day.
+// usage: energy_report [years]
+
+
+static long calls = 0;
+
+static void counting_acc(const Universe *uni, Vector *a) {
+    ++calls;
+    acc(uni, a);
+}
+
+// The Earth and the Moon on a slightly eccentric orbit, plus a distant, light third body.
+static Universe* create_system(void) {
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = 3;
+    uni->p = calloc(3, sizeof(Vector));
+    uni->v = calloc(3, sizeof(Vector));
+    uni->m = calloc(3, sizeof(double));
+
+    uni->m[0] = 5.9724e+24;
+    uni->m[1] = 0.07346e+24;
+    uni->p[1] = (Vector) { 0, 3.85e+8 };
+    uni->v[1] = (Vector) { 1.1e+3, 0 };
+    uni->m[2] = 1e+20;
+    uni->p[2] = (Vector) { 1.5e+9, 0 };
+    uni->v[2] = (Vector) { 0, 5e+2 };
+    return uni;
+}
+
+static void run(Method method, double h, double tol, double t_end) {
+    Universe *uni = create_system();
+    Integrator *ctx = create_integrator(uni->N);
+    integrator_set_acc(ctx, counting_acc);
+    ctx->h = h;
+    ctx->tol = tol;
+    calls = 0;
+
+    double e0 = total_energy(uni);
+    double worst = 0;
+    for (double day = 86400; day <= t_end; day += 86400) {
+        while (uni->t < day) {
+            integrate_step(ctx, uni, day, method);
+        }
+        worst = max(worst, fabs((total_energy(uni) - e0) / e0));
+    }
+
+    if (tol > 0) {
+        printf("%-14s %10s %10.0e %12ld %14.3E\n", method_name(method), "-", tol, calls, worst);
+    } else {
+        printf("%-14s %10.0f %10s %12ld %14.3E\n", method_name(method), h, "-", calls, worst);
+    }
+    destroy_integrator(ctx);
+    destroy_universe(uni);
+}
+
+int main(int argc, char **argv) {
+    double years = argc > 1 ? atof(argv[1]) : 10;
+    double t_end = years * 365 * 86400;
+
+    printf("%.0f years, max |ΔE/E|\n\n", years);
+    printf("method                  h        tol    acc calls     max energy\n");
+
+    Method symplectic[] = { METHOD_LEAPFROG, METHOD_FOREST_RUTH, METHOD_YOSHIDA4, METHOD_YOSHIDA6 };
+    for (int k = 0; k < 4; ++k) {
+        for (double h = 3600; h >= 200; h /= 2) {
+            run(symplectic[k], h, 0, t_end);
+        }
+    }
+
+    Method adaptive[] = { METHOD_RKN45, METHOD_RKN67, METHOD_RKN87 };
+    for (int k = 0; k < 3; ++k) {
+        for (double tol = 1e-6; tol >= 1e-12; tol /= 10) {
+            run(adaptive[k], 0, tol, t_end);
+        }
+    }
+
+    return 0;
+}
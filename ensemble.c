@@ -0,0 +1,590 @@
+#include "ensemble.h"
+#include "threadpool.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every thread keeps a block of W lanes in its own scratch memory and runs rkn45 on
+// all of them at once. Lanes take universes from a shared counter one at a time and
+// give them back when they reach t_end, so the threads and the lanes stay busy no
+// matter how different the numbers of steps of the universes are. Inside a block every
+// stage is one loop over [object][lane], and the force kernel computes W universes
+// with one instruction per operation.
+
+#define W ENSEMBLE_WIDTH
+
+// Limits on how much the step size may change from one step to the next, as in integrate().
+#define FACTOR_MIN 0.2
+#define FACTOR_MAX 5.0
+#define SAFETY 0.9
+#define ORDER 4
+
+static double* alloc_lanes(int N) {
+    return aligned_alloc(64, max(N, 1) * W * sizeof(double));
+}
+
+Ensemble* create_ensemble(int M, int N) {
+    Ensemble *ens = calloc(1, sizeof(Ensemble));
+    ens->M = M;
+    ens->N = N;
+    ens->cap = (M + W - 1) / W * W;
+    ens->tol = 1e-9;
+
+    size_t size = max((size_t)N * ens->cap, (size_t)1) * sizeof(double);
+    ens->x = aligned_alloc(64, size);
+    ens->y = aligned_alloc(64, size);
+    ens->vx = aligned_alloc(64, size);
+    ens->vy = aligned_alloc(64, size);
+    ens->m = aligned_alloc(64, size);
+    // The padding universes keep their objects apart, so they never divide by zero.
+    for (int i = 0; i < N; ++i) {
+        for (int k = 0; k < ens->cap; ++k) {
+            ens->x[i * ens->cap + k] = i;
+            ens->y[i * ens->cap + k] = 0;
+            ens->vx[i * ens->cap + k] = ens->vy[i * ens->cap + k] = 0;
+            ens->m[i * ens->cap + k] = 0;
+        }
+    }
+
+    ens->t = calloc(ens->cap, sizeof(double));
+    ens->h = calloc(ens->cap, sizeof(double));
+    ens->err_prev = calloc(ens->cap, sizeof(double));
+    ens->e0 = calloc(ens->cap, sizeof(double));
+    ens->accepted = calloc(ens->cap, sizeof(long));
+    ens->rejected = calloc(ens->cap, sizeof(long));
+    ens->failed = calloc(ens->cap, sizeof(int));
+    return ens;
+}
+
+void destroy_ensemble(Ensemble *ens) {
+    free(ens->x);
+    free(ens->y);
+    free(ens->vx);
+    free(ens->vy);
+    free(ens->m);
+    free(ens->t);
+    free(ens->h);
+    free(ens->err_prev);
+    free(ens->e0);
+    free(ens->accepted);
+    free(ens->rejected);
+    free(ens->failed);
+    free(ens);
+}
+
+void ensemble_set(Ensemble *ens, int k, const Universe *uni) {
+    for (int i = 0; i < ens->N; ++i) {
+        ens->x[i * ens->cap + k] = uni->p[i].x;
+        ens->y[i * ens->cap + k] = uni->p[i].y;
+        ens->vx[i * ens->cap + k] = uni->v[i].x;
+        ens->vy[i * ens->cap + k] = uni->v[i].y;
+        ens->m[i * ens->cap + k] = uni->m[i];
+    }
+    ens->t[k] = uni->t;
+    ens->h[k] = 0;
+    ens->err_prev[k] = 0;
+    ens->accepted[k] = ens->rejected[k] = 0;
+    ens->failed[k] = 0;
+    ens->e0[k] = ensemble_energy(ens, k);
+}
+
+void ensemble_get(const Ensemble *ens, int k, Universe *uni) {
+    for (int i = 0; i < ens->N; ++i) {
+        uni->p[i] = (Vector) { ens->x[i * ens->cap + k], ens->y[i * ens->cap + k] };
+        uni->v[i] = (Vector) { ens->vx[i * ens->cap + k], ens->vy[i * ens->cap + k] };
+        uni->m[i] = ens->m[i * ens->cap + k];
+    }
+    uni->t = ens->t[k];
+}
+
+// ### E = ∑ᵢ mᵢ ⋅ |vᵢ|² / 2 − G ∑ⱼ<ᵢ mᵢ ⋅ mⱼ / d(pᵢ, pⱼ)
+double ensemble_energy(const Ensemble *ens, int k) {
+    const int s = ens->cap;
+    double kinetic = 0;
+    double potential = 0;
+    for (int i = 0; i < ens->N; ++i) {
+        double vx = ens->vx[i * s + k];
+        double vy = ens->vy[i * s + k];
+        kinetic += 0.5 * ens->m[i * s + k] * (vx*vx + vy*vy);
+        for (int j = 0; j < i; ++j) {
+            double dx = ens->x[j * s + k] - ens->x[i * s + k];
+            double dy = ens->y[j * s + k] - ens->y[i * s + k];
+            potential -= ens->m[i * s + k] * ens->m[j * s + k] / sqrt(dx*dx + dy*dy);
+        }
+    }
+    return kinetic + G * potential;
+}
+
+double ensemble_energy_error(const Ensemble *ens, int k) {
+    return (ensemble_energy(ens, k) - ens->e0[k]) / ens->e0[k];
+}
+
+// The force kernels compute the accelerations of N objects in W universes at once, from
+// arrays laid out as [object * W + lane]. They use aᵢⱼ = −aⱼᵢ like acc(), which is free
+// here because the lanes, not the objects, are spread over the vector.
+
+static void acc_lanes_scalar(int N, const double *x, const double *y, const double *m,
+                             double *ax, double *ay) {
+    memset(ax, 0, N * W * sizeof(double));
+    memset(ay, 0, N * W * sizeof(double));
+
+    for (int i = 0; i < N; ++i) {
+        for (int j = 0; j < i; ++j) {
+            for (int l = 0; l < W; ++l) {
+                double dx = x[j*W + l] - x[i*W + l];
+                double dy = y[j*W + l] - y[i*W + l];
+                double d3 = 1.0 / sqrt(dx*dx + dy*dy);
+                d3 = d3 * d3 * d3;
+
+                ax[i*W + l] += d3 * m[j*W + l] * dx;
+                ay[i*W + l] += d3 * m[j*W + l] * dy;
+                ax[j*W + l] -= d3 * m[i*W + l] * dx;
+                ay[j*W + l] -= d3 * m[i*W + l] * dy;
+            }
+        }
+    }
+
+    for (int i = 0; i < N * W; ++i) {
+        ax[i] *= G;
+        ay[i] *= G;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void acc_lanes_avx2(int N, const double *x, const double *y, const double *m,
+                           double *ax, double *ay) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d g = _mm256_set1_pd(G);
+
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; l += 4) {
+            __m256d xi = _mm256_load_pd(x + i*W + l);
+            __m256d yi = _mm256_load_pd(y + i*W + l);
+            __m256d mi = _mm256_load_pd(m + i*W + l);
+            __m256d sx = _mm256_setzero_pd();
+            __m256d sy = _mm256_setzero_pd();
+
+            for (int j = 0; j < i; ++j) {
+                __m256d dx = _mm256_sub_pd(_mm256_load_pd(x + j*W + l), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_load_pd(y + j*W + l), yi);
+                __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+                __m256d d1 = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+                __m256d d3 = _mm256_mul_pd(_mm256_mul_pd(d1, d1), d1);
+                __m256d wj = _mm256_mul_pd(d3, _mm256_load_pd(m + j*W + l));
+                __m256d wi = _mm256_mul_pd(d3, mi);
+
+                sx = _mm256_fmadd_pd(wj, dx, sx);
+                sy = _mm256_fmadd_pd(wj, dy, sy);
+                _mm256_store_pd(ax + j*W + l, _mm256_fnmadd_pd(wi, dx, _mm256_load_pd(ax + j*W + l)));
+                _mm256_store_pd(ay + j*W + l, _mm256_fnmadd_pd(wi, dy, _mm256_load_pd(ay + j*W + l)));
+            }
+            // Rows before i never touch aᵢ, rows after it only subtract from it.
+            _mm256_store_pd(ax + i*W + l, sx);
+            _mm256_store_pd(ay + i*W + l, sy);
+        }
+    }
+
+    for (int n = 0; n < N * W; n += 4) {
+        _mm256_store_pd(ax + n, _mm256_mul_pd(g, _mm256_load_pd(ax + n)));
+        _mm256_store_pd(ay + n, _mm256_mul_pd(g, _mm256_load_pd(ay + n)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void acc_lanes_avx512(int N, const double *x, const double *y, const double *m,
+                             double *ax, double *ay) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d three = _mm512_set1_pd(3.0);
+    const __m512d g = _mm512_set1_pd(G);
+
+    for (int i = 0; i < N; ++i) {
+        __m512d xi = _mm512_load_pd(x + i*W);
+        __m512d yi = _mm512_load_pd(y + i*W);
+        __m512d mi = _mm512_load_pd(m + i*W);
+        __m512d sx = _mm512_setzero_pd();
+        __m512d sy = _mm512_setzero_pd();
+
+        for (int j = 0; j < i; ++j) {
+            __m512d dx = _mm512_sub_pd(_mm512_load_pd(x + j*W), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_load_pd(y + j*W), yi);
+            __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+            // 14-bit estimate, refined twice with Newton's method as in acc_soa_avx512(),
+            // which is much cheaper than a division and a square root of 8 lanes.
+            __m512d d1 = _mm512_rsqrt14_pd(r2);
+            d1 = _mm512_mul_pd(_mm512_mul_pd(half, d1), _mm512_fnmadd_pd(_mm512_mul_pd(r2, d1), d1, three));
+            d1 = _mm512_mul_pd(_mm512_mul_pd(half, d1), _mm512_fnmadd_pd(_mm512_mul_pd(r2, d1), d1, three));
+            __m512d d3 = _mm512_mul_pd(_mm512_mul_pd(d1, d1), d1);
+            __m512d wj = _mm512_mul_pd(d3, _mm512_load_pd(m + j*W));
+            __m512d wi = _mm512_mul_pd(d3, mi);
+
+            sx = _mm512_fmadd_pd(wj, dx, sx);
+            sy = _mm512_fmadd_pd(wj, dy, sy);
+            _mm512_store_pd(ax + j*W, _mm512_fnmadd_pd(wi, dx, _mm512_load_pd(ax + j*W)));
+            _mm512_store_pd(ay + j*W, _mm512_fnmadd_pd(wi, dy, _mm512_load_pd(ay + j*W)));
+        }
+        _mm512_store_pd(ax + i*W, sx);
+        _mm512_store_pd(ay + i*W, sy);
+    }
+
+    for (int n = 0; n < N * W; n += 8) {
+        _mm512_store_pd(ax + n, _mm512_mul_pd(g, _mm512_load_pd(ax + n)));
+        _mm512_store_pd(ay + n, _mm512_mul_pd(g, _mm512_load_pd(ay + n)));
+    }
+}
+
+typedef void (*acc_lanes_fn)(int N, const double *x, const double *y, const double *m,
+                             double *ax, double *ay);
+
+static acc_lanes_fn acc_lanes = NULL;
+
+static void select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        acc_lanes = acc_lanes_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        acc_lanes = acc_lanes_avx2;
+    } else {
+        acc_lanes = acc_lanes_scalar;
+    }
+}
+
+// W lanes, each holding one universe at a time, as arrays of N * W doubles.
+typedef struct Block {
+    int N;
+    double *x, *y, *vx, *vy, *m;
+    double *sx, *sy;        // the positions of the current stage
+    double *kx[5], *ky[5];  // the accelerations of the stages; k0 is kept between steps
+
+    // Per lane: the universe in it or -1, and its step size control.
+    int universe[W];
+    double t[W], h[W], err_prev[W];
+    int retry[W];
+} Block;
+
+static Block* create_block(int N) {
+    Block *b = calloc(1, sizeof(Block));
+    b->N = N;
+    double **arrays[] = { &b->x, &b->y, &b->vx, &b->vy, &b->m, &b->sx, &b->sy };
+    for (int a = 0; a < 7; ++a) {
+        *arrays[a] = alloc_lanes(N);
+    }
+    for (int s = 0; s < 5; ++s) {
+        b->kx[s] = alloc_lanes(N);
+        b->ky[s] = alloc_lanes(N);
+    }
+    return b;
+}
+
+static void destroy_block(Block *b) {
+    double *arrays[] = { b->x, b->y, b->vx, b->vy, b->m, b->sx, b->sy };
+    for (int a = 0; a < 7; ++a) {
+        free(arrays[a]);
+    }
+    for (int s = 0; s < 5; ++s) {
+        free(b->kx[s]);
+        free(b->ky[s]);
+    }
+    free(b);
+}
+
+// Move universe k into lane l, or empty the lane for k = -1. An empty lane holds
+// massless objects that are kept apart, so it never divides by zero.
+static void load_lane(const Ensemble *ens, Block *b, int l, int k) {
+    b->universe[l] = k;
+    for (int i = 0; i < b->N; ++i) {
+        size_t e = (size_t)i * ens->cap + k;
+        int n = i*W + l;
+        b->x[n] = k < 0 ? i : ens->x[e];
+        b->y[n] = k < 0 ? 0 : ens->y[e];
+        b->vx[n] = k < 0 ? 0 : ens->vx[e];
+        b->vy[n] = k < 0 ? 0 : ens->vy[e];
+        b->m[n] = k < 0 ? 0 : ens->m[e];
+    }
+    if (k >= 0) {
+        b->t[l] = ens->t[k];
+        b->h[l] = ens->h[k];
+        b->err_prev[l] = ens->err_prev[k];
+        b->retry[l] = 0;
+    }
+}
+
+static void store_lane(Ensemble *ens, const Block *b, int l) {
+    int k = b->universe[l];
+    for (int i = 0; i < b->N; ++i) {
+        size_t e = (size_t)i * ens->cap + k;
+        int n = i*W + l;
+        ens->x[e] = b->x[n];
+        ens->y[e] = b->y[n];
+        ens->vx[e] = b->vx[n];
+        ens->vy[e] = b->vy[n];
+    }
+    ens->t[k] = b->t[l];
+    ens->h[k] = b->h[l];
+    ens->err_prev[k] = b->err_prev[l];
+}
+
+// The first guess of initial_step() in integrate.c, per lane, from the accelerations in k0.
+static double initial_step(const Block *b, int l, double tol) {
+    const int N = b->N;
+    double cx = 0, cy = 0;
+    for (int i = 0; i < N; ++i) {
+        cx += b->x[i*W + l] / N;
+        cy += b->y[i*W + l] / N;
+    }
+
+    double size = 0, speed = 0, accel = 0;
+    for (int i = 0; i < N; ++i) {
+        double dx = b->x[i*W + l] - cx;
+        double dy = b->y[i*W + l] - cy;
+        size += dx*dx + dy*dy;
+        speed += b->vx[i*W + l] * b->vx[i*W + l] + b->vy[i*W + l] * b->vy[i*W + l];
+        accel += b->kx[0][i*W + l] * b->kx[0][i*W + l] + b->ky[0][i*W + l] * b->ky[0][i*W + l];
+    }
+    size = sqrt(size);
+    speed = sqrt(speed);
+    accel = sqrt(accel);
+
+    double h = INFINITY;
+    if (speed > 0) {
+        h = min(h, size / speed);
+    }
+    if (accel > 0) {
+        h = min(h, sqrt(size / accel));
+    }
+    if (!isfinite(h) || h == 0) {
+        h = 1;
+    }
+    return h * pow(tol, 1.0 / ORDER);
+}
+
+// One rkn45 step of every lane with its own step size h[l], which is 0 for masked lanes.
+// The new positions are left in sx, sy; the velocities are not touched. err[l] is the
+// error norm of step_rkn45().
+static void step_lanes(Block *b, const double *h, double tol, double *err) {
+    const int N = b->N;
+    double **kx = b->kx, **ky = b->ky;
+    const double *x = b->x, *y = b->y, *vx = b->vx, *vy = b->vy;
+    double *sx = b->sx, *sy = b->sy;
+
+    // The coefficients of every stage per lane, so the loops below only multiply.
+    double h2[W], h3[W], hh18[W], hh6[W], hh120[W], hh29[W];
+    for (int l = 0; l < W; ++l) {
+        h2[l] = h[l]*2/3;
+        h3[l] = h[l]/3;
+        hh18[l] = h[l]*h[l]/18;
+        hh29[l] = 2*h[l]*h[l]/9;
+        hh6[l] = h[l]*h[l]/6;
+        hh120[l] = h[l]*h[l]/120;
+    }
+
+    // k1 = acc(p + v*h/3 + h*h*k0/18)
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; ++l) {
+            int n = i*W + l;
+            sx[n] = x[n] + vx[n] * h3[l] + kx[0][n] * hh18[l];
+            sy[n] = y[n] + vy[n] * h3[l] + ky[0][n] * hh18[l];
+        }
+    }
+    acc_lanes(N, sx, sy, b->m, kx[1], ky[1]);
+
+    // k2 = acc(p + v * 2/3h + k1 * h*h*2/9)
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; ++l) {
+            int n = i*W + l;
+            sx[n] = x[n] + vx[n] * h2[l] + kx[1][n] * hh29[l];
+            sy[n] = y[n] + vy[n] * h2[l] + ky[1][n] * hh29[l];
+        }
+    }
+    acc_lanes(N, sx, sy, b->m, kx[2], ky[2]);
+
+    // k3 = acc(p + h*v + h*h*(k0/3 + k2/6))
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; ++l) {
+            int n = i*W + l;
+            sx[n] = x[n] + vx[n] * h[l] + (kx[0][n] * 2 + kx[2][n]) * hh6[l];
+            sy[n] = y[n] + vy[n] * h[l] + (ky[0][n] * 2 + ky[2][n]) * hh6[l];
+        }
+    }
+    acc_lanes(N, sx, sy, b->m, kx[3], ky[3]);
+
+    // p = p + h*v + h*h*(k0*13/120 + k1*3/10 + k2*3/40 + k3/60), k4 = acc(p)
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; ++l) {
+            int n = i*W + l;
+            sx[n] = x[n] + vx[n] * h[l] + (kx[0][n] * 13 + kx[1][n] * 36 + kx[2][n] * 9 + kx[3][n] * 2) * hh120[l];
+            sy[n] = y[n] + vy[n] * h[l] + (ky[0][n] * 13 + ky[1][n] * 36 + ky[2][n] * 9 + ky[3][n] * 2) * hh120[l];
+        }
+    }
+    acc_lanes(N, sx, sy, b->m, kx[4], ky[4]);
+
+    // The embedded solution uses k4 instead of k3 in the position update. The largest
+    // squared ratio is found first, so there is one square root per lane.
+    double ratio[W] = { 0 };
+    for (int i = 0; i < N; ++i) {
+        for (int l = 0; l < W; ++l) {
+            int n = i*W + l;
+            double ex = kx[3][n] - kx[4][n];
+            double ey = ky[3][n] - ky[4][n];
+            double e2 = ex*ex + ey*ey;
+            double dx = sx[n] - x[n];
+            double dy = sy[n] - y[n];
+            double r = e2 == 0 ? 0 : e2 / (dx*dx + dy*dy);
+            // Keep a NaN, which marks a stage that put two objects on top of each other.
+            ratio[l] = r > ratio[l] || r != r ? r : ratio[l];
+        }
+    }
+    for (int l = 0; l < W; ++l) {
+        err[l] = sqrt(ratio[l]) * h[l]*h[l]/60 / tol;
+    }
+}
+
+typedef struct Job {
+    Ensemble *ens;
+    double t_end;
+    atomic_int next;
+} Job;
+
+// The next universe that still has to move, or -1.
+static int next_universe(Job *job) {
+    for (;;) {
+        int k = atomic_fetch_add(&job->next, 1);
+        if (k >= job->ens->M) {
+            return -1;
+        }
+        if (!job->ens->failed[k] && job->ens->t[k] < job->t_end) {
+            return k;
+        }
+    }
+}
+
+// Integrate universes to t_end with the step size control of integrate_step(), run
+// separately for every lane. A lane whose universe is done takes the next one, so a
+// single universe that needs many steps does not idle the other lanes of its block.
+static void integrate_lanes(void *arg, int tid, int nthreads) {
+    (void)tid;
+    (void)nthreads;
+    Job *job = arg;
+    Ensemble *ens = job->ens;
+    const double t_end = job->t_end;
+    const int N = ens->N;
+    Block *b = create_block(N);
+    double step[W], wanted[W], err[W];
+    int clipped[W];
+
+    for (int l = 0; l < W; ++l) {
+        load_lane(ens, b, l, next_universe(job));
+    }
+    int refilled = 1;
+
+    for (;;) {
+        int any = 0;
+        for (int l = 0; l < W; ++l) {
+            any |= b->universe[l] >= 0;
+        }
+        if (!any) {
+            break;
+        }
+
+        // New universes need their first accelerations and step size.
+        if (refilled) {
+            acc_lanes(N, b->x, b->y, b->m, b->kx[0], b->ky[0]);
+            for (int l = 0; l < W; ++l) {
+                if (b->universe[l] >= 0 && b->h[l] <= 0) {
+                    b->h[l] = initial_step(b, l, ens->tol);
+                }
+            }
+            refilled = 0;
+        }
+
+        for (int l = 0; l < W; ++l) {
+            step[l] = 0;
+            clipped[l] = 0;
+            if (b->universe[l] < 0) {
+                continue;
+            }
+            wanted[l] = step[l] = b->h[l];
+            clipped[l] = step[l] >= t_end - b->t[l];
+            if (clipped[l]) {
+                step[l] = t_end - b->t[l];
+            }
+            if (b->t[l] + step[l] == b->t[l]) {
+                ens->failed[b->universe[l]] = 1;
+                step[l] = 0;
+            }
+        }
+
+        step_lanes(b, step, ens->tol, err);
+
+        for (int l = 0; l < W; ++l) {
+            int k = b->universe[l];
+            if (k < 0) {
+                continue;
+            }
+            if (ens->failed[k]) {
+                // Keep the universe where the step size control gave up.
+            } else if (err[l] <= 1) {
+                double factor = FACTOR_MAX;
+                if (err[l] > 0) {
+                    double prev = b->err_prev[l] > 0 ? b->err_prev[l] : 1;
+                    factor = SAFETY * pow(err[l], -0.7 / ORDER) * pow(prev, 0.4 / ORDER);
+                    factor = max(FACTOR_MIN, min(FACTOR_MAX, factor));
+                }
+                if (b->retry[l]) {
+                    factor = min(factor, 1.0);
+                }
+                b->err_prev[l] = max(err[l], 1e-4);
+                // A step that was shortened to land on t_end says little about the next one.
+                b->h[l] = clipped[l] ? max(step[l] * factor, wanted[l]) : step[l] * factor;
+                b->t[l] = clipped[l] ? t_end : b->t[l] + step[l];
+                b->retry[l] = 0;
+                ++ens->accepted[k];
+
+                // v = v + (k0 + 3k1 + 3k2 + k3) * h/8, and k4 is the next k0.
+                double **kx = b->kx, **ky = b->ky;
+                for (int i = 0; i < N; ++i) {
+                    int n = i*W + l;
+                    b->vx[n] += (kx[0][n] + kx[1][n] * 3 + kx[2][n] * 3 + kx[3][n]) * step[l]/8;
+                    b->vy[n] += (ky[0][n] + ky[1][n] * 3 + ky[2][n] * 3 + ky[3][n]) * step[l]/8;
+                    b->x[n] = b->sx[n];
+                    b->y[n] = b->sy[n];
+                    kx[0][n] = kx[4][n];
+                    ky[0][n] = ky[4][n];
+                }
+                if (b->t[l] < t_end) {
+                    continue;
+                }
+            } else {
+                ++ens->rejected[k];
+                b->retry[l] = 1;
+                // err is NaN if a stage landed two objects on top of each other.
+                double factor = isnan(err[l]) ? FACTOR_MIN : SAFETY * pow(err[l], -1.0 / ORDER);
+                b->h[l] = step[l] * max(FACTOR_MIN, factor);
+                continue;
+            }
+
+            store_lane(ens, b, l);
+            load_lane(ens, b, l, next_universe(job));
+            refilled |= b->universe[l] >= 0;
+        }
+    }
+
+    destroy_block(b);
+}
+
+int ensemble_integrate(Ensemble *ens, double t_end) {
+    if (NULL == acc_lanes) {
+        select_kernel();
+    }
+
+    Job job = { ens, t_end, 0 };
+    parallel_run(integrate_lanes, &job);
+
+    int failed = 0;
+    for (int k = 0; k < ens->M; ++k) {
+        failed += ens->failed[k];
+    }
+    return failed;
+}
@@ -0,0 +1,51 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "gravity.h"
+
+// The number of universes integrated together: one per lane of a 512-bit register.
+#define ENSEMBLE_WIDTH 8
+
+// M independent universes of N objects each, integrated with rkn45 at once. The
+// state is lane-interleaved: the value of object i in universe k is at [i * cap + k],
+// so every SIMD lane computes a different universe and the force kernel needs no
+// gathers. Every thread of the pool integrates ENSEMBLE_WIDTH universes at a time.
+// Every universe has its own time, step size and step size controller; a universe
+// that is done (or failed) is masked out and its lane refilled with the next one.
+typedef struct Ensemble {
+    int M;
+    int N;
+    int cap;      // M rounded up to ENSEMBLE_WIDTH, the stride of the arrays below
+    double *x, *y, *vx, *vy, *m;  // N * cap doubles each; padding universes have no mass
+
+    double tol;   // tolerated local error per distance travelled (default 1e-9)
+    double *t;    // per universe: the simulation time
+    double *h;    // the next step size, 0 to pick one
+    double *err_prev;
+    double *e0;   // the energy at the last ensemble_set()
+    long *accepted;
+    long *rejected;
+    int *failed;  // set when the step size control failed; the universe stops there
+} Ensemble;
+
+Ensemble* create_ensemble(int M, int N);
+
+void destroy_ensemble(Ensemble *ens);
+
+// Copy a Universe of ens->N objects into universe k, reset its step size control and
+// record its energy for ensemble_energy_error().
+void ensemble_set(Ensemble *ens, int k, const Universe *uni);
+
+// Copy universe k into a Universe of ens->N objects.
+void ensemble_get(const Ensemble *ens, int k, Universe *uni);
+
+// Advance every universe to t_end, landing on it exactly. Returns the number of
+// universes whose step size control failed.
+int ensemble_integrate(Ensemble *ens, double t_end);
+
+double ensemble_energy(const Ensemble *ens, int k);
+
+// The relative energy error of universe k since ensemble_set().
+double ensemble_energy_error(const Ensemble *ens, int k);
+
+#endif /* ENSEMBLE_H */
@@ -0,0 +1,110 @@
+#include "ensemble.h"
+#include "integrate.h"
+#include "gravity.h"
+#include "threadpool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// M universes of N objects integrated for the same time, once universe by universe
+// with integrate() and METHOD_RKN45, and once as an ensemble. Both take their steps
+// with the same controller, so the step counts and energy errors should agree closely;
+// the throughput is in universe-steps per second. N = 3 uses random universes like
+// main2() in main.c, larger N planetary systems, which all need similar numbers of steps.
+// usage: ensemble_report [M] [N] [days] [threads]
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int M = argc > 1 ? atoi(argv[1]) : 1024;
+    int N = argc > 2 ? atoi(argv[2]) : 3;
+    double t_end = (argc > 3 ? atof(argv[3]) : 10) * 86400;
+    set_num_threads(argc > 4 ? atoi(argv[4]) : 0);
+    const double tol = 1e-9;
+
+    srand(1);
+    Universe **unis = calloc(M, sizeof(Universe*));
+    Ensemble *ens = create_ensemble(M, N);
+    ens->tol = tol;
+    for (int k = 0; k < M; ++k) {
+        unis[k] = N > 3 ? create_planetary_system(N) : create_random_universe(N);
+        ensemble_set(ens, k, unis[k]);
+    }
+
+    double start = now();
+    long loop_steps = 0;
+    int loop_failed = 0;
+    double loop_error = 0;
+    int *failed = calloc(M, sizeof(int));
+    Integrator *ctx = create_integrator(N);
+    for (int k = 0; k < M; ++k) {
+        double e0 = total_energy(unis[k]);
+        ctx->h = 0;
+        ctx->err_prev = 0;
+        integrator_invalidate(ctx);
+        ctx->accepted = ctx->rejected = 0;
+        if (integrate(ctx, unis[k], t_end, tol, METHOD_RKN45) < 0) {
+            ++loop_failed;
+            failed[k] = 1;
+        }
+        loop_steps += ctx->accepted + ctx->rejected;
+        if (failed[k]) {
+            continue;
+        }
+        loop_error = max(loop_error, fabs((total_energy(unis[k]) - e0) / e0));
+    }
+    double loop_seconds = now() - start;
+
+    start = now();
+    int ens_failed = ensemble_integrate(ens, t_end);
+    double ens_seconds = now() - start;
+
+    long ens_steps = 0;
+    double ens_error = 0;
+    double difference = 0;
+    Universe *out = create_random_universe(N);
+    for (int k = 0; k < M; ++k) {
+        ens_steps += ens->accepted[k] + ens->rejected[k];
+        // Universes the step size control gave up on in either mode are not compared.
+        if (ens->failed[k] || failed[k]) {
+            continue;
+        }
+        ens_error = max(ens_error, fabs(ensemble_energy_error(ens, k)));
+
+        // The largest position difference to the loop, relative to the size of the universe.
+        ensemble_get(ens, k, out);
+        double size = 0, d = 0;
+        for (int i = 0; i < N; ++i) {
+            size = max(size, hypot(unis[k]->p[i].x, unis[k]->p[i].y));
+            d = max(d, hypot(out->p[i].x - unis[k]->p[i].x, out->p[i].y - unis[k]->p[i].y));
+        }
+        difference = max(difference, d / size);
+    }
+
+    printf("M = %d universes of N = %d, %.1f days, tol %g, %d threads\n",
+        M, N, t_end / 86400, tol, get_num_threads());
+    printf("%-10s %10s %12s %16s %8s %14s\n", "mode", "seconds", "steps", "steps/second", "failed", "max |dE/E|");
+    printf("%-10s %10.3f %12ld %16.4g %8d %14.3E\n", "loop", loop_seconds, loop_steps,
+        loop_steps / loop_seconds, loop_failed, loop_error);
+    printf("%-10s %10.3f %12ld %16.4g %8d %14.3E\n", "ensemble", ens_seconds, ens_steps,
+        ens_steps / ens_seconds, ens_failed, ens_error);
+    printf("ensemble is %.1fx faster; largest relative position difference %.3E\n",
+        (ens_steps / ens_seconds) / (loop_steps / loop_seconds), difference);
+
+    destroy_universe(out);
+    destroy_integrator(ctx);
+    destroy_ensemble(ens);
+    for (int k = 0; k < M; ++k) {
+        destroy_universe(unis[k]);
+    }
+    free(unis);
+    free(failed);
+    return 0;
+}
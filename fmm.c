@@ -0,0 +1,489 @@
+#include "fmm.h"
+#include "gravity.h"
+#include "threadpool.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The objects attract each other with the 3D law F ~ 1/d² restricted to the
+// plane, so the potential is 1/d and not the log d of true 2D gravity. The
+// complex-variable expansions of Greengard and Rokhlin only hold for log d, so
+// this uses Cartesian Taylor expansions of 1/d instead, in two variables.
+//
+// A multipole around centre z holds Mₖ = ∑ⱼ mⱼ (pⱼ − z)ᵏ / k! for every multi-index
+// k = (kx, ky) with |k| = kx + ky ≤ p. A local expansion around w holds Lₙ such that
+// ∑ⱼ mⱼ / d(pⱼ, r) = ∑ₙ Lₙ (r − w)ⁿ / n! near w. Converting one into the other needs
+// the derivatives Dₖ = ∂ᵏ (1/|R|) at R = w − z:
+// ### Lₙ = ∑ₖ (−1)^|k| Mₖ ⋅ Dₙ₊ₖ(R), |n| + |k| ≤ p
+//
+// The tree is a uniform quadtree, so the boxes of a level only differ by one of 7 × 7
+// offsets and the derivatives are computed once per level. Well separated means not
+// adjacent, the classic choice; neighbouring leaves are summed directly.
+
+#define MAX_LEVEL 10
+#define DIRECT_BELOW 256
+
+#define TERMS(p) (((p) + 1) * ((p) + 2) / 2)
+#define TERM(a, b) (((a) + (b)) * ((a) + (b) + 1) / 2 + (b))
+
+static int order = 8;
+static int leaf_size = 32;
+
+void set_fmm_order(int p) {
+    order = max(1, min(p, FMM_MAX_ORDER));
+}
+
+int get_fmm_order(void) {
+    return order;
+}
+
+void set_fmm_leaf_size(int s) {
+    leaf_size = max(1, s);
+}
+
+// The tree of the last call. Memory is kept between calls.
+static int depth;            // leaves are at this level, the root at level 0
+static int nterms;
+static double left, bottom;  // lower left corner of the root
+static double width;
+
+static int *count;           // objects per cell
+static int *leaf_start;      // first sorted object of every leaf, and one past the last
+static int *original;        // original index of every sorted object
+static int *leaf_of;
+static double *sx, *sy, *sm;
+static double *M, *L;        // multipole and local coefficients, nterms per cell
+static double *D;            // derivatives per level and offset, nterms each
+
+static int cell_cap = 0;
+static int body_cap = 0;
+
+static int level_offset(int l) {
+    return ((1 << (2 * l)) - 1) / 3;
+}
+
+static int cell(int l, int ix, int iy) {
+    return level_offset(l) + (iy << l) + ix;
+}
+
+static double cell_width(int l) {
+    return width / (1 << l);
+}
+
+// ∂ᵏ (1/|R|) for |k| ≤ p, from the identity |R|² ∂ᵢ f + Rᵢ f = 0 for f = 1/|R|:
+// ### |R|² Dₐ,ᵦ = −(2a − 1) X Dₐ₋₁,ᵦ − 2b Y Dₐ,ᵦ₋₁ − (a − 1)² Dₐ₋₂,ᵦ − b (b − 1) Dₐ,ᵦ₋₂
+static void derivatives(double X, double Y, int p, double *d) {
+    double r2 = X*X + Y*Y;
+    double ir2 = 1.0 / r2;
+    d[0] = sqrt(ir2);
+
+    for (int n = 1; n <= p; ++n) {
+        for (int b = 0; b <= n; ++b) {
+            int a = n - b;
+            double v;
+            if (a > 0) {
+                v = -(2*a - 1) * X * d[TERM(a - 1, b)];
+                if (b > 0) v -= 2*b * Y * d[TERM(a, b - 1)];
+                if (a > 1) v -= (a - 1) * (a - 1) * d[TERM(a - 2, b)];
+                if (b > 1) v -= b * (b - 1) * d[TERM(a, b - 2)];
+            } else {
+                v = -(2*b - 1) * Y * d[TERM(0, b - 1)];
+                if (b > 1) v -= (b - 1) * (b - 1) * d[TERM(0, b - 2)];
+            }
+            d[TERM(a, b)] = v * ir2;
+        }
+    }
+}
+
+// dᵏ / k! for k = 0 .. p.
+static void scaled_powers(double d, int p, double *out) {
+    out[0] = 1;
+    for (int k = 1; k <= p; ++k) {
+        out[k] = out[k - 1] * d / k;
+    }
+}
+
+static void reserve(int N, int ncells) {
+    if (N > body_cap) {
+        body_cap = N;
+        original = realloc(original, N * sizeof(int));
+        leaf_of = realloc(leaf_of, N * sizeof(int));
+        sx = realloc(sx, N * sizeof(double));
+        sy = realloc(sy, N * sizeof(double));
+        sm = realloc(sm, N * sizeof(double));
+    }
+    if (ncells > cell_cap) {
+        cell_cap = ncells;
+        count = realloc(count, ncells * sizeof(int));
+        leaf_start = realloc(leaf_start, (ncells + 1) * sizeof(int));
+    }
+    M = realloc(M, (size_t)ncells * nterms * sizeof(double));
+    L = realloc(L, (size_t)ncells * nterms * sizeof(double));
+    D = realloc(D, (size_t)(depth + 1) * 49 * nterms * sizeof(double));
+}
+
+// Sort the objects into the leaves of a square around all of them.
+static void build_tree(const Universe *uni) {
+    double xmin = uni->p[0].x, xmax = uni->p[0].x;
+    double ymin = uni->p[0].y, ymax = uni->p[0].y;
+    for (int i = 1; i < uni->N; ++i) {
+        xmin = min(xmin, uni->p[i].x);
+        xmax = max(xmax, uni->p[i].x);
+        ymin = min(ymin, uni->p[i].y);
+        ymax = max(ymax, uni->p[i].y);
+    }
+    width = max(xmax - xmin, ymax - ymin) * 1.0001 + 1e-9;
+    left = (xmin + xmax - width) / 2;
+    bottom = (ymin + ymax - width) / 2;
+
+    depth = 2;
+    while (depth < MAX_LEVEL && (1L << (2 * depth)) * leaf_size < uni->N) {
+        ++depth;
+    }
+    nterms = TERMS(order);
+    int ncells = level_offset(depth + 1);
+    int nleaves = 1 << (2 * depth);
+    reserve(uni->N, ncells);
+
+    int side = 1 << depth;
+    int *leaf_count = count + level_offset(depth);
+    memset(leaf_count, 0, nleaves * sizeof(int));
+    for (int i = 0; i < uni->N; ++i) {
+        int ix = min((int)((uni->p[i].x - left) / width * side), side - 1);
+        int iy = min((int)((uni->p[i].y - bottom) / width * side), side - 1);
+        leaf_of[i] = (iy << depth) + ix;
+        ++leaf_count[leaf_of[i]];
+    }
+
+    leaf_start[0] = 0;
+    for (int c = 0; c < nleaves; ++c) {
+        leaf_start[c + 1] = leaf_start[c] + leaf_count[c];
+    }
+    int *next = malloc(nleaves * sizeof(int));
+    memcpy(next, leaf_start, nleaves * sizeof(int));
+    for (int i = 0; i < uni->N; ++i) {
+        int k = next[leaf_of[i]]++;
+        original[k] = i;
+        sx[k] = uni->p[i].x;
+        sy[k] = uni->p[i].y;
+        sm[k] = uni->m[i];
+    }
+    free(next);
+
+    // Object counts of the other levels, to skip empty cells.
+    for (int l = depth - 1; l >= 0; --l) {
+        for (int iy = 0; iy < (1 << l); ++iy) {
+            for (int ix = 0; ix < (1 << l); ++ix) {
+                count[cell(l, ix, iy)] =
+                    count[cell(l + 1, 2*ix, 2*iy)] + count[cell(l + 1, 2*ix + 1, 2*iy)] +
+                    count[cell(l + 1, 2*ix, 2*iy + 1)] + count[cell(l + 1, 2*ix + 1, 2*iy + 1)];
+            }
+        }
+    }
+
+    for (int l = 2; l <= depth; ++l) {
+        for (int oy = -3; oy <= 3; ++oy) {
+            for (int ox = -3; ox <= 3; ++ox) {
+                if (max(abs(ox), abs(oy)) > 1) {
+                    // R = target − source, so a source at offset o from the target is at −o.
+                    double w = cell_width(l);
+                    derivatives(-ox * w, -oy * w, order, D + ((size_t)l * 49 + (oy + 3) * 7 + ox + 3) * nterms);
+                }
+            }
+        }
+    }
+}
+
+// Multipoles of the leaves, from their objects.
+static void p2m(int c, int ix, int iy) {
+    double *m = M + (size_t)cell(depth, ix, iy) * nterms;
+    memset(m, 0, nterms * sizeof(double));
+
+    double w = cell_width(depth);
+    double cx = left + (ix + 0.5) * w;
+    double cy = bottom + (iy + 0.5) * w;
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1];
+
+    for (int k = leaf_start[c]; k < leaf_start[c + 1]; ++k) {
+        scaled_powers(sx[k] - cx, order, px);
+        scaled_powers(sy[k] - cy, order, py);
+        for (int n = 0; n <= order; ++n) {
+            for (int b = 0; b <= n; ++b) {
+                m[TERM(n - b, b)] += sm[k] * px[n - b] * py[b];
+            }
+        }
+    }
+}
+
+// Shift the multipoles of the four children to the centre of their parent.
+// ### Mₖ(parent) = ∑ⱼ Mⱼ(child) ⋅ dᵏ⁻ʲ / (k − j)!, d = c(child) − c(parent)
+static void m2m(int l, int ix, int iy) {
+    double *m = M + (size_t)cell(l, ix, iy) * nterms;
+    memset(m, 0, nterms * sizeof(double));
+    if (count[cell(l, ix, iy)] == 0) {
+        return;
+    }
+
+    double h = cell_width(l + 1) / 2;
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1];
+
+    for (int c = 0; c < 4; ++c) {
+        int cx = 2*ix + (c & 1);
+        int cy = 2*iy + (c >> 1);
+        if (count[cell(l + 1, cx, cy)] == 0) {
+            continue;
+        }
+        const double *mc = M + (size_t)cell(l + 1, cx, cy) * nterms;
+        scaled_powers((c & 1) ? h : -h, order, px);
+        scaled_powers((c >> 1) ? h : -h, order, py);
+
+        for (int n = 0; n <= order; ++n) {
+            for (int b = 0; b <= n; ++b) {
+                int a = n - b;
+                double sum = 0;
+                for (int ja = 0; ja <= a; ++ja) {
+                    for (int jb = 0; jb <= b; ++jb) {
+                        sum += mc[TERM(ja, jb)] * px[a - ja] * py[b - jb];
+                    }
+                }
+                m[TERM(a, b)] += sum;
+            }
+        }
+    }
+}
+
+// Flip the sign of the odd terms once, so that M2L is a plain sum.
+static void negate_odd(int c) {
+    double *m = M + (size_t)c * nterms;
+    for (int n = 1; n <= order; n += 2) {
+        for (int b = 0; b <= n; ++b) {
+            m[TERM(n - b, b)] = -m[TERM(n - b, b)];
+        }
+    }
+}
+
+// The local expansion of a cell: its parent's, shifted to its centre, plus the
+// multipoles of the children of the parent's neighbours that are not adjacent to it.
+static void l2l_m2l(int l, int ix, int iy) {
+    double *loc = L + (size_t)cell(l, ix, iy) * nterms;
+    memset(loc, 0, nterms * sizeof(double));
+    if (count[cell(l, ix, iy)] == 0) {
+        return;
+    }
+
+    // ### Lₙ(child) = ∑ₖ Lₖ(parent) ⋅ dᵏ⁻ⁿ / (k − n)!
+    if (l > 2) {
+        const double *lp = L + (size_t)cell(l - 1, ix / 2, iy / 2) * nterms;
+        double h = cell_width(l) / 2;
+        double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1];
+        scaled_powers((ix & 1) ? h : -h, order, px);
+        scaled_powers((iy & 1) ? h : -h, order, py);
+
+        for (int n = 0; n <= order; ++n) {
+            for (int b = 0; b <= n; ++b) {
+                int a = n - b;
+                double sum = 0;
+                for (int m = n; m <= order; ++m) {
+                    for (int kb = b; kb <= m - a; ++kb) {
+                        sum += lp[TERM(m - kb, kb)] * px[m - kb - a] * py[kb - b];
+                    }
+                }
+                loc[TERM(a, b)] = sum;
+            }
+        }
+    }
+
+    int side = 1 << l;
+    int pxl = ix / 2, pyl = iy / 2;
+    for (int sy_ = max(2*pyl - 2, 0); sy_ <= min(2*pyl + 3, side - 1); ++sy_) {
+        for (int sx_ = max(2*pxl - 2, 0); sx_ <= min(2*pxl + 3, side - 1); ++sx_) {
+            int ox = sx_ - ix, oy = sy_ - iy;
+            if (max(abs(ox), abs(oy)) <= 1 || count[cell(l, sx_, sy_)] == 0) {
+                continue;
+            }
+            const double *ms = M + (size_t)cell(l, sx_, sy_) * nterms;
+            const double *d = D + ((size_t)l * 49 + (oy + 3) * 7 + ox + 3) * nterms;
+
+            for (int n = 0; n <= order; ++n) {
+                for (int b = 0; b <= n; ++b) {
+                    int a = n - b;
+                    double sum = 0;
+                    for (int k = 0; k <= order - n; ++k) {
+                        for (int kb = 0; kb <= k; ++kb) {
+                            sum += ms[TERM(k - kb, kb)] * d[TERM(a + k - kb, b + kb)];
+                        }
+                    }
+                    loc[TERM(a, b)] += sum;
+                }
+            }
+        }
+    }
+}
+
+// Evaluate the local expansion of a leaf at its objects and add the neighbouring
+// leaves directly. acc and psi are indexed like the sorted objects and leave out G.
+static void l2p_p2p(int ix, int iy, Vector *acc, double *psi) {
+    int c = (iy << depth) + ix;
+    const double *loc = L + (size_t)cell(depth, ix, iy) * nterms;
+    double w = cell_width(depth);
+    double cx = left + (ix + 0.5) * w;
+    double cy = bottom + (iy + 0.5) * w;
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1];
+
+    for (int i = leaf_start[c]; i < leaf_start[c + 1]; ++i) {
+        scaled_powers(sx[i] - cx, order, px);
+        scaled_powers(sy[i] - cy, order, py);
+
+        double f = 0, gx = 0, gy = 0;
+        for (int n = 0; n <= order; ++n) {
+            for (int b = 0; b <= n; ++b) {
+                int a = n - b;
+                double l = loc[TERM(a, b)];
+                f += l * px[a] * py[b];
+                if (a > 0) gx += l * px[a - 1] * py[b];
+                if (b > 0) gy += l * px[a] * py[b - 1];
+            }
+        }
+
+        int side = 1 << depth;
+        for (int ny = max(iy - 1, 0); ny <= min(iy + 1, side - 1); ++ny) {
+            for (int nx = max(ix - 1, 0); nx <= min(ix + 1, side - 1); ++nx) {
+                int n = (ny << depth) + nx;
+                for (int j = leaf_start[n]; j < leaf_start[n + 1]; ++j) {
+                    if (j == i) {
+                        continue;
+                    }
+                    double dx = sx[j] - sx[i];
+                    double dy = sy[j] - sy[i];
+                    double d1 = 1.0 / sqrt(dx*dx + dy*dy);
+                    double d3 = d1 * d1 * d1;
+                    f += sm[j] * d1;
+                    gx += sm[j] * d3 * dx;
+                    gy += sm[j] * d3 * dy;
+                }
+            }
+        }
+
+        acc[i] = (Vector) { gx, gy };
+        psi[i] = f;
+    }
+}
+
+typedef struct Pass {
+    int stage;
+    int level;
+    Vector *acc;
+    double *psi;
+} Pass;
+
+enum { STAGE_P2M, STAGE_M2M, STAGE_NEGATE, STAGE_L2L_M2L, STAGE_LEAVES };
+
+// Split the cells of a level evenly over the threads.
+static void run_stage(void *arg, int tid, int nthreads) {
+    Pass *pass = arg;
+    int l = pass->stage == STAGE_P2M || pass->stage == STAGE_LEAVES ? depth : pass->level;
+    int side = 1 << l;
+    long cells = (long)side * side;
+
+    for (long c = cells * tid / nthreads; c < cells * (tid + 1) / nthreads; ++c) {
+        int ix = c % side;
+        int iy = c / side;
+        switch (pass->stage) {
+            case STAGE_P2M: p2m(c, ix, iy); break;
+            case STAGE_M2M: m2m(l, ix, iy); break;
+            case STAGE_NEGATE: negate_odd(cell(l, ix, iy)); break;
+            case STAGE_L2L_M2L: l2l_m2l(l, ix, iy); break;
+            case STAGE_LEAVES: l2p_p2p(ix, iy, pass->acc, pass->psi); break;
+        }
+    }
+}
+
+static void direct(const Universe *uni, Vector *a, double *pot) {
+    for (int i = 0; i < uni->N; ++i) {
+        double ax = 0, ay = 0, f = 0;
+        for (int j = 0; j < uni->N; ++j) {
+            if (j == i) {
+                continue;
+            }
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double d1 = 1.0 / sqrt(dx*dx + dy*dy);
+            double d3 = d1 * d1 * d1;
+            f += uni->m[j] * d1;
+            ax += uni->m[j] * d3 * dx;
+            ay += uni->m[j] * d3 * dy;
+        }
+        a[i] = (Vector) { G * ax, G * ay };
+        if (pot) {
+            pot[i] = -G * f;
+        }
+    }
+}
+
+static Vector *sorted_acc = NULL;
+static double *sorted_psi = NULL;
+static int sorted_cap = 0;
+
+void acc_pot_fmm(const Universe *uni, Vector *a, double *pot) {
+    STATS_KERNEL(STATS_FMM, 0);
+    if (uni->N < DIRECT_BELOW) {
+        direct(uni, a, pot);
+        return;
+    }
+    if (uni->N > sorted_cap) {
+        sorted_cap = uni->N;
+        sorted_acc = realloc(sorted_acc, sorted_cap * sizeof(Vector));
+        sorted_psi = realloc(sorted_psi, sorted_cap * sizeof(double));
+    }
+
+    build_tree(uni);
+
+    Pass pass = { STAGE_P2M, depth, sorted_acc, sorted_psi };
+    parallel_run(run_stage, &pass);
+
+    for (pass.stage = STAGE_M2M, pass.level = depth - 1; pass.level >= 2; --pass.level) {
+        parallel_run(run_stage, &pass);
+    }
+
+    for (pass.stage = STAGE_NEGATE, pass.level = 2; pass.level <= depth; ++pass.level) {
+        parallel_run(run_stage, &pass);
+    }
+
+    for (pass.stage = STAGE_L2L_M2L, pass.level = 2; pass.level <= depth; ++pass.level) {
+        parallel_run(run_stage, &pass);
+    }
+
+    pass.stage = STAGE_LEAVES;
+    parallel_run(run_stage, &pass);
+
+    for (int k = 0; k < uni->N; ++k) {
+        int i = original[k];
+        a[i] = (Vector) { G * sorted_acc[k].x, G * sorted_acc[k].y };
+        if (pot) {
+            pot[i] = -G * sorted_psi[k];
+        }
+    }
+}
+
+void acc_fmm(const Universe *uni, Vector *a) {
+    acc_pot_fmm(uni, a, NULL);
+}
+
+// Calculate the total gravitational energy of the Universe from the FMM potentials.
+// ### Eg = ∑ᵢ mᵢ ⋅ φᵢ / 2
+double gravitational_energy_fmm(const Universe *uni) {
+    Vector *a = malloc(uni->N * sizeof(Vector));
+    double *pot = malloc(uni->N * sizeof(double));
+    acc_pot_fmm(uni, a, pot);
+
+    double energy = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        energy += uni->m[i] * pot[i];
+    }
+
+    free(pot);
+    free(a);
+    return energy / 2;
+}
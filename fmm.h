@@ -0,0 +1,27 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include "gravity.h"
+
+#define FMM_MAX_ORDER 16
+
+// Set the expansion order p. The error drops roughly geometrically with p,
+// the cost of the far field grows with p⁴. Defaults to 8.
+void set_fmm_order(int p);
+
+int get_fmm_order(void);
+
+// Set the average number of objects per leaf of the tree. Defaults to 32.
+void set_fmm_leaf_size(int s);
+
+// Calculate the accelerations with the fast multipole method, in O(N).
+void acc_fmm(const Universe *uni, Vector *a);
+
+// Calculate the accelerations and the potential at every object in the same pass.
+// ### φᵢ = − ∑ⱼ G ⋅ mⱼ / d(pⱼ, pᵢ)
+void acc_pot_fmm(const Universe *uni, Vector *a, double *pot);
+
+// The same as gravitational_energy(), in O(N).
+double gravitational_energy_fmm(const Universe *uni);
+
+#endif /* FMM_H */
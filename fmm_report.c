@@ -0,0 +1,67 @@
+#include "gravity.h"
+#include "barneshut.h"
+#include "fmm.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Accuracy and speed of the fast multipole method for a range of expansion orders,
+// compared against the direct sum acc(), and Barnes-Hut at its default angle.
+// usage: fmm_report [N]
+
+
+static double seconds_per_call(acc_fn f, const Universe *uni, Vector *a) {
+    int calls = 0;
+    clock_t start = clock();
+    do {
+        f(uni, a);
+        ++calls;
+    } while (clock() - start < CLOCKS_PER_SEC / 4);
+    return (double)(clock() - start) / CLOCKS_PER_SEC / calls;
+}
+
+// The error relative to the rms acceleration.
+static double rms_error(const Vector *approx, const Vector *exact, int N) {
+    double sq_err = 0;
+    double sq_norm = 0;
+    for (int i = 0; i < N; ++i) {
+        double dx = approx[i].x - exact[i].x;
+        double dy = approx[i].y - exact[i].y;
+        sq_err += dx*dx + dy*dy;
+        sq_norm += exact[i].x * exact[i].x + exact[i].y * exact[i].y;
+    }
+    return sqrt(sq_err / sq_norm);
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 20000;
+
+    Universe *uni = create_random_universe(N);
+    Vector *exact = calloc(N, sizeof(Vector));
+    Vector *approx = calloc(N, sizeof(Vector));
+
+    double direct_time = seconds_per_call(acc, uni, exact);
+    double energy = gravitational_energy(uni);
+    printf("N = %d, direct acc(): %.3f ms per call\n\n", N, direct_time * 1e+3);
+
+    double time = seconds_per_call(acc_barnes_hut, uni, approx);
+    printf("Barnes-Hut, theta = %.2f: %.3f ms per call, rms force err %.3E\n\n",
+        get_barnes_hut_theta(), time * 1e+3, rms_error(approx, exact, N));
+
+    printf("    p   ms/call  speedup  rms force err    energy err\n");
+    for (int p = 2; p <= FMM_MAX_ORDER; p += 2) {
+        set_fmm_order(p);
+        time = seconds_per_call(acc_fmm, uni, approx);
+        double energy_err = fabs(gravitational_energy_fmm(uni) - energy) / fabs(energy);
+
+        printf("%5d %9.3f %8.2f %14.3E %13.3E\n",
+            p, time * 1e+3, direct_time / time, rms_error(approx, exact, N), energy_err);
+    }
+
+    free(approx);
+    free(exact);
+    destroy_universe(uni);
+    return 0;
+}
@@ -0,0 +1,260 @@
+from fractions import Fraction as F
+from math import lcm, gcd
+
+# Generates rkn_generated.inc, the embedded Runge-Kutta-Nyström steppers of steppers.c,
+# from their tableaux in exact arithmetic. Every stage becomes one loop over the objects
+# with its coefficients as constants, and the velocity update and the error estimate
+# share the last loop. Run it after changing a tableau:
+#
+#     python3 gen_rkn.py > rkn_generated.inc
+#
+# A tableau for x'' = f(x) with s stages:
+#     stage k at t + c[k] ⋅ h:  fₖ = f(p + c[k] ⋅ h ⋅ v + h² ⋅ ∑ⱼ a[k][j] ⋅ fⱼ)
+#     p' = p + h ⋅ v + h² ⋅ ∑ₖ bbar[k] ⋅ fₖ
+#     v' = v + h ⋅ ∑ₖ b[k] ⋅ fₖ
+#     the embedded solution has the position weights ehat; the difference of the positions
+#     is the error estimate, the same one step_rkn_tableau() and the ensemble use.
+#
+# Stage 0 comes from the accelerations kept from the last step. If the last stage is
+# evaluated at p' (first same as last), it is kept for the next step.
+
+
+def row(*values):
+    return [F(x) for x in values]
+
+
+# Dormand, El-Mikkawy and Prince (1987), RKN4(5): 4th order, first same as last.
+RKN45 = dict(
+    name="rkn45",
+    c=row(0, "1/3", "2/3", 1, 1),
+    a=[row(),
+       row("1/18"),
+       row(0, "2/9"),
+       row("1/3", 0, "1/6"),
+       row("13/120", "3/10", "3/40", "1/60")],
+    bbar=row("13/120", "3/10", "3/40", "1/60", 0),
+    b=row("1/8", "3/8", "3/8", "1/8", 0),
+    ehat=row("13/120", "3/10", "3/40", 0, "1/60"),
+)
+
+# Dormand and Prince, RKN6(7): 6th order, first same as last.
+RKN67 = dict(
+    name="rkn67",
+    c=row(0, "1/10", "1/5", "2/5", "3/5", "4/5", 1, 1),
+    a=[row(),
+       row("1/200"),
+       row("1/150", "2/150"),
+       row("2/75", 0, "4/75"),
+       row("9/200", 0, "18/200", "9/200"),
+       row("199/3600", "-456/3600", "1410/3600", "-357/3600", "356/3600"),
+       row("-179/1824", "816/1824", 0, "-444/1824", "876/1824", "-157/1824"),
+       row("122/2016", 0, "475/2016", "100/2016", "250/2016", "50/2016", "11/2016")],
+    bbar=row("122/2016", 0, "475/2016", "100/2016", "250/2016", "50/2016", "11/2016", 0),
+    b=row("19/288", 0, "75/288", "50/288", "50/288", "75/288", "19/288", 0),
+    ehat=row("122/2016", 0, "475/2016", "100/2016", "250/2016", "50/2016", 0, "11/2016"),
+)
+
+
+# Fehlberg (1968), RK7(8) for first order systems, 13 stages.
+def fehlberg78():
+    c = row(0, "2/27", "1/9", "1/6", "5/12", "1/2", "5/6", "1/6", "2/3", "1/3", 1, 0, 1)
+    A = [row(),
+         row("2/27"),
+         row("1/36", "1/12"),
+         row("1/24", 0, "1/8"),
+         row("5/12", 0, "-25/16", "25/16"),
+         row("1/20", 0, 0, "1/4", "1/5"),
+         row("-25/108", 0, 0, "125/108", "-65/27", "125/54"),
+         row("31/300", 0, 0, 0, "61/225", "-2/9", "13/900"),
+         row(2, 0, 0, "-53/6", "704/45", "-107/9", "67/90", 3),
+         row("-91/108", 0, 0, "23/108", "-976/135", "311/54", "-19/60", "17/6", "-1/12"),
+         row("2383/4100", 0, 0, "-341/164", "4496/1025", "-301/82", "2133/4100", "45/82", "45/164", "18/41"),
+         row("3/205", 0, 0, 0, 0, "-6/41", "-3/205", "-3/41", "3/41", "6/41", 0),
+         row("-1777/4100", 0, 0, "-341/164", "4496/1025", "-289/82", "2193/4100", "51/82", "33/164", "12/41", 0, 1)]
+    b7 = row("41/840", 0, 0, 0, 0, "34/105", "9/35", "9/35", "9/280", "9/280", "41/840", 0, 0)
+    b8 = row(0, 0, 0, 0, 0, "34/105", "9/35", "9/35", "9/280", "9/280", 0, "41/840", "41/840")
+    for k in range(13):
+        assert sum(A[k]) == c[k]
+    return c, A, b7, b8
+
+
+# An RK method applied to x' = v, v' = f(x) is the RKN method with a = A², bbar = b ⋅ A.
+def nystrom(c, A, b, bhat):
+    s = len(c)
+    A = [r + [F(0)] * (s - len(r)) for r in A]
+    a = [[sum(A[k][m] * A[m][j] for m in range(s)) for j in range(k)] for k in range(s)]
+    bbar = [sum(b[m] * A[m][j] for m in range(s)) for j in range(s)]
+    ehat = [sum(bhat[m] * A[m][j] for m in range(s)) for j in range(s)]
+    return a, bbar, ehat
+
+
+def rkn87():
+    c, A, b7, b8 = fehlberg78()
+    a, bbar, ehat = nystrom(c, A, b8, b7)
+    # The 8th order solution is propagated and the 7th order one estimates its error.
+    return dict(name="rkn87", c=c, a=a, bbar=bbar, b=b8, ehat=ehat)
+
+
+def check(t):
+    s = len(t["c"])
+    for k in range(s):
+        assert len(t["a"][k]) == k
+    # The quadrature conditions of the first orders.
+    for q in range(1, 4):
+        assert sum(b * c ** (q - 1) for b, c in zip(t["b"], t["c"])) == F(1, q), (t["name"], q)
+        assert sum(b * c ** (q - 1) for b, c in zip(t["bbar"], t["c"])) == F(1, q * (q + 1)), (t["name"], q)
+        assert sum(b * c ** (q - 1) for b, c in zip(t["ehat"], t["c"])) == F(1, q * (q + 1)), (t["name"], q)
+
+
+def used_stages(t):
+    # A stage whose value no later stage, update or error estimate uses need not be evaluated.
+    s = len(t["c"])
+    e = [x - y for x, y in zip(t["bbar"], t["ehat"])]
+    used = [True] * s
+    for j in reversed(range(s)):
+        later = any(used[k] and t["a"][k][j] != 0 for k in range(j + 1, s))
+        used[j] = j == 0 or later or t["bbar"][j] != 0 or t["b"][j] != 0 or e[j] != 0
+    return used
+
+
+def fraction(x, var):
+    # x ⋅ var as C, e.g. "h*2/5"
+    if x == 1:
+        return var
+    if x.denominator == 1:
+        return "%s*%d" % (var, x.numerator)
+    if x.numerator == 1:
+        return "%s/%d" % (var, x.denominator)
+    return "%s*%d/%d" % (var, x.numerator, x.denominator)
+
+
+def weighted_sum(weights, names, comp):
+    # ∑ⱼ wⱼ ⋅ names[j][i].comp as C. The weights share a denominator if it is small,
+    # otherwise they are written as decimals.
+    terms = [(w, names[j]) for j, w in enumerate(weights) if w != 0]
+    den = lcm(*[w.denominator for w, _ in terms])
+    num = [w * den for w, _ in terms]
+    g = gcd(*[int(n) for n in num])
+    if den <= 100000 and max(abs(n) for n in num) / g <= 100000:
+        scale = F(g, den)
+        out = ""
+        for (w, name), n in zip(terms, num):
+            n = int(n) // g
+            term = "%s[i].%s" % (name, comp) + ("" if abs(n) == 1 else "*%d" % abs(n))
+            out += ("-" if n < 0 else "") + term if not out else (" - " if n < 0 else " + ") + term
+        if scale == 1:
+            return out
+        if len(terms) > 1:
+            out = "(%s)" % out
+        if scale.numerator == 1:
+            return "%s / %d" % (out, scale.denominator)
+        return "%s * %d/%d" % (out, scale.numerator, scale.denominator)
+
+    out = ""
+    for w, name in terms:
+        term = "%s[i].%s*%.17g" % (name, comp, abs(float(w)))
+        out += ("-" if w < 0 else "") + term if not out else (" - " if w < 0 else " + ") + term
+    return out
+
+
+def generate(t):
+    check(t)
+    name, c, a, bbar, b = t["name"], t["c"], t["a"], t["bbar"], t["b"]
+    s = len(c)
+    e = [x - y for x, y in zip(bbar, t["ehat"])]
+    used = used_stages(t)
+    # First same as last: the last stage is evaluated at p', and the velocity does not need it.
+    fsal = c[-1] == 1 and a[-1] == bbar[:-1] and bbar[-1] == 0 and b[-1] == 0
+
+    stages = [k for k in range(1, s) if used[k]]
+    calls = len(stages) + 1 - fsal
+    names = ["k%d" % k for k in range(s)]
+
+    out = []
+    w = out.append
+    w("// %s: %d force evaluations per step%s." % (
+        name, calls, ", the last is the first of the next step" if fsal else ""))
+    w("double step_%s(Integrator *ctx, Universe *uni, double h) {" % name)
+    w("    prepare(ctx, uni, %d);" % (len(stages) + 1))
+    w("    Vector *p = buffer(ctx, 0);")
+    decl = ["*%s = buffer(ctx, %d)" % (names[k], n + 1) for n, k in enumerate(stages)]
+    for n in range(0, len(decl), 4):
+        w("    Vector %s;" % ", ".join(decl[n:n + 4]))
+    w("    memcpy(p, uni->p, sizeof(Vector) * uni->N);")
+    w("    double t = uni->t;")
+    w("")
+    w("    Vector *k0 = current_acc(ctx, uni);")
+
+    for k in stages:
+        last = fsal and k == s - 1
+        w("")
+        w("    for (int i = 0; i < uni->N; ++i) {")
+        if any(a[k]):
+            for comp in "xy":
+                w("        double T%s = %s;" % (comp, weighted_sum(a[k], names, comp)))
+        for comp in "xy":
+            v = "" if c[k] == 0 else " + uni->v[i].%s * %s" % (comp, fraction(c[k], "h"))
+            T = " + T%s * h*h" % comp if any(a[k]) else ""
+            w("        uni->p[i].%s = p[i].%s%s%s;" % (comp, comp, v, T))
+        w("    }")
+        w("    uni->t = t;" if c[k] == 0 else "    uni->t = t + %s;" % fraction(c[k], "h"))
+        if last:
+            w("    acc_end(ctx, uni, %s, uni->t);" % names[k])
+        else:
+            w("    ctx->acc(uni, %s);" % names[k])
+
+    # The error estimate e ⋅ h², with e factored into a constant and a sum of the stages.
+    scale = F(1)
+    nz = [x for x in e if x != 0]
+    den = lcm(*[x.denominator for x in nz])
+    g = gcd(*[int(x * den) for x in nz])
+    if den <= 100000:
+        scale = F(g, den)
+    ex = [x / scale for x in e]
+
+    w("")
+    w("    double error = 0;")
+    w("    for (int i = 0; i < uni->N; ++i) {")
+    if not fsal:
+        for comp in "xy":
+            w("        double P%s = %s;" % (comp, weighted_sum(bbar, names, comp)))
+        for comp in "xy":
+            w("        uni->p[i].%s = p[i].%s + uni->v[i].%s * h + P%s * h*h;" % (comp, comp, comp, comp))
+        w("")
+    for comp in "xy":
+        w("        double V%s = %s;" % (comp, weighted_sum(b, names, comp)))
+    for comp in "xy":
+        w("        uni->v[i].%s += h * V%s;" % (comp, comp))
+    w("")
+    for comp in "xy":
+        w("        double e%s = %s;" % (comp, weighted_sum(ex, names, comp)))
+    w("        double e2 = ex*ex + ey*ey;")
+    w("        if (e2 != 0) {")
+    w("            double dx = uni->p[i].x - p[i].x;")
+    w("            double dy = uni->p[i].y - p[i].y;")
+    w("            error = max(error, e2 / (dx*dx + dy*dy));")
+    w("        }")
+    w("    }")
+    w("    uni->t = t + h;")
+    w("    error = %s * sqrt(error) / ctx->tol;" % fraction(scale, "h*h"))
+
+    if fsal:
+        w("")
+        w("    // integrate() keeps the step, so its last stage is the first of the next one.")
+        w("    if (error <= 1) {")
+        w("        memcpy(ctx->fsal, %s, sizeof(Vector) * uni->N);" % names[s - 1])
+        w("        ctx->fsal_t = uni->t;")
+        w("        ctx->fsal_valid = 1;")
+        w("    }")
+    w("    return error;")
+    w("}")
+    return "\n".join(out)
+
+
+if __name__ == "__main__":
+    print("// Generated by gen_rkn.py from the tableaux there. Do not edit.")
+    print("// Included by steppers.c, which provides prepare(), buffer(), current_acc() and acc_end().")
+    print("// While forces are evaluated, uni->t is the time of the stage.")
+    for t in (RKN45, RKN67, rkn87()):
+        print()
+        print(generate(t))
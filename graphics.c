@@ -1,6 +1,8 @@
 #include "graphics.h"
 #include "gravity.h"
 #include <SDL2/SDL.h>
+#include <math.h>
+#include <string.h>
 
 
 int graphics_init(SDL_Window **window, SDL_Renderer **renderer) {
@@ -36,47 +38,224 @@ int graphics_init(SDL_Window **window, SDL_Renderer **renderer) {
 }
 
 
+// The scratch points of render_circle(), kept between calls.
+static SDL_Point *circle_points = NULL;
+static int circle_cap = 0;
+
 int render_circle(SDL_Renderer *renderer, SDL_Point centre, int radius) {
     int r2 = radius * radius;
-    
-    // Maybe cache these points and shift them when needed?
-    // Performance impact not yet clear.
-    SDL_Point *points = calloc(4 * r2, sizeof(SDL_Point));
+    if (4 * r2 > circle_cap) {
+        circle_cap = 4 * r2;
+        free(circle_points);
+        circle_points = calloc(circle_cap, sizeof(SDL_Point));
+    }
 
     int point_count = 0;
     for (int x = -radius+1; x < radius; ++x) {
         for (int y = -radius+1; y < radius; ++y) {
             if ((x*x + y*y) < r2) {
-                points[point_count++] = (SDL_Point) { centre.x + x, centre.y + y };
+                circle_points[point_count++] = (SDL_Point) { centre.x + x, centre.y + y };
             }
         }
     }
 
-    int success = SDL_RenderDrawPoints(renderer, points, point_count);
-    free(points);
-    return success;
+    return SDL_RenderDrawPoints(renderer, circle_points, point_count);
 }
 
-// Scale the radii so that r ~ sqrt(m) and the heaviest object has a radius of max_radius (in pixels).
-// Set the center of the screen at the center of gravity and scale down by xscale and yscale.
-void scale_to_screen(const Universe *uni, double xscale, double yscale, int max_radius, SDL_Point *points, int *radii) {
+// The side of the circle texture in pixels. Smaller circles are scaled down from it.
+#define SPRITE_SIZE 64
+
+static SDL_Texture *sprite = NULL;
+static SDL_Renderer *sprite_renderer = NULL;
+
+// A white circle on a transparent background, its edge smoothed by 4 x 4 samples per
+// pixel. Textures belong to a renderer, so it is made again for another one.
+static SDL_Texture* circle_sprite(SDL_Renderer *renderer) {
+    if (sprite && sprite_renderer == renderer) {
+        return sprite;
+    }
+    if (sprite) {
+        SDL_DestroyTexture(sprite);
+    }
+
+    static Uint32 pixels[SPRITE_SIZE * SPRITE_SIZE];
+    double r = SPRITE_SIZE / 2.0;
+    for (int y = 0; y < SPRITE_SIZE; ++y) {
+        for (int x = 0; x < SPRITE_SIZE; ++x) {
+            int inside = 0;
+            for (int s = 0; s < 16; ++s) {
+                double dx = x + (s % 4 + 0.5) / 4 - r;
+                double dy = y + (s / 4 + 0.5) / 4 - r;
+                inside += dx*dx + dy*dy < r*r;
+            }
+            pixels[y * SPRITE_SIZE + x] = (Uint32)(255 * inside / 16) << 24 | 0xffffff;
+        }
+    }
+
+    sprite = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SPRITE_SIZE, SPRITE_SIZE);
+    sprite_renderer = renderer;
+    if (NULL == sprite) {
+        return NULL;
+    }
+    SDL_UpdateTexture(sprite, NULL, pixels, SPRITE_SIZE * sizeof(Uint32));
+    SDL_SetTextureBlendMode(sprite, SDL_BLENDMODE_BLEND);
+    return sprite;
+}
+
+// The quads of render_circles(), kept between calls. The indices never change.
+static SDL_Vertex *vertices = NULL;
+static int *indices = NULL;
+static int quads_cap = 0;
+
+int render_circles(SDL_Renderer *renderer, const SDL_Point *centres, const int *radii, int n, SDL_Color color) {
+    SDL_Texture *texture = circle_sprite(renderer);
+    if (NULL == texture) {
+        return -1;
+    }
+    if (n > quads_cap) {
+        quads_cap = max(n, 2 * quads_cap);
+        free(vertices);
+        free(indices);
+        vertices = malloc(4 * quads_cap * sizeof(SDL_Vertex));
+        indices = malloc(6 * quads_cap * sizeof(int));
+        // Two triangles per quad: 0 1 2 and 2 3 0.
+        static const int corners[6] = { 0, 1, 2, 2, 3, 0 };
+        for (int q = 0; q < quads_cap; ++q) {
+            for (int k = 0; k < 6; ++k) {
+                indices[6 * q + k] = 4 * q + corners[k];
+            }
+        }
+    }
+
+    int quads = 0;
+    for (int i = 0; i < n; ++i) {
+        float r = max(radii[i], 1);
+        float x = centres[i].x;
+        float y = centres[i].y;
+        // Circles entirely off the screen cost nothing.
+        if (x + r < 0 || x - r > SCREEN_WIDTH || y + r < 0 || y - r > SCREEN_HEIGHT) {
+            continue;
+        }
+        SDL_Vertex *v = vertices + 4 * quads++;
+        v[0] = (SDL_Vertex) { { x - r, y - r }, color, { 0, 0 } };
+        v[1] = (SDL_Vertex) { { x + r, y - r }, color, { 1, 0 } };
+        v[2] = (SDL_Vertex) { { x + r, y + r }, color, { 1, 1 } };
+        v[3] = (SDL_Vertex) { { x - r, y + r }, color, { 0, 1 } };
+    }
+    if (0 == quads) {
+        return 0;
+    }
+    return SDL_RenderGeometry(renderer, texture, vertices, 4 * quads, indices, 6 * quads);
+}
+
+// The heat map of render_density(): the mass per pixel, the colours, and the streaming texture they go to.
+static double *density = NULL;
+static Uint32 *heat = NULL;
+static Uint32 palette[256];
+static SDL_Texture *heat_texture = NULL;
+static SDL_Renderer *heat_renderer = NULL;
+
+// The smallest non-zero density gets this colour, so that it stands out from the background.
+#define PALETTE_LOW 48
+
+static int prepare_heat(SDL_Renderer *renderer) {
+    if (NULL == density) {
+        density = malloc((size_t)SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(double));
+        heat = malloc((size_t)SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(Uint32));
+        // Black, red, yellow, white.
+        for (int k = 0; k < 256; ++k) {
+            double t = (k + 1) / 256.0;
+            int r = 255 * min(1.0, 3 * t);
+            int g = 255 * max(0.0, min(1.0, 3 * t - 1));
+            int b = 255 * max(0.0, min(1.0, 3 * t - 2));
+            palette[k] = 0xffu << 24 | r << 16 | g << 8 | b;
+        }
+    }
+    if (heat_texture && heat_renderer == renderer) {
+        return 0;
+    }
+    if (heat_texture) {
+        SDL_DestroyTexture(heat_texture);
+    }
+    heat_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        SCREEN_WIDTH, SCREEN_HEIGHT);
+    heat_renderer = renderer;
+    return heat_texture ? 0 : -1;
+}
+
+int render_density(SDL_Renderer *renderer, const SDL_Point *points, const double *m, int n) {
+    if (prepare_heat(renderer) < 0) {
+        return -1;
+    }
+    int pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    memset(density, 0, pixels * sizeof(double));
+    for (int i = 0; i < n; ++i) {
+        int x = points[i].x;
+        int y = points[i].y;
+        if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT) {
+            density[y * SCREEN_WIDTH + x] += fabs(m[i]);
+        }
+    }
+
+    double low = INFINITY, high = 0;
+    for (int p = 0; p < pixels; ++p) {
+        if (density[p] > 0) {
+            low = min(low, density[p]);
+            high = max(high, density[p]);
+        }
+    }
+    // ### colour = PALETTE_LOW + (255 − PALETTE_LOW) ⋅ log(ρ / ρmin) / log(ρmax / ρmin)
+    double scale = high > low ? (255 - PALETTE_LOW) / log(high / low) : 0;
+    for (int p = 0; p < pixels; ++p) {
+        heat[p] = density[p] > 0 ? palette[PALETTE_LOW + (int)(log(density[p] / low) * scale)] : palette[0];
+    }
+
+    if (SDL_UpdateTexture(heat_texture, NULL, heat, SCREEN_WIDTH * sizeof(Uint32)) < 0) {
+        return -1;
+    }
+    return SDL_RenderCopy(renderer, heat_texture, NULL, NULL);
+}
+
+Projection screen_projection(const Universe *uni, double xscale, double yscale, int max_radius) {
     double maxm = uni->m[0];
     for (int i = 0; i < uni->N; ++i) {
         maxm = max(uni->m[i], maxm);
     }
     // r = k * sqrt(m)
     // k = r_max / sqrt(m_max)
-    double k = (double)max_radius / sqrt(maxm);
+    Projection proj = { xscale, yscale, center_of_gravity(uni), (double)max_radius / sqrt(maxm) };
+    return proj;
+}
 
-    Vector center = center_of_gravity(uni);
+void project(Projection *proj, const Universe *uni, SDL_Point *points, int *radii) {
+    Vector center = proj->center;
+    double mass = 0;
+    Vector moment = { 0, 0 };
 
     for (int i = 0; i < uni->N; ++i) {
         // Shift by the center of gravity, scale down by xscale and yscale and fit to screen.
         points[i] = (SDL_Point) {
-            ((uni->p[i].x - center.x) / xscale + 1) * SCREEN_WIDTH / 2,
-            ((uni->p[i].y - center.y) / yscale + 1) * SCREEN_HEIGHT / 2
+            ((uni->p[i].x - center.x) / proj->xscale + 1) * SCREEN_WIDTH / 2,
+            ((uni->p[i].y - center.y) / proj->yscale + 1) * SCREEN_HEIGHT / 2
         };
+        mass += uni->m[i];
+        moment.x += uni->p[i].x * uni->m[i];
+        moment.y += uni->p[i].y * uni->m[i];
+    }
+    if (radii) {
+        for (int i = 0; i < uni->N; ++i) {
+            radii[i] = proj->k * sqrt(uni->m[i]);
+        }
+    }
 
-        radii[i] = k * sqrt(uni->m[i]);
+    if (mass != 0) {
+        proj->center = (Vector) { moment.x / mass, moment.y / mass };
     }
-}
\ No newline at end of file
+}
+
+// Scale the radii so that r ~ sqrt(m) and the heaviest object has a radius of max_radius (in pixels).
+// Set the center of the screen at the center of gravity and scale down by xscale and yscale.
+void scale_to_screen(const Universe *uni, double xscale, double yscale, int max_radius, SDL_Point *points, int *radii) {
+    Projection proj = screen_projection(uni, xscale, yscale, max_radius);
+    project(&proj, uni, points, radii);
+}
@@ -7,10 +7,36 @@
 static const int SCREEN_WIDTH = 500;
 static const int SCREEN_HEIGHT = 500;
 
+// How positions map to the screen: the centre of gravity in the middle, scaled down by
+// xscale and yscale, and radii r ~ sqrt(m) so that the heaviest object gets max_radius.
+typedef struct Projection {
+    double xscale;
+    double yscale;
+    Vector center;  // of gravity, kept up to date by project()
+    double k;       // radius per sqrt(mass), in pixels
+} Projection;
+
+// Measure the masses and the centre of gravity once. Call it again after the masses changed.
+Projection screen_projection(const Universe *uni, double xscale, double yscale, int max_radius);
+
+// The screen positions of all objects, and their radii if radii is not NULL; the radii
+// only change with the masses. The centre of gravity for the next call is summed up
+// on the way, so the picture follows it a frame late, and no extra pass is needed.
+void project(Projection *proj, const Universe *uni, SDL_Point *points, int *radii);
+
 int render_circle(SDL_Renderer *renderer, SDL_Point centre, int radius);
 
+// Draw n filled circles in one call to SDL_RenderGeometry(): a quad per circle,
+// textured with a circle rasterized once. Returns 0, or -1 on an SDL error.
+int render_circles(SDL_Renderer *renderer, const SDL_Point *centres, const int *radii, int n, SDL_Color color);
+
+// Draw the mass per pixel of n objects as a heat map, on a logarithmic scale. The
+// cost is O(n + pixels), independent of the radii, for very large n. Returns 0, or
+// -1 on an SDL error.
+int render_density(SDL_Renderer *renderer, const SDL_Point *points, const double *m, int n);
+
 void scale_to_screen(const Universe *uni, double xscale, double yscale, int max_radius, SDL_Point *points, int *radii);
 
 int graphics_init(SDL_Window **window, SDL_Renderer **renderer);
 
-#endif /* GRAPHICS_H */
\ No newline at end of file
+#endif /* GRAPHICS_H */
@@ -1,11 +1,64 @@
 #include "gravity.h"
 #include "vmath.h"
+#include "stats.h"
 
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
 
 
+// Create a Universe with N randomly placed objects of (mostly) planet-like masses.
+Universe* create_random_universe(int N) {
+    Universe *uni = calloc(1, sizeof(Universe));
+    Vector *p = calloc(N, sizeof(Vector));
+    Vector *v = calloc(N, sizeof(Vector));
+    double *m = calloc(N, sizeof(double));
+
+    for (int i = 0; i < N; ++i) {
+        p[i] = (Vector) { uniform(-1e+9, 1e+9), uniform(-1e+9, 1e+9) };
+        v[i] = (Vector) { uniform(-3e+2, 3e+2), uniform(-3e+2, 3e+2) };
+        m[i] = uniform(-1e+22, 1e+25);
+    }
+
+    uni->p = p;
+    uni->v = v;
+    uni->m = m;
+    uni->N = N;
+    return uni;
+}
+
+// Create a star with N − 1 light planets on circular orbits, with radii drawn
+// log-uniformly from 0.05 to 30 AU, so the orbital periods range from days to centuries.
+Universe* create_planetary_system(int N) {
+    const double AU = 1.496e+11;
+    const double M_SUN = 1.989e+30;
+
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = N;
+    uni->p = calloc(N, sizeof(Vector));
+    uni->v = calloc(N, sizeof(Vector));
+    uni->m = calloc(N, sizeof(double));
+
+    uni->m[0] = M_SUN;
+    for (int i = 1; i < N; ++i) {
+        double r = AU * exp(uniform(log(0.05), log(30)));
+        double phi = uniform(0, 2 * M_PI);
+        double speed = sqrt(G * M_SUN / r);
+        uni->p[i] = (Vector) { r * cos(phi), r * sin(phi) };
+        uni->v[i] = (Vector) { -speed * sin(phi), speed * cos(phi) };
+        uni->m[i] = uniform(1e+20, 1e+22);
+    }
+    return uni;
+}
+
+void destroy_universe(Universe *uni) {
+    free(uni->p);
+    free(uni->v);
+    free(uni->m);
+    free(uni);
+}
+
 // Calculate the center of gravity of a universe.
 // ### c = ∑ᵢ mᵢ ⋅ pᵢ / ∑ᵢ mᵢ
 Vector center_of_gravity(const Universe *uni) {
@@ -24,9 +77,21 @@ Vector center_of_gravity(const Universe *uni) {
     return center;
 }
 
+static double eps = 0;
+
+void set_softening(double epsilon) {
+    eps = epsilon;
+}
+
+double get_softening(void) {
+    return eps;
+}
+
 // Calculate the accelerations of the objects in a Universe.
-// ### aᵢ = ∑ⱼ mⱼ ⋅ (pⱼ − pᵢ) / d(pⱼ, pᵢ)³
+// ### aᵢ = ∑ⱼ mⱼ ⋅ (pⱼ − pᵢ) / (d(pⱼ, pᵢ)² + ε²)^(3/2)
 void acc(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_DIRECT, (long)uni->N * (uni->N - 1) / 2);
+    double eps2 = eps * eps;
     memset(a, 0, sizeof(Vector) * uni->N);
 
     for (int i = 0; i < uni->N; ++i) {
@@ -34,7 +99,7 @@ void acc(const Universe *uni, Vector *a) {
         for (int j = 0; j < i; ++j) {
             double dx = uni->p[j].x - uni->p[i].x;
             double dy = uni->p[j].y - uni->p[i].y;
-            double d3 = 1.0 / sqrt(dx*dx + dy*dy);
+            double d3 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
             d3 = d3 * d3 * d3;
 
             a[i].x += d3 * uni->m[j] * dx;
@@ -51,6 +116,113 @@ void acc(const Universe *uni, Vector *a) {
     }
 }
 
+// Calculate the accelerations and their time derivatives, the jerks, in one pass over
+// the pairs, with the relative velocity w = vⱼ − vᵢ. For step_hermite().
+// ### aᵢ = ∑ⱼ mⱼ ⋅ r / s³, with r = pⱼ − pᵢ and s² = d(pⱼ, pᵢ)² + ε²
+// ### ȧᵢ = ∑ⱼ mⱼ ⋅ (w / s³ − 3 (r ⋅ w) ⋅ r / s⁵)
+void acc_jerk(const Universe *uni, Vector *a, Vector *jerk) {
+    STATS_KERNEL(STATS_DIRECT_JERK, (long)uni->N * (uni->N - 1) / 2);
+    double eps2 = eps * eps;
+    memset(a, 0, sizeof(Vector) * uni->N);
+    memset(jerk, 0, sizeof(Vector) * uni->N);
+
+    for (int i = 0; i < uni->N; ++i) {
+        for (int j = 0; j < i; ++j) {
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double wx = uni->v[j].x - uni->v[i].x;
+            double wy = uni->v[j].y - uni->v[i].y;
+            double d1 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
+            double d3 = d1 * d1 * d1;
+            double rw = 3 * (dx*wx + dy*wy) * d1 * d1;
+
+            // Both terms change sign with r and w, like the force.
+            double jx = d3 * (wx - rw * dx);
+            double jy = d3 * (wy - rw * dy);
+
+            a[i].x += d3 * uni->m[j] * dx;
+            a[i].y += d3 * uni->m[j] * dy;
+            jerk[i].x += uni->m[j] * jx;
+            jerk[i].y += uni->m[j] * jy;
+
+            a[j].x -= d3 * uni->m[i] * dx;
+            a[j].y -= d3 * uni->m[i] * dy;
+            jerk[j].x -= uni->m[i] * jx;
+            jerk[j].y -= uni->m[i] * jy;
+        }
+    }
+
+    for (int i = 0; i < uni->N; ++i) {
+        a[i].x *= G;
+        a[i].y *= G;
+        jerk[i].x *= G;
+        jerk[i].y *= G;
+    }
+}
+
+// Calculate the accelerations of only the objects in targets, from all objects.
+// Only a[targets[k]] is written. Without the symmetry of acc() this costs n ⋅ N pairs.
+// ### aᵢ = ∑ⱼ mⱼ ⋅ (pⱼ − pᵢ) / (d(pⱼ, pᵢ)² + ε²)^(3/2) for i in targets
+void acc_partial(const Universe *uni, const int *targets, int n, Vector *a) {
+    STATS_KERNEL(STATS_PARTIAL, (long)n * (uni->N - 1));
+    double eps2 = eps * eps;
+    for (int k = 0; k < n; ++k) {
+        int i = targets[k];
+        double ax = 0;
+        double ay = 0;
+
+        for (int j = 0; j < uni->N; ++j) {
+            if (j == i) {
+                continue;
+            }
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double d3 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
+            d3 = d3 * d3 * d3;
+
+            ax += d3 * uni->m[j] * dx;
+            ay += d3 * uni->m[j] * dy;
+        }
+
+        a[i].x = G * ax;
+        a[i].y = G * ay;
+    }
+}
+
+// Calculate the accelerations and the potential at every object in one pass over the
+// pairs, which shares 1/d between both and costs little more than acc() alone.
+// ### φᵢ = − ∑ⱼ G ⋅ mⱼ / √(d(pⱼ, pᵢ)² + ε²)
+void acc_pot(const Universe *uni, Vector *a, double *pot) {
+    STATS_KERNEL(STATS_DIRECT_POT, (long)uni->N * (uni->N - 1) / 2);
+    double eps2 = eps * eps;
+    memset(a, 0, sizeof(Vector) * uni->N);
+    memset(pot, 0, sizeof(double) * uni->N);
+
+    for (int i = 0; i < uni->N; ++i) {
+        for (int j = 0; j < i; ++j) {
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double d1 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
+            double d3 = d1 * d1 * d1;
+
+            a[i].x += d3 * uni->m[j] * dx;
+            a[i].y += d3 * uni->m[j] * dy;
+
+            a[j].x -= d3 * uni->m[i] * dx;
+            a[j].y -= d3 * uni->m[i] * dy;
+
+            pot[i] -= d1 * uni->m[j];
+            pot[j] -= d1 * uni->m[i];
+        }
+    }
+
+    for (int i = 0; i < uni->N; ++i) {
+        a[i].x *= G;
+        a[i].y *= G;
+        pot[i] *= G;
+    }
+}
+
 // Calculate the total kinetic energy of the Universe.
 // ### Eₖ = ∑ᵢ mᵢ ⋅ |vᵢ|² / 2
 double kinetic_energy(const Universe *uni) {
@@ -65,13 +237,16 @@ double kinetic_energy(const Universe *uni) {
 }
 
 // Calculate the total gravitational energy of the Universe.
-// ### Eg = − ∑ᵢⱼ mᵢ ⋅ mⱼ / d(pᵢ, pⱼ)
+// ### Eg = − ∑ᵢⱼ mᵢ ⋅ mⱼ / √(d(pᵢ, pⱼ)² + ε²)
 double gravitational_energy(const Universe *uni) {
+    double eps2 = eps * eps;
     double energy = 0;
 
     for (int i = 1; i < uni->N; ++i) {
         for (int j = 0; j < i; ++j) {
-            energy -= uni->m[i] * uni->m[j] * inv_distance(uni->p[i], uni->p[j]);
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            energy -= uni->m[i] * uni->m[j] / sqrt(dx*dx + dy*dy + eps2);
         }
     }
 
@@ -83,4 +258,30 @@ double gravitational_energy(const Universe *uni) {
 // ### Eₜ = Eₖ + Eg = constant
 double total_energy(const Universe *uni) {
     return gravitational_energy(uni) + kinetic_energy(uni);
-}
\ No newline at end of file
+}
+
+// Calculate the total momentum of the Universe, which is conserved.
+// ### P = ∑ᵢ mᵢ ⋅ vᵢ
+Vector momentum(const Universe *uni) {
+    Vector P = { 0, 0 };
+
+    for (int i = 0; i < uni->N; ++i) {
+        P.x += uni->m[i] * uni->v[i].x;
+        P.y += uni->m[i] * uni->v[i].y;
+    }
+
+    return P;
+}
+
+// Calculate the total angular momentum of the Universe around the origin, which is conserved.
+// In the plane it only has a z component.
+// ### L = ∑ᵢ mᵢ ⋅ (xᵢ ⋅ vyᵢ − yᵢ ⋅ vxᵢ)
+double angular_momentum(const Universe *uni) {
+    double L = 0;
+
+    for (int i = 0; i < uni->N; ++i) {
+        L += uni->m[i] * (uni->p[i].x * uni->v[i].y - uni->p[i].y * uni->v[i].x);
+    }
+
+    return L;
+}
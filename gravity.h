@@ -25,16 +25,57 @@ typedef struct Universe {
     Vector *p;
     Vector *v;
     double *m;
+    double t;  // simulation time in seconds
 } Universe;
 
+// Anything that fills in the accelerations of all objects in a Universe. While a
+// stepper evaluates forces, uni->t is the time of the positions in uni->p, so a
+// force that depends on time, or extrapolates in time, can use it.
+typedef void (*acc_fn)(const Universe *uni, Vector *a);
+
+// Anything that fills in the accelerations and the potential φ of all objects.
+typedef void (*acc_pot_fn)(const Universe *uni, Vector *a, double *pot);
+
+// Anything that fills in the accelerations and their time derivatives of all objects.
+typedef void (*acc_jerk_fn)(const Universe *uni, Vector *a, Vector *jerk);
+
+// Anything that fills in the accelerations of the objects in targets only.
+typedef void (*acc_partial_fn)(const Universe *uni, const int *targets, int n, Vector *a);
+
+Universe* create_random_universe(int N);
+
+Universe* create_planetary_system(int N);
+
+void destroy_universe(Universe *uni);
+
 Vector center_of_gravity(const Universe *uni);
 
+// Plummer softening: every pair attracts as if at a distance of √(d² + ε²) instead
+// of d, which bounds the force of close encounters and keeps adaptive steps from
+// collapsing. ε = 0, the default, is plain Newtonian gravity. Used by the direct
+// kernels (acc, acc_pot, acc_jerk, acc_partial, acc_parallel, acc_vectorized) and by
+// gravitational_energy(); the tree, mesh, mixed and ensemble kernels ignore it.
+// Integrators that hold on to forces need integrator_invalidate() after a change.
+void set_softening(double epsilon);
+
+double get_softening(void);
+
 void acc(const Universe *uni, Vector *a);
 
+void acc_jerk(const Universe *uni, Vector *a, Vector *jerk);
+
+void acc_partial(const Universe *uni, const int *targets, int n, Vector *a);
+
+void acc_pot(const Universe *uni, Vector *a, double *pot);
+
 double kinetic_energy(const Universe *uni);
 
 double gravitational_energy(const Universe *uni);
 
 double total_energy(const Universe *uni);
 
+Vector momentum(const Universe *uni);
+
+double angular_momentum(const Universe *uni);
+
 #endif /* GRAVITY_H */
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "gravitylib.h"
+#include "integrate.h"
+#include "gravity.h"
+#include "backend.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Build the shared library with
+// gcc -O2 -march=native -shared -fPIC -o gravitylib.so gravitylib.c gravity.c vmath.c steppers.c integrate.c backend.c barneshut.c fmm.c mixed.c pm.c parallel.c soa.c stats.c threadpool.c -lm -pthread
+
+struct GravitySystem {
+    Universe uni;  // points into the caller's arrays
+    Integrator *ctx;
+    Method method;
+};
+
+// A Vector is two doubles without padding, so an (N, 2) array of doubles is an array of N Vectors.
+_Static_assert(sizeof(Vector) == 2 * sizeof(double), "Vector must be two packed doubles");
+
+int gravity_api_version(void) {
+    return GRAVITY_API_VERSION;
+}
+
+GravitySystem* gravity_create(int N, double *p, double *v, double *m, double t) {
+    GravitySystem *sys = calloc(1, sizeof(GravitySystem));
+    sys->uni = (Universe) { N, (Vector*)p, (Vector*)v, m, t };
+    sys->ctx = create_integrator(N);
+    sys->method = METHOD_RKN45;
+    return sys;
+}
+
+void gravity_destroy(GravitySystem *sys) {
+    destroy_integrator(sys->ctx);
+    free(sys);
+}
+
+void gravity_set_buffers(GravitySystem *sys, int N, double *p, double *v, double *m) {
+    sys->uni.N = N;
+    sys->uni.p = (Vector*)p;
+    sys->uni.v = (Vector*)v;
+    sys->uni.m = m;
+    integrator_resize(sys->ctx, N);
+}
+
+int gravity_set_method(GravitySystem *sys, const char *name) {
+    for (Method m = 0; m < METHOD_COUNT; ++m) {
+        if (!strcmp(name, method_name(m))) {
+            sys->method = m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int gravity_set_backend(GravitySystem *sys, const char *name) {
+    const ForceBackend *backend = find_force_backend(name);
+    if (!backend) {
+        return -1;
+    }
+    integrator_set_backend(sys->ctx, backend);
+    return 0;
+}
+
+int gravity_tune(const char *cache) {
+    return tune_force_backend(cache);
+}
+
+void gravity_set_tolerance(GravitySystem *sys, double tol) {
+    sys->ctx->tol = tol;
+}
+
+void gravity_set_step(GravitySystem *sys, double h) {
+    sys->ctx->h = h;
+}
+
+double gravity_time(const GravitySystem *sys) {
+    return sys->uni.t;
+}
+
+long gravity_step(GravitySystem *sys, long K) {
+    // The caller may have changed the arrays between calls.
+    integrator_invalidate(sys->ctx);
+    for (long k = 0; k < K; ++k) {
+        if (integrate_step(sys->ctx, &sys->uni, INFINITY, sys->method) == 0) {
+            return -1;
+        }
+    }
+    return K;
+}
+
+long gravity_advance_to(GravitySystem *sys, double t_end) {
+    integrator_invalidate(sys->ctx);
+    return integrate(sys->ctx, &sys->uni, t_end, sys->ctx->tol, sys->method);
+}
+
+void gravity_acc(GravitySystem *sys, double *a) {
+    sys->ctx->acc(&sys->uni, (Vector*)a);
+}
+
+void gravity_conserved(GravitySystem *sys, double *out) {
+    integrator_invalidate(sys->ctx);
+    Conserved c = integrator_conserved(sys->ctx, &sys->uni);
+    out[0] = c.energy;
+    out[1] = c.kinetic;
+    out[2] = c.potential;
+    out[3] = c.momentum.x;
+    out[4] = c.momentum.y;
+    out[5] = c.angular_momentum;
+}
+
+long gravity_accepted(const GravitySystem *sys) {
+    return sys->ctx->accepted;
+}
+
+long gravity_rejected(const GravitySystem *sys) {
+    return sys->ctx->rejected;
+}
+
+int gravity_stats(char *buffer, int size, int prometheus) {
+    FILE *f = fmemopen(buffer, size, "w");
+    if (NULL == f) {
+        return -1;
+    }
+    int error = stats_write(f, prometheus ? STATS_PROMETHEUS : STATS_JSON);
+    long length = ftell(f);
+    error |= fclose(f);
+    return error || length >= size ? -1 : (int)length;
+}
@@ -0,0 +1,74 @@
+#ifndef GRAVITYLIB_H
+#define GRAVITYLIB_H
+
+// The C API of gravitylib.so, for Python (ctypes) and other foreign callers. It only
+// uses ints, doubles, strings and pointers to double arrays, so no structs cross the
+// boundary. Positions and velocities are N (x, y) pairs of doubles, i.e. C-contiguous
+// NumPy arrays of shape (N, 2); masses are N doubles. The arrays stay owned by the
+// caller and are worked on in place: nothing is copied in or out.
+
+#define GRAVITY_API_VERSION 1
+
+typedef struct GravitySystem GravitySystem;
+
+int gravity_api_version(void);
+
+// Wrap the caller's arrays, starting at time t. The arrays must stay alive and in
+// place until gravity_destroy() or gravity_set_buffers().
+GravitySystem* gravity_create(int N, double *p, double *v, double *m, double t);
+
+void gravity_destroy(GravitySystem *sys);
+
+// Point at other arrays, e.g. after the caller resized them.
+void gravity_set_buffers(GravitySystem *sys, int N, double *p, double *v, double *m);
+
+// Select the stepper by name: "euler", "rk4", "rkn45", "rkn67", "rkn87", "rkn45_tableau",
+// "leapfrog", "yoshida4", "yoshida6", "forest_ruth" or "hermite". Defaults to "rkn45".
+// Returns 0, or -1 for an unknown name.
+int gravity_set_method(GravitySystem *sys, const char *name);
+
+// Select the force calculation by name: "direct", "parallel", "vectorized", "mixed",
+// "barnes_hut", "fmm", "pm", or "auto", the fastest exact one for this machine and N as
+// tuned by gravity_tune(). Defaults to "direct". Returns 0, or -1 for an unknown name.
+int gravity_set_backend(GravitySystem *sys, const char *name);
+
+// Tune "auto" for this machine, or load the tuning from the cache file, NULL for the
+// default one (see tune_force_backend() in backend.h). Systems created afterwards use
+// "auto" unless $GRAVITY_BACKEND names another backend. Returns 0 if it was loaded, 1 if
+// it was tuned, and -1 if the tuning could not be cached.
+int gravity_tune(const char *cache);
+
+// The tolerance of the adaptive steppers, 1e-9 by default.
+void gravity_set_tolerance(GravitySystem *sys, double tol);
+
+// The step size of the fixed step steppers, or the first step of the adaptive ones.
+void gravity_set_step(GravitySystem *sys, double h);
+
+double gravity_time(const GravitySystem *sys);
+
+// Take K steps. Every call starts from fresh forces, so the caller may change the
+// arrays between calls. Returns the number of steps taken, or -1 if the step size control failed.
+long gravity_step(GravitySystem *sys, long K);
+
+// Advance to t_end, landing on it exactly. Returns the number of steps taken, or -1
+// if the step size control failed.
+long gravity_advance_to(GravitySystem *sys, double t_end);
+
+// Write the accelerations at the current positions to a, which holds N (x, y) pairs.
+void gravity_acc(GravitySystem *sys, double *a);
+
+// Write the energy, the kinetic energy, the potential energy, the momentum (x, y)
+// and the angular momentum to out[0..5].
+void gravity_conserved(GravitySystem *sys, double *out);
+
+// The number of accepted and rejected steps so far.
+long gravity_accepted(const GravitySystem *sys);
+
+long gravity_rejected(const GravitySystem *sys);
+
+// Write the counters and timers of all systems (see stats.h) into buffer, which holds
+// size bytes: as JSON, or as Prometheus text if prometheus is set. Returns the length
+// of the text, or -1 if it did not fit.
+int gravity_stats(char *buffer, int size, int prometheus);
+
+#endif /* GRAVITYLIB_H */
@@ -0,0 +1,80 @@
+#include "integrate.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Force evaluations and energy error of the Hermite stepper at a range of η against
+// rkn45 and rkn67 at a range of tolerances, on a planetary system. A call to
+// acc_jerk() sums the same pairs as a call to acc() with a few more operations each.
+// The energy is measured with total_energy() once per day.
+// usage: hermite_report [N] [days]
+
+
+static long calls = 0;
+
+static void counting_acc(const Universe *uni, Vector *a) {
+    ++calls;
+    acc(uni, a);
+}
+
+static void counting_acc_jerk(const Universe *uni, Vector *a, Vector *jerk) {
+    ++calls;
+    acc_jerk(uni, a, jerk);
+}
+
+static void run(Method method, double setting, int N, double days) {
+    srand(1);
+    Universe *uni = create_planetary_system(N);
+    Integrator *ctx = create_integrator(N);
+    integrator_set_acc(ctx, counting_acc);
+    integrator_set_acc_jerk(ctx, counting_acc_jerk);
+    if (method == METHOD_HERMITE) {
+        ctx->eta = setting;
+    } else {
+        ctx->tol = setting;
+    }
+    calls = 0;
+
+    double e0 = total_energy(uni);
+    double worst = 0;
+    long steps = 0;
+    clock_t start = clock();
+    for (double day = 86400; day <= days * 86400; day += 86400) {
+        while (uni->t < day) {
+            if (integrate_step(ctx, uni, day, method) == 0) {
+                printf("%-10s %10.3g step size collapsed at day %.1f\n", method_name(method), setting, uni->t / 86400);
+                return;
+            }
+            steps++;
+        }
+        worst = max(worst, fabs((total_energy(uni) - e0) / e0));
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-10s %10.3g %10ld %12ld %10.2f %14.3E\n", method_name(method), setting, steps, calls, seconds, worst);
+    destroy_integrator(ctx);
+    destroy_universe(uni);
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 100;
+    double days = argc > 2 ? atof(argv[2]) : 365;
+
+    printf("N = %d, %.0f days\n\n", N, days);
+    printf("%-10s %10s %10s %12s %10s %14s\n", "method", "eta / tol", "steps", "acc calls", "seconds", "max |ΔE/E|");
+    static const double etas[] = { 0.04, 0.02, 0.01, 0.005, 0.0025 };
+    for (int k = 0; k < 5; ++k) {
+        run(METHOD_HERMITE, etas[k], N, days);
+    }
+    static const double tolerances[] = { 1e-6, 1e-8, 1e-10 };
+    for (int k = 0; k < 3; ++k) {
+        run(METHOD_RKN45, tolerances[k], N, days);
+    }
+    for (int k = 0; k < 3; ++k) {
+        run(METHOD_RKN67, tolerances[k], N, days);
+    }
+    return 0;
+}
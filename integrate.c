@@ -0,0 +1,229 @@
+#include "integrate.h"
+#include "steppers.h"
+#include "gravity.h"
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+
+// Limits on how much the step size may change from one step to the next.
+#define FACTOR_MIN 0.2
+#define FACTOR_MAX 5.0
+
+typedef double (*stepper_fn)(Integrator *ctx, Universe *uni, double h);
+
+static double euler(Integrator *ctx, Universe *uni, double h) {
+    step_euler(ctx, uni, h);
+    return 0;
+}
+
+static double rk4(Integrator *ctx, Universe *uni, double h) {
+    step_rk4(ctx, uni, h);
+    return 0;
+}
+
+static double leapfrog(Integrator *ctx, Universe *uni, double h) {
+    step_leapfrog(ctx, uni, h);
+    return 0;
+}
+
+static double yoshida4(Integrator *ctx, Universe *uni, double h) {
+    step_yoshida4(ctx, uni, h);
+    return 0;
+}
+
+static double yoshida6(Integrator *ctx, Universe *uni, double h) {
+    step_yoshida6(ctx, uni, h);
+    return 0;
+}
+
+static double forest_ruth(Integrator *ctx, Universe *uni, double h) {
+    step_forest_ruth(ctx, uni, h);
+    return 0;
+}
+
+// Hermite picks the size of its next step itself.
+static double hermite(Integrator *ctx, Universe *uni, double h) {
+    ctx->h = step_hermite(ctx, uni, h);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    stepper_fn step;
+    int order;  // the error estimate per unit of distance is O(hᵒʳᵈᵉʳ)
+} methods[METHOD_COUNT] = {
+    [METHOD_EULER]         = { "euler", euler, 0 },
+    [METHOD_RK4]           = { "rk4", rk4, 0 },
+    [METHOD_RKN45]         = { "rkn45", step_rkn45, 4 },
+    [METHOD_RKN67]         = { "rkn67", step_rkn67, 6 },
+    [METHOD_RKN45_TABLEAU] = { "rkn45_tableau", step_rkn45_tableau, 4 },
+    [METHOD_LEAPFROG]      = { "leapfrog", leapfrog, 0 },
+    [METHOD_YOSHIDA4]      = { "yoshida4", yoshida4, 0 },
+    [METHOD_YOSHIDA6]      = { "yoshida6", yoshida6, 0 },
+    [METHOD_FOREST_RUTH]   = { "forest_ruth", forest_ruth, 0 },
+    [METHOD_RKN87]         = { "rkn87", step_rkn87, 7 },
+    [METHOD_HERMITE]       = { "hermite", hermite, 0 },
+};
+
+const char* method_name(Method method) {
+    return methods[method].name;
+}
+
+int method_order(Method method) {
+    return methods[method].order;
+}
+
+// A first guess for the step size: a small fraction of the time it takes
+// to cross the system, or to fall through it.
+static double initial_step(Integrator *ctx, const Universe *uni, int order) {
+    Vector *a = ctx->mem;
+    ctx->acc(uni, a);
+
+    Vector c = { 0, 0 };
+    for (int i = 0; i < uni->N; ++i) {
+        c.x += uni->p[i].x / uni->N;
+        c.y += uni->p[i].y / uni->N;
+    }
+
+    double size = 0, speed = 0, accel = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        size += (uni->p[i].x - c.x) * (uni->p[i].x - c.x) + (uni->p[i].y - c.y) * (uni->p[i].y - c.y);
+        speed += uni->v[i].x * uni->v[i].x + uni->v[i].y * uni->v[i].y;
+        accel += a[i].x * a[i].x + a[i].y * a[i].y;
+    }
+    size = sqrt(size);
+    speed = sqrt(speed);
+    accel = sqrt(accel);
+
+    double h = INFINITY;
+    if (speed > 0) {
+        h = min(h, size / speed);
+    }
+    if (accel > 0) {
+        h = min(h, sqrt(size / accel));
+    }
+    if (!isfinite(h) || h == 0) {
+        h = 1;
+    }
+    return h * (order > 0 ? pow(ctx->tol, 1.0 / order) : 0.01);
+}
+
+// Set the time to t_end after a step that was shortened to end there, which may differ
+// from t + h in the last bit. The accelerations and potentials kept from the end of
+// the step move along.
+static void land(Integrator *ctx, Universe *uni, double t_end) {
+    if (ctx->fsal_t == uni->t) {
+        ctx->fsal_t = t_end;
+    }
+    if (ctx->pot_t == uni->t) {
+        ctx->pot_t = t_end;
+    }
+    if (ctx->hermite_t == uni->t) {
+        ctx->hermite_t = t_end;
+    }
+    uni->t = t_end;
+}
+
+double integrate_step(Integrator *ctx, Universe *uni, double t_end, Method method) {
+    STATS_STEP();
+    if (uni->N != ctx->N) {
+        integrator_resize(ctx, uni->N);
+    }
+    if (!(t_end > uni->t)) {
+        return 0;
+    }
+
+    int order = methods[method].order;
+    if (method == METHOD_HERMITE && !(ctx->hermite_valid && ctx->hermite_t == uni->t)) {
+        ctx->h = hermite_initial_step(ctx, uni);
+    }
+    if (ctx->h <= 0) {
+        ctx->h = initial_step(ctx, uni, order);
+    }
+    double h = min(ctx->h, ctx->h_max);
+
+    if (0 == order) {
+        int clipped = h >= t_end - uni->t;
+        if (clipped) {
+            h = t_end - uni->t;
+        }
+        methods[method].step(ctx, uni, h);
+        if (clipped) {
+            land(ctx, uni, t_end);
+        }
+        ++ctx->accepted;
+        stats_accepted(h);
+        return h;
+    }
+
+    double t = uni->t;
+    Vector *p = ctx->saved;
+    Vector *v = ctx->saved + ctx->cap;
+    memcpy(p, uni->p, sizeof(Vector) * uni->N);
+    memcpy(v, uni->v, sizeof(Vector) * uni->N);
+
+    int retry = 0;
+    for (;;) {
+        double wanted = h;
+        int clipped = h >= t_end - t;
+        if (clipped) {
+            h = t_end - t;
+        }
+        // Only a step the controller asked for can be too small; the last one before
+        // t_end may be shorter than h_min.
+        if (wanted < ctx->h_min || t + h == t) {
+            return 0;
+        }
+
+        double err = methods[method].step(ctx, uni, h);
+
+        if (err <= 1) {
+            // PI controller: the integral part drives the error to 1, the
+            // proportional part damps oscillations of the step size.
+            double factor = FACTOR_MAX;
+            if (err > 0) {
+                double prev = ctx->err_prev > 0 ? ctx->err_prev : 1;
+                factor = ctx->safety * pow(err, -0.7 / order) * pow(prev, 0.4 / order);
+                factor = max(FACTOR_MIN, min(FACTOR_MAX, factor));
+            }
+            if (retry) {
+                factor = min(factor, 1.0);
+            }
+
+            ctx->err_prev = max(err, 1e-4);
+            // A step that was shortened to land on t_end says little about the next one.
+            ctx->h = clipped ? max(h * factor, wanted) : h * factor;
+            if (clipped) {
+                land(ctx, uni, t_end);
+            }
+            ++ctx->accepted;
+            stats_accepted(h);
+            return h;
+        }
+
+        memcpy(uni->p, p, sizeof(Vector) * uni->N);
+        memcpy(uni->v, v, sizeof(Vector) * uni->N);
+        uni->t = t;
+        ++ctx->rejected;
+        stats_rejected();
+        retry = 1;
+
+        // err is NaN if a stage landed two objects on top of each other.
+        double factor = isnan(err) ? FACTOR_MIN : ctx->safety * pow(err, -1.0 / order);
+        h *= max(FACTOR_MIN, factor);
+    }
+}
+
+long integrate(Integrator *ctx, Universe *uni, double t_end, double tol, Method method) {
+    ctx->tol = tol;
+
+    long steps = 0;
+    while (uni->t < t_end) {
+        if (integrate_step(ctx, uni, t_end, method) == 0) {
+            return -1;
+        }
+        ++steps;
+    }
+    return steps;
+}
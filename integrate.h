@@ -0,0 +1,38 @@
+#ifndef INTEGRATE_H
+#define INTEGRATE_H
+
+#include "steppers.h"
+
+typedef enum Method {
+    METHOD_EULER,
+    METHOD_RK4,
+    METHOD_RKN45,
+    METHOD_RKN67,
+    METHOD_RKN45_TABLEAU,
+    METHOD_LEAPFROG,
+    METHOD_YOSHIDA4,
+    METHOD_YOSHIDA6,
+    METHOD_FOREST_RUTH,
+    METHOD_RKN87,
+    METHOD_HERMITE,
+    METHOD_COUNT
+} Method;
+
+const char* method_name(Method method);
+
+// How the error estimate of an adaptive method scales with h, or 0 for a fixed step method.
+int method_order(Method method);
+
+// Take one step with the given method, never passing t_end. Adaptive methods pick
+// the step size with a PI controller on ctx->tol and retry rejected steps with a
+// smaller step. Fixed step methods take steps of ctx->h. hermite sets ctx->h itself
+// with Aarseth's criterion after every step, and with its starting criterion whenever
+// it kept no forces from a step that ended at uni->t. Returns the size of the
+// accepted step, or 0 if the step size dropped below ctx->h_min.
+double integrate_step(Integrator *ctx, Universe *uni, double t_end, Method method);
+
+// Advance the Universe from uni->t to t_end with a local error tolerance of tol.
+// Returns the number of accepted steps, or -1 if the step size dropped below ctx->h_min.
+long integrate(Integrator *ctx, Universe *uni, double t_end, double tol, Method method);
+
+#endif /* INTEGRATE_H */
@@ -1,8 +1,16 @@
+#include "backend.h"
+#include "collide.h"
 #include "gravity.h"
 #include "graphics.h"
-#include "steppers.h"
+#include "integrate.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "triple.h"
 #include <SDL2/SDL.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <math.h>
 #include <time.h>
 
 
@@ -37,6 +45,83 @@ Universe create_earth_moon(int N) {
 }
 
 
+// State shared by the simulation thread and the renderer.
+typedef struct Simulation {
+    Universe *uni;
+    Integrator *ctx;
+    TripleBuffer *frames;
+    atomic_int quit;
+    double energy_error;  // the last one measured
+    double measured;      // when, in wall time
+} Simulation;
+
+// The simulation thread publishes a frame at most this often, in seconds of wall time.
+#define PUBLISH_INTERVAL 1e-3
+
+// Without a backend that hands out the potentials with the last force evaluation of
+// a step, the energy costs O(N²) and is only measured this often.
+#define ENERGY_INTERVAL 0.1
+
+// Objects interact as if at least SOFTENING apart, and merge when closer than
+// COLLISION_RADIUS, both in meters. Close encounters of the random objects would
+// otherwise drive the step size towards zero.
+#define SOFTENING 1e+6
+#define COLLISION_RADIUS 1e+7
+
+// With more objects than this the circles merge anyway; a heat map of the mass per pixel shows more.
+#define DENSITY_ABOVE 10000
+
+static double wall_time(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// With always set, the energy is measured however much it costs.
+static void publish(Simulation *sim, double energy, int always) {
+    Frame *f = triple_back(sim->frames);
+    triple_store(sim->frames, sim->uni);
+    f->steps = sim->ctx->accepted;
+    // With ctx->monitor the last step ended on a force evaluation with the potentials,
+    // so this costs O(N).
+    double now = wall_time();
+    if (always || sim->ctx->monitor || now - sim->measured >= ENERGY_INTERVAL) {
+        sim->energy_error = (integrator_conserved(sim->ctx, sim->uni).energy - energy) / energy;
+        sim->measured = now;
+        stats_energy(sim->energy_error);
+    }
+    f->energy_error = sim->energy_error;
+    triple_publish(sim->frames);
+}
+
+// Step as fast as possible, independent of the frame rate, and hand the newest
+// positions to the renderer now and then. The clock is only read, and collisions
+// are only looked for, every 64 steps, which is often enough even for a handful of
+// objects; the softening keeps the steps in between from collapsing.
+static void* simulate(void *arg) {
+    Simulation *sim = arg;
+    double energy = integrator_conserved(sim->ctx, sim->uni).energy;
+    publish(sim, energy, 1);
+    double last = wall_time();
+
+    for (long k = 1; !atomic_load_explicit(&sim->quit, memory_order_relaxed); ++k) {
+        if (integrate_step(sim->ctx, sim->uni, INFINITY, METHOD_RKN45) == 0) {
+            // The step size control gave up; the renderer keeps showing the last frame.
+            break;
+        }
+        if ((k & 63) == 0 && merge_collisions(sim->uni, COLLISION_RADIUS) > 0) {
+            // Merging is inelastic; the error is measured from here on.
+            energy = integrator_conserved(sim->ctx, sim->uni).energy;
+        }
+        if ((k & 63) == 0 && wall_time() - last >= PUBLISH_INTERVAL) {
+            publish(sim, energy, 0);
+            last = wall_time();
+        }
+    }
+    publish(sim, energy, 1);
+    return NULL;
+}
+
 int main2() {
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
@@ -48,24 +133,49 @@ int main2() {
 
     const int N = 3;
 
+    // The fastest force calculation for this machine, probed on the first run only.
+    if (tune_force_backend(NULL) > 0) {
+        printf("Tuned the force calculation for this machine\n");
+    }
+    printf("Forces: %s (%s for N = %d), %s, %d threads\n", force_backend()->name,
+        tuned_force_backend(N)->name, N, cpu_isa(), get_num_threads());
+
     Universe uni = create_random_universe2(N);
     // Universe uni = create_earth_moon(N);
+    Integrator *ctx = create_integrator(N);
+    ctx->tol = 1e-10;
+    // Monitoring needs a backend that computes the potentials along with the forces,
+    // which "auto" does not.
+    ctx->monitor = ctx->acc_pot != NULL;
+    set_softening(SOFTENING);
+
+    // With GRAVITY_STATS set to a path, the counters of stats.h are written there every second.
+    if (getenv("GRAVITY_STATS")) {
+        stats_start_dump(getenv("GRAVITY_STATS"), 1, STATS_PROMETHEUS);
+    }
+
+    Simulation sim = { .uni = &uni, .ctx = ctx, .frames = create_triple_buffer(N) };
+    pthread_t simulation;
+    if (NULL == sim.frames || pthread_create(&simulation, NULL, simulate, &sim) != 0) {
+        printf("Error starting the simulation\n");
+        SDL_Quit();
+        return -1;
+    }
 
-    SDL_Point coords[N];
-    int radii[N];
+    SDL_Point *coords = calloc(N, sizeof(SDL_Point));
+    int *radii = calloc(N, sizeof(int));
+    Projection proj;
+    int projected = 0;  // the number of objects proj and radii are for
 
-    // main event handling loop
+    // main event handling loop, paced by vsync
     SDL_Event e;
     bool quit = false;
     double smoothing = 0.9;
-    int fps = 0;
-    // double days = 0;
-    double energy = kinetic_energy(&uni) + gravitational_energy(&uni);
-    double h = 20.0;
-    clock_t FRAME_CLOCKS = CLOCKS_PER_SEC / 120;
+    double fps = 0;
+    double days_per_second = 0;
+    double last = wall_time();
+    double last_t = 0;
     while (!quit) {
-        clock_t start = clock();
-
         // get all current events
         // it does not block
         while (SDL_PollEvent(&e)) {
@@ -74,41 +184,52 @@ int main2() {
             }
         }
 
+        // The newest frame the simulation published; it stays ours until the next call.
+        const Frame *frame = triple_front(sim.frames);
+        Universe view = { frame->N, frame->p, NULL, frame->m, frame->t };
+
         // set white background
         SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
         SDL_RenderClear(renderer);
 
-        scale_to_screen(&uni, 2e+9, 2e+9, 30, coords, radii);
-
-        SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-        for (int i = 0; i < uni.N; ++i) {
-            render_circle(renderer, coords[i], radii[i]);
+        // The masses only change when objects merge, and so do the radii.
+        if (view.N != projected && view.N > 0) {
+            proj = screen_projection(&view, 2e+9, 2e+9, 30);
+            project(&proj, &view, coords, radii);
+            projected = view.N;
+        } else if (projected) {
+            project(&proj, &view, coords, NULL);
         }
-        
-        double rts = 0;  // real-time seconds
-        int i = 0;
-        while ((clock() - start < FRAME_CLOCKS) && (i < 5000)) {
-            rts += h;
-            // step_rk4(&uni, h);
-            h = step_rkn45(&uni, h);
-            // h = step_rkn67(&uni, h);
-            // step_euler(&uni, h);
-            ++i;
+
+        if (view.N > DENSITY_ABOVE) {
+            render_density(renderer, coords, view.m, view.N);
+        } else {
+            render_circles(renderer, coords, radii, view.N, (SDL_Color) { 0, 0, 255, 255 });
         }
 
         // render to the screen
         SDL_RenderPresent(renderer);
 
-        clock_t end = clock();
-        double frame_time = (double)(end - start) / CLOCKS_PER_SEC;
-        double error = (kinetic_energy(&uni) + gravitational_energy(&uni) - energy) / energy;
-        fps = (int)(fps * smoothing + (1 - smoothing) / frame_time);
-        rts = 120 * rts / 86400;
-        printf("error: %E parts\t\r", error);
+        double now = wall_time();
+        double frame_time = now - last;
+        fps = fps * smoothing + (1 - smoothing) / frame_time;
+        days_per_second = days_per_second * smoothing + (1 - smoothing) * (frame->t - last_t) / 86400 / frame_time;
+        last = now;
+        last_t = frame->t;
+        printf("error: %E parts, %.0f fps, %.1f days/s, %ld steps\t\r",
+            frame->energy_error, fps, days_per_second, frame->steps);
     }
     printf("\n");
 
+    atomic_store(&sim.quit, 1);
+    pthread_join(simulation, NULL);
+
     // destroy_universe(uni);
+    stats_stop_dump();
+    free(coords);
+    free(radii);
+    destroy_triple_buffer(sim.frames);
+    destroy_integrator(ctx);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
@@ -0,0 +1,408 @@
+#include "mixed.h"
+#include "gravity.h"
+#include "threadpool.h"
+#include "stats.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The objects are sorted along a Morton curve and cut into tiles of TILE objects, which
+// keeps every tile compact. Threads take tiles of targets; for every tile, all positions
+// are converted once to float offsets from the tile centre (O(N) against O(TILE ⋅ N) pair
+// terms), and the kernel sums over all sources for every target of the tile. Like the
+// acc_soa() kernels this computes the full N² sum, so every target is independent.
+
+#define TILE 16
+#define WIDTH 16  // floats per 512-bit register
+#define PAD 64    // the arrays are padded to a multiple of 4 registers
+#define ALIGN 64
+
+static Accumulation accumulation = ACCUMULATE_DOUBLE;
+
+void set_mixed_accumulation(Accumulation mode) {
+    accumulation = mode;
+}
+
+// The state of the current call, in Morton order.
+static int N = 0;
+static int cap = 0;           // N padded to a multiple of PAD
+static int allocated = 0;
+static int *original = NULL;  // original index of every sorted object
+static double *sx = NULL;     // positions in units of scale
+static double *sy = NULL;
+static float *fm = NULL;      // masses in units of mass_scale; padding has none
+static Vector *sorted_acc = NULL;
+static double scale;
+static double mass_scale;
+
+// Per thread: the float offsets of all objects from the centre of the current tile.
+static float **offset_x = NULL;
+static float **offset_y = NULL;
+static int offset_threads = 0;
+static int offset_cap = 0;
+
+static void* alloc_aligned(size_t size) {
+    void *p = aligned_alloc(ALIGN, (max(size, (size_t)1) + ALIGN - 1) / ALIGN * ALIGN);
+    memset(p, 0, size);
+    return p;
+}
+
+static void reserve(int n, int threads) {
+    int c = (n + PAD - 1) / PAD * PAD;
+    if (c > allocated) {
+        free(original);
+        free(sx);
+        free(sy);
+        free(fm);
+        free(sorted_acc);
+        original = alloc_aligned(c * sizeof(int));
+        sx = alloc_aligned(c * sizeof(double));
+        sy = alloc_aligned(c * sizeof(double));
+        fm = alloc_aligned(c * sizeof(float));
+        sorted_acc = alloc_aligned(c * sizeof(Vector));
+        allocated = c;
+    }
+    if (c > offset_cap || threads > offset_threads) {
+        for (int t = 0; t < offset_threads; ++t) {
+            free(offset_x[t]);
+            free(offset_y[t]);
+        }
+        free(offset_x);
+        free(offset_y);
+        offset_threads = max(threads, offset_threads);
+        offset_cap = max(c, offset_cap);
+        offset_x = calloc(offset_threads, sizeof(float*));
+        offset_y = calloc(offset_threads, sizeof(float*));
+        for (int t = 0; t < offset_threads; ++t) {
+            offset_x[t] = alloc_aligned(offset_cap * sizeof(float));
+            offset_y[t] = alloc_aligned(offset_cap * sizeof(float));
+        }
+    }
+    cap = c;
+}
+
+// Interleave the bits of two 16-bit numbers.
+static uint32_t morton(uint32_t ix, uint32_t iy) {
+    uint32_t k = 0;
+    for (int b = 0; b < 16; ++b) {
+        k |= ((ix >> b) & 1) << (2*b) | ((iy >> b) & 1) << (2*b + 1);
+    }
+    return k;
+}
+
+typedef struct Key {
+    uint32_t code;
+    int index;
+} Key;
+
+static int compare_keys(const void *a, const void *b) {
+    uint32_t ka = ((const Key*)a)->code;
+    uint32_t kb = ((const Key*)b)->code;
+    return (ka > kb) - (ka < kb);
+}
+
+static void sort_objects(const Universe *uni) {
+    double left = INFINITY, right = -INFINITY, bottom = INFINITY, top = -INFINITY;
+    double heaviest = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        left = min(left, uni->p[i].x);
+        right = max(right, uni->p[i].x);
+        bottom = min(bottom, uni->p[i].y);
+        top = max(top, uni->p[i].y);
+        heaviest = max(heaviest, fabs(uni->m[i]));
+    }
+    scale = max(max(right - left, top - bottom), 1e-300);
+    mass_scale = heaviest > 0 ? heaviest : 1;
+
+    Key *keys = malloc(max(uni->N, 1) * sizeof(Key));
+    for (int i = 0; i < uni->N; ++i) {
+        uint32_t ix = (uint32_t)((uni->p[i].x - left) / scale * 65535);
+        uint32_t iy = (uint32_t)((uni->p[i].y - bottom) / scale * 65535);
+        keys[i] = (Key) { morton(ix, iy), i };
+    }
+    qsort(keys, uni->N, sizeof(Key), compare_keys);
+
+    for (int k = 0; k < uni->N; ++k) {
+        int i = keys[k].index;
+        original[k] = i;
+        sx[k] = uni->p[i].x / scale;
+        sy[k] = uni->p[i].y / scale;
+        fm[k] = (float)(uni->m[i] / mass_scale);
+    }
+    // Massless padding at the position of the last object; r² = 0 masks it out.
+    for (int k = uni->N; k < cap; ++k) {
+        sx[k] = uni->N ? sx[uni->N - 1] : 0;
+        sy[k] = uni->N ? sy[uni->N - 1] : 0;
+        fm[k] = 0;
+    }
+    free(keys);
+}
+
+// The kernels sum the accelerations of the targets [i0, i1) from all sources, in units
+// of G ⋅ mass_scale / scale², from float offsets ox, oy. Pairs with d = 0 (the target
+// itself and the padding) are masked out.
+
+static void tile_scalar(const float *ox, const float *oy, int i0, int i1, int n) {
+    for (int i = i0; i < i1; ++i) {
+        double ax = 0, ay = 0;
+        float kx = 0, ky = 0, cx = 0, cy = 0;
+        for (int j = 0; j < n; ++j) {
+            float dx = ox[j] - ox[i];
+            float dy = oy[j] - oy[i];
+            float r2 = dx*dx + dy*dy;
+            if (r2 == 0) {
+                continue;
+            }
+            float d3 = 1.0f / sqrtf(r2);
+            d3 = d3 * d3 * d3;
+            float tx = d3 * fm[j] * dx;
+            float ty = d3 * fm[j] * dy;
+
+            if (accumulation == ACCUMULATE_DOUBLE) {
+                ax += tx;
+                ay += ty;
+            } else {
+                float y = tx - cx;
+                float t = kx + y;
+                cx = (t - kx) - y;
+                kx = t;
+                y = ty - cy;
+                t = ky + y;
+                cy = (t - ky) - y;
+                ky = t;
+            }
+        }
+        sorted_acc[i] = accumulation == ACCUMULATE_DOUBLE
+            ? (Vector) { ax, ay } : (Vector) { (double)kx - cx, (double)ky - cy };
+    }
+}
+
+// The pair terms w ⋅ dx and w ⋅ dy of the sources [j, j + 8) on the target at (xi, yi).
+__attribute__((target("avx2,fma"), always_inline))
+static inline void pairs_avx2(const float *ox, const float *oy, int j, __m256 xi, __m256 yi,
+                              __m256 *tx, __m256 *ty) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+
+    __m256 dx = _mm256_sub_ps(_mm256_load_ps(ox + j), xi);
+    __m256 dy = _mm256_sub_ps(_mm256_load_ps(oy + j), yi);
+    __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+    // 12-bit estimate, refined once with Newton's method: d ← d ⋅ (3 − r² ⋅ d²) / 2.
+    __m256 d1 = _mm256_rsqrt_ps(r2);
+    d1 = _mm256_mul_ps(_mm256_mul_ps(half, d1), _mm256_fnmadd_ps(_mm256_mul_ps(r2, d1), d1, three));
+    __m256 d3 = _mm256_mul_ps(_mm256_mul_ps(d1, d1), d1);
+    __m256 w = _mm256_mul_ps(d3, _mm256_load_ps(fm + j));
+    w = _mm256_and_ps(w, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+    *tx = _mm256_mul_ps(w, dx);
+    *ty = _mm256_mul_ps(w, dy);
+}
+
+__attribute__((target("avx2,fma")))
+static __m256d sum_halves(__m256 v) {
+    return _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+}
+
+__attribute__((target("avx2,fma")))
+static void tile_avx2(const float *ox, const float *oy, int i0, int i1, int n) {
+    for (int i = i0; i < i1; ++i) {
+        __m256 xi = _mm256_set1_ps(ox[i]);
+        __m256 yi = _mm256_set1_ps(oy[i]);
+        __m256d ax = _mm256_setzero_pd();
+        __m256d ay = _mm256_setzero_pd();
+        __m256 tx, ty;
+
+        if (accumulation == ACCUMULATE_DOUBLE) {
+            // Four vectors of terms are added in float before the conversion.
+            for (int j = 0; j < n; j += 32) {
+                __m256 tx1, ty1, tx2, ty2, tx3, ty3;
+                pairs_avx2(ox, oy, j, xi, yi, &tx, &ty);
+                pairs_avx2(ox, oy, j + 8, xi, yi, &tx1, &ty1);
+                pairs_avx2(ox, oy, j + 16, xi, yi, &tx2, &ty2);
+                pairs_avx2(ox, oy, j + 24, xi, yi, &tx3, &ty3);
+                tx = _mm256_add_ps(_mm256_add_ps(tx, tx1), _mm256_add_ps(tx2, tx3));
+                ty = _mm256_add_ps(_mm256_add_ps(ty, ty1), _mm256_add_ps(ty2, ty3));
+                ax = _mm256_add_pd(ax, sum_halves(tx));
+                ay = _mm256_add_pd(ay, sum_halves(ty));
+            }
+        } else {
+            __m256 kx = _mm256_setzero_ps(), ky = _mm256_setzero_ps();
+            __m256 cx = _mm256_setzero_ps(), cy = _mm256_setzero_ps();
+            for (int j = 0; j < n; j += 8) {
+                pairs_avx2(ox, oy, j, xi, yi, &tx, &ty);
+                __m256 y = _mm256_sub_ps(tx, cx);
+                __m256 t = _mm256_add_ps(kx, y);
+                cx = _mm256_sub_ps(_mm256_sub_ps(t, kx), y);
+                kx = t;
+                y = _mm256_sub_ps(ty, cy);
+                t = _mm256_add_ps(ky, y);
+                cy = _mm256_sub_ps(_mm256_sub_ps(t, ky), y);
+                ky = t;
+            }
+            ax = _mm256_sub_pd(sum_halves(kx), sum_halves(cx));
+            ay = _mm256_sub_pd(sum_halves(ky), sum_halves(cy));
+        }
+
+        double bx[4], by[4];
+        _mm256_storeu_pd(bx, ax);
+        _mm256_storeu_pd(by, ay);
+        sorted_acc[i] = (Vector) { (bx[0] + bx[1]) + (bx[2] + bx[3]), (by[0] + by[1]) + (by[2] + by[3]) };
+    }
+}
+
+// The pair terms of the sources [j, j + 16) on the target at (xi, yi).
+__attribute__((target("avx512f"), always_inline))
+static inline void pairs_avx512(const float *ox, const float *oy, int j, __m512 xi, __m512 yi,
+                                __m512 *tx, __m512 *ty) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+
+    __m512 dx = _mm512_sub_ps(_mm512_load_ps(ox + j), xi);
+    __m512 dy = _mm512_sub_ps(_mm512_load_ps(oy + j), yi);
+    __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+    __mmask16 nonzero = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+    // 14-bit estimate, refined once with Newton's method to full float precision.
+    __m512 d1 = _mm512_rsqrt14_ps(r2);
+    d1 = _mm512_mul_ps(_mm512_mul_ps(half, d1), _mm512_fnmadd_ps(_mm512_mul_ps(r2, d1), d1, three));
+    __m512 d3 = _mm512_mul_ps(_mm512_mul_ps(d1, d1), d1);
+    __m512 w = _mm512_maskz_mul_ps(nonzero, d3, _mm512_load_ps(fm + j));
+    *tx = _mm512_mul_ps(w, dx);
+    *ty = _mm512_mul_ps(w, dy);
+}
+
+// The 16 floats of v, summed pairwise into 8 doubles.
+__attribute__((target("avx512f")))
+static __m512d sum_halves512(__m512 v) {
+    __m512d low = _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+    __m512d high = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+    return _mm512_add_pd(low, high);
+}
+
+__attribute__((target("avx512f")))
+static void tile_avx512(const float *ox, const float *oy, int i0, int i1, int n) {
+    for (int i = i0; i < i1; ++i) {
+        __m512 xi = _mm512_set1_ps(ox[i]);
+        __m512 yi = _mm512_set1_ps(oy[i]);
+        __m512d ax = _mm512_setzero_pd();
+        __m512d ay = _mm512_setzero_pd();
+        __m512 tx, ty;
+
+        if (accumulation == ACCUMULATE_DOUBLE) {
+            // Four vectors of terms are added in float before the conversion, which
+            // would otherwise cost a third of the loop.
+            for (int j = 0; j < n; j += 4 * WIDTH) {
+                __m512 tx1, ty1, tx2, ty2, tx3, ty3;
+                pairs_avx512(ox, oy, j, xi, yi, &tx, &ty);
+                pairs_avx512(ox, oy, j + WIDTH, xi, yi, &tx1, &ty1);
+                pairs_avx512(ox, oy, j + 2*WIDTH, xi, yi, &tx2, &ty2);
+                pairs_avx512(ox, oy, j + 3*WIDTH, xi, yi, &tx3, &ty3);
+                tx = _mm512_add_ps(_mm512_add_ps(tx, tx1), _mm512_add_ps(tx2, tx3));
+                ty = _mm512_add_ps(_mm512_add_ps(ty, ty1), _mm512_add_ps(ty2, ty3));
+                ax = _mm512_add_pd(ax, sum_halves512(tx));
+                ay = _mm512_add_pd(ay, sum_halves512(ty));
+            }
+        } else {
+            // Two independent compensated sums, so the additions of one hide the
+            // latency of the other.
+            __m512 kx[2], ky[2], cx[2], cy[2];
+            for (int u = 0; u < 2; ++u) {
+                kx[u] = ky[u] = cx[u] = cy[u] = _mm512_setzero_ps();
+            }
+            for (int j = 0; j < n; j += WIDTH) {
+                int u = (j / WIDTH) & 1;
+                pairs_avx512(ox, oy, j, xi, yi, &tx, &ty);
+                __m512 y = _mm512_sub_ps(tx, cx[u]);
+                __m512 t = _mm512_add_ps(kx[u], y);
+                cx[u] = _mm512_sub_ps(_mm512_sub_ps(t, kx[u]), y);
+                kx[u] = t;
+                y = _mm512_sub_ps(ty, cy[u]);
+                t = _mm512_add_ps(ky[u], y);
+                cy[u] = _mm512_sub_ps(_mm512_sub_ps(t, ky[u]), y);
+                ky[u] = t;
+            }
+            for (int u = 0; u < 2; ++u) {
+                ax = _mm512_add_pd(ax, _mm512_sub_pd(sum_halves512(kx[u]), sum_halves512(cx[u])));
+                ay = _mm512_add_pd(ay, _mm512_sub_pd(sum_halves512(ky[u]), sum_halves512(cy[u])));
+            }
+        }
+
+        sorted_acc[i] = (Vector) { _mm512_reduce_add_pd(ax), _mm512_reduce_add_pd(ay) };
+    }
+}
+
+typedef void (*tile_fn)(const float *ox, const float *oy, int i0, int i1, int n);
+
+static tile_fn kernel = NULL;
+static const char *kernel_name = NULL;
+
+static void select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel = tile_avx512;
+        kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        kernel = tile_avx2;
+        kernel_name = "avx2";
+    } else {
+        kernel = tile_scalar;
+        kernel_name = "scalar";
+    }
+}
+
+const char* acc_mixed_path(void) {
+    if (NULL == kernel) {
+        select_kernel();
+    }
+    return kernel_name;
+}
+
+// Every thread takes every nthreads-th tile; all tiles cost the same.
+static void run_tiles(void *arg, int tid, int nthreads) {
+    (void)arg;
+    float *ox = offset_x[tid];
+    float *oy = offset_y[tid];
+    int tiles = (N + TILE - 1) / TILE;
+
+    for (int k = tid; k < tiles; k += nthreads) {
+        int i0 = k * TILE;
+        int i1 = min(i0 + TILE, N);
+
+        // The offsets are taken from the centre of the tile, and rounded to float only
+        // once, after the subtraction in double.
+        double cx = 0, cy = 0;
+        for (int i = i0; i < i1; ++i) {
+            cx += sx[i];
+            cy += sy[i];
+        }
+        cx /= i1 - i0;
+        cy /= i1 - i0;
+        for (int j = 0; j < cap; ++j) {
+            ox[j] = (float)(sx[j] - cx);
+            oy[j] = (float)(sy[j] - cy);
+        }
+
+        kernel(ox, oy, i0, i1, cap);
+    }
+}
+
+void acc_mixed(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_MIXED, (long)uni->N * (uni->N - 1) / 2);
+    if (NULL == kernel) {
+        select_kernel();
+    }
+    int threads = get_num_threads();
+    reserve(uni->N, threads);
+    N = uni->N;
+    sort_objects(uni);
+
+    parallel_run(run_tiles, NULL);
+
+    double unit = G * mass_scale / (scale * scale);
+    for (int k = 0; k < N; ++k) {
+        a[original[k]] = (Vector) { unit * sorted_acc[k].x, unit * sorted_acc[k].y };
+    }
+}
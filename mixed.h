@@ -0,0 +1,37 @@
+#ifndef MIXED_H
+#define MIXED_H
+
+#include "gravity.h"
+
+// Mixed-precision direct summation: every pair term is computed in float, which
+// doubles the SIMD width and halves the memory traffic of the kernel, and the sums
+// stay accurate. To avoid cancellation at the ±1e9 m coordinates of typical
+// universes, the objects are sorted into compact tiles, and the float positions are
+// offsets from the centre of the tile of the object whose acceleration is summed.
+// Positions and masses are scaled to O(1), so neither d³ nor m / d³ leaves the
+// range of float.
+//
+// The rounding error of one pair term is about 1e-7 ⋅ (1 + R / d), with R the tile
+// radius and d the distance of the pair. mixed_report measures the force error and
+// the energy drift against acc(): on a random universe of 2000 objects the rms force
+// error is 2.4e-6, and a planetary system of 500 objects integrated for 100 days
+// with rkn45 at tol 1e-9 drifts by |ΔE/E| = 9e-9 (Kahan: 4e-9), against 8e-10 with
+// acc(). That suits large approximate runs, not long accurate ones.
+
+// How the float pair terms are summed.
+typedef enum Accumulation {
+    ACCUMULATE_DOUBLE,  // terms added in double, after adding groups of 4 in float
+    ACCUMULATE_KAHAN,   // compensated (Kahan) summation in float
+} Accumulation;
+
+// Defaults to ACCUMULATE_DOUBLE.
+void set_mixed_accumulation(Accumulation mode);
+
+// The name of the kernel acc_mixed() dispatches to: "avx512", "avx2" or "scalar".
+const char* acc_mixed_path(void);
+
+// Same contract as acc(), with float pair terms, on all threads of the pool.
+// ### aᵢ = ∑ⱼ mⱼ ⋅ (pⱼ − pᵢ) / d(pⱼ, pᵢ)³
+void acc_mixed(const Universe *uni, Vector *a);
+
+#endif /* MIXED_H */
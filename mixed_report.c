@@ -0,0 +1,106 @@
+#include "mixed.h"
+#include "integrate.h"
+#include "gravity.h"
+#include "soa.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Accuracy and speed of the mixed-precision kernel against the double kernels.
+//
+// forces: the rms force error against acc() on a random universe at the ±1e9 m
+//         scale of create_random_universe(), and the time per call
+// drift:  the energy error after integrating a planetary system with rkn45 at
+//         tol 1e-9, where the force errors of float pair terms show up as drift
+//
+// usage: mixed_report [N] [days]
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double rms_error(const Vector *approx, const Vector *exact, int N) {
+    double sq_err = 0;
+    double sq_norm = 0;
+    for (int i = 0; i < N; ++i) {
+        double dx = approx[i].x - exact[i].x;
+        double dy = approx[i].y - exact[i].y;
+        sq_err += dx*dx + dy*dy;
+        sq_norm += exact[i].x * exact[i].x + exact[i].y * exact[i].y;
+    }
+    return sqrt(sq_err / sq_norm);
+}
+
+static void acc_mixed_double(const Universe *uni, Vector *a) {
+    set_mixed_accumulation(ACCUMULATE_DOUBLE);
+    acc_mixed(uni, a);
+}
+
+static void acc_mixed_kahan(const Universe *uni, Vector *a) {
+    set_mixed_accumulation(ACCUMULATE_KAHAN);
+    acc_mixed(uni, a);
+}
+
+static const struct {
+    const char *name;
+    acc_fn acc;
+} kernels[] = {
+    { "double", acc },
+    { "vectorized", acc_vectorized },
+    { "mixed", acc_mixed_double },
+    { "mixed_kahan", acc_mixed_kahan },
+};
+
+#define KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 2000;
+    double days = argc > 2 ? atof(argv[2]) : 100;
+
+    srand(1);
+    Universe *uni = create_random_universe(N);
+    Vector *exact = calloc(N, sizeof(Vector));
+    Vector *a = calloc(N, sizeof(Vector));
+    acc(uni, exact);
+
+    printf("forces, random universe of N = %d, simd %s\n", N, acc_mixed_path());
+    printf("%-12s %12s %12s\n", "kernel", "ms per call", "rms error");
+    for (int k = 0; k < KERNELS; ++k) {
+        kernels[k].acc(uni, a);
+        double best = INFINITY;
+        for (int r = 0; r < 5; ++r) {
+            double start = now();
+            kernels[k].acc(uni, a);
+            best = min(best, now() - start);
+        }
+        printf("%-12s %12.3f %12.3E\n", kernels[k].name, best * 1e+3, rms_error(a, exact, N));
+    }
+    destroy_universe(uni);
+
+    int n = min(N, 500);
+    printf("\nenergy drift, planetary system of N = %d, %.0f days, rkn45 at tol 1e-9\n", n, days);
+    printf("%-12s %10s %10s %14s\n", "kernel", "seconds", "steps", "|dE/E|");
+    for (int k = 0; k < KERNELS; ++k) {
+        srand(1);
+        Universe *sys = create_planetary_system(n);
+        Integrator *ctx = create_integrator(n);
+        integrator_set_acc(ctx, kernels[k].acc);
+        double e0 = total_energy(sys);
+        double start = now();
+        long steps = integrate(ctx, sys, days * 86400, 1e-9, METHOD_RKN45);
+        double seconds = now() - start;
+        printf("%-12s %10.2f %10ld %14.3E\n", kernels[k].name, seconds, steps,
+            fabs((total_energy(sys) - e0) / e0));
+        destroy_integrator(ctx);
+        destroy_universe(sys);
+    }
+
+    free(a);
+    free(exact);
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "neighbour.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+
+static int neighbours = 32;
+static double eta = 0.02;
+
+// The state of the scheme, for a Universe of N objects with nb neighbours each.
+static int N = 0;
+static int nb = 0;
+static int valid = 0;
+static int *list;       // nb neighbours per object
+static Vector *regular; // the regular force at t0, without G
+static Vector *rate;    // and its time derivative
+static double *t0;
+static double *dt;      // how long the extrapolation from t0 stays accurate
+static double *d2;      // the squared distances of the neighbours, while choosing them
+static long *stamp;     // stamp[j] == refreshes while j is a neighbour of the object being refreshed
+static long refreshes = 0;
+static long pairs = 0;
+
+void set_neighbours(int n) {
+    neighbours = max(n, 1);
+    valid = 0;
+}
+
+int get_neighbours(void) {
+    return neighbours;
+}
+
+void set_neighbour_eta(double e) {
+    eta = e;
+    valid = 0;
+}
+
+double get_neighbour_eta(void) {
+    return eta;
+}
+
+void reset_neighbours(void) {
+    valid = 0;
+}
+
+long neighbour_pairs(void) {
+    return pairs;
+}
+
+static int resize(int n) {
+    free(list);
+    free(regular);
+    free(rate);
+    free(t0);
+    free(dt);
+    free(d2);
+    free(stamp);
+    N = n;
+    nb = max(min(neighbours, n - 1), 0);
+    list = malloc(sizeof(int) * (size_t)n * max(nb, 1));
+    regular = malloc(sizeof(Vector) * n);
+    rate = malloc(sizeof(Vector) * n);
+    t0 = malloc(sizeof(double) * n);
+    dt = malloc(sizeof(double) * n);
+    d2 = malloc(sizeof(double) * max(nb, 1));
+    stamp = calloc(n, sizeof(long));
+    if (!list || !regular || !rate || !t0 || !dt || !d2 || !stamp) {
+        N = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Choose the nb nearest objects to i, and sum the regular force of all others with
+// its time derivative, for a softened distance s:
+// ### Fᵢ = ∑ⱼ mⱼ ⋅ rᵢⱼ / s³
+// ### Ḟᵢ = ∑ⱼ mⱼ ⋅ (vᵢⱼ / s³ − 3 (rᵢⱼ ⋅ vᵢⱼ) ⋅ rᵢⱼ / s⁵)
+// ### Δtᵢ = η ⋅ minⱼ d(pⱼ, pᵢ) / d(vⱼ, vᵢ)
+static void refresh(const Universe *uni, int i, double eps2) {
+    int *own = list + (size_t)i * nb;
+    Vector pi = uni->p[i];
+    Vector vi = uni->v[i];
+
+    // Keep the nearest ones found so far sorted by distance, so most objects are
+    // rejected with one comparison.
+    int found = 0;
+    for (int j = 0; j < N; ++j) {
+        if (j == i) {
+            continue;
+        }
+        double dx = uni->p[j].x - pi.x;
+        double dy = uni->p[j].y - pi.y;
+        double r2 = dx*dx + dy*dy;
+        if (found == nb && (nb == 0 || r2 >= d2[nb - 1])) {
+            continue;
+        }
+        int k = found < nb ? found++ : nb - 1;
+        for (; k > 0 && d2[k - 1] > r2; --k) {
+            d2[k] = d2[k - 1];
+            own[k] = own[k - 1];
+        }
+        d2[k] = r2;
+        own[k] = j;
+    }
+    // A new stamp for every refresh, so that the neighbours of an earlier refresh of i
+    // are not mistaken for the current ones.
+    ++refreshes;
+    for (int k = 0; k < nb; ++k) {
+        stamp[own[k]] = refreshes;
+    }
+
+    Vector f = { 0, 0 };
+    Vector df = { 0, 0 };
+    double shortest = INFINITY;
+    for (int j = 0; j < N; ++j) {
+        if (j == i || stamp[j] == refreshes) {
+            continue;
+        }
+        double dx = uni->p[j].x - pi.x;
+        double dy = uni->p[j].y - pi.y;
+        double wx = uni->v[j].x - vi.x;
+        double wy = uni->v[j].y - vi.y;
+        double r2 = dx*dx + dy*dy;
+        double w2 = wx*wx + wy*wy;
+        double s1 = 1.0 / sqrt(r2 + eps2);
+        double s3 = s1 * s1 * s1;
+        double s5 = 3 * (dx*wx + dy*wy) * s3 * s1 * s1;
+
+        f.x += uni->m[j] * s3 * dx;
+        f.y += uni->m[j] * s3 * dy;
+        df.x += uni->m[j] * (s3 * wx - s5 * dx);
+        df.y += uni->m[j] * (s3 * wy - s5 * dy);
+        if (r2 < shortest * shortest * w2) {
+            shortest = sqrt(r2 / w2);
+        }
+    }
+    pairs += N - 1;
+
+    regular[i] = f;
+    rate[i] = df;
+    t0[i] = uni->t;
+    dt[i] = eta * shortest;
+}
+
+// Calculate the accelerations as the extrapolated regular force plus the irregular
+// force of the neighbours, refreshing the objects that are due.
+// ### aᵢ = G ⋅ (∑ⱼ∈nbᵢ mⱼ ⋅ rᵢⱼ / s³ + Fᵢ + Ḟᵢ ⋅ (t − t₀ᵢ))
+void acc_neighbour(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_NEIGHBOUR, (long)uni->N * max(min(neighbours, uni->N - 1), 0));
+    if ((uni->N != N || !valid) && resize(uni->N) < 0) {
+        acc(uni, a);
+        return;
+    }
+    double eps2 = get_softening() * get_softening();
+    double t = uni->t;
+
+    for (int i = 0; i < N; ++i) {
+        if (!valid || !(fabs(t - t0[i]) <= dt[i])) {
+            refresh(uni, i, eps2);
+        }
+
+        double elapsed = t - t0[i];
+        double ax = regular[i].x + rate[i].x * elapsed;
+        double ay = regular[i].y + rate[i].y * elapsed;
+        const int *own = list + (size_t)i * nb;
+        for (int k = 0; k < nb; ++k) {
+            int j = own[k];
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double d3 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
+            d3 = d3 * d3 * d3;
+
+            ax += d3 * uni->m[j] * dx;
+            ay += d3 * uni->m[j] * dy;
+        }
+        pairs += nb;
+
+        a[i].x = G * ax;
+        a[i].y = G * ay;
+    }
+    valid = 1;
+}
@@ -0,0 +1,43 @@
+#ifndef NEIGHBOUR_H
+#define NEIGHBOUR_H
+
+#include "gravity.h"
+
+// The Ahmad-Cohen neighbour scheme. The force on every object is split into the
+// irregular force of its nearest neighbours, summed on every call, and the regular
+// force of all others, which changes slowly. The regular force and its time
+// derivative are computed now and then, at the same time as the neighbour list,
+// and extrapolated linearly in time in between:
+// ### aᵢ(t) = ∑ⱼ∈nbᵢ aᵢⱼ(t) + Fᵢ(t₀) + Ḟᵢ(t₀) ⋅ (t − t₀)
+// The regular force of an object is recomputed, with a new neighbour list, once t
+// is more than eta times the shortest time any non-neighbour takes to cross its
+// own distance, r / |Δv|, away from t₀. A call costs N ⋅ n pairs for n neighbours,
+// plus N pairs for every object whose regular force is due.
+//
+// The time comes from uni->t, which the steppers set to the time of every stage,
+// and the velocities from uni->v, which the RKN steppers keep at the start of the
+// step, so Ḟ is accurate to O(h). Momentum is only conserved up to the error of the
+// extrapolation, since the neighbour lists are not symmetric.
+
+// The number of neighbours per object (default 32).
+void set_neighbours(int n);
+
+int get_neighbours(void);
+
+// The accuracy parameter of the regular force (default 0.02).
+void set_neighbour_eta(double eta);
+
+double get_neighbour_eta(void);
+
+// Recompute every regular force on the next call. Call this after changing masses,
+// or positions outside of a stepper, or when switching to another Universe with the
+// same number of objects.
+void reset_neighbours(void);
+
+// The pair terms computed so far, irregular and regular.
+long neighbour_pairs(void);
+
+// Same contract as acc(), including the softening.
+void acc_neighbour(const Universe *uni, Vector *a);
+
+#endif /* NEIGHBOUR_H */
@@ -0,0 +1,173 @@
+#include "neighbour.h"
+#include "integrate.h"
+#include "gravity.h"
+#include "vmath.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A star cluster with a dense core, integrated with rkn45 at the same tolerance with
+// acc() and with the Ahmad-Cohen neighbour scheme at a range of neighbour counts.
+// Pair terms are those summed by the force calculation; acc() uses the symmetry and
+// sums N (N − 1) / 2 per call. The energy error is the largest seen at 20 checks, and
+// the drift is the RMS distance of the positions from those of the run with acc(),
+// relative to the scale radius of the cluster. Before that, a check that the forces
+// equal those of acc() when every object gets a new neighbour list.
+// usage: neighbour_report [N] [crossing times] [tol] [eta]
+
+
+static const double RADIUS = 1e+15;
+static long calls = 0;
+
+static void counting_acc(const Universe *uni, Vector *a) {
+    ++calls;
+    acc(uni, a);
+}
+
+// Stars of a solar mass with a surface density falling like a 2D Plummer profile,
+// Σ ∝ (1 + r² / a²)^(−2), so half of them lie within a of the centre, and random
+// velocities scaled to virial equilibrium, 2 K = −W.
+static Universe* create_cluster(int N) {
+    srand(1);
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = N;
+    uni->p = calloc(N, sizeof(Vector));
+    uni->v = calloc(N, sizeof(Vector));
+    uni->m = calloc(N, sizeof(double));
+
+    for (int i = 0; i < N; ++i) {
+        double u = uniform(0, 0.99);
+        double r = RADIUS * sqrt(u / (1 - u));
+        double phi = uniform(0, 2 * M_PI);
+        uni->p[i] = (Vector) { r * cos(phi), r * sin(phi) };
+        uni->v[i] = (Vector) { uniform(-1, 1), uniform(-1, 1) };
+        uni->m[i] = 1.989e+30;
+    }
+    double scale = sqrt(-gravitational_energy(uni) / (2 * kinetic_energy(uni)));
+    for (int i = 0; i < N; ++i) {
+        uni->v[i].x *= scale;
+        uni->v[i].y *= scale;
+    }
+    return uni;
+}
+
+// Run for the given time and return the final positions.
+static Vector* run(const char *mode, acc_fn f, int N, double t_end, double tol, Vector *reference) {
+    Universe *uni = create_cluster(N);
+    Integrator *ctx = create_integrator(N);
+    integrator_set_acc(ctx, f);
+    ctx->tol = tol;
+    calls = 0;
+    reset_neighbours();
+    long pairs = neighbour_pairs();
+
+    double e0 = total_energy(uni);
+    double worst = 0;
+    long steps = 0;
+    clock_t start = clock();
+    for (int k = 1; k <= 20; ++k) {
+        while (uni->t < t_end * k / 20) {
+            if (integrate_step(ctx, uni, t_end * k / 20, METHOD_RKN45) == 0) {
+                printf("%-12s step size collapsed at t = %.3e\n", mode, uni->t);
+                exit(1);
+            }
+            steps++;
+        }
+        worst = max(worst, fabs((total_energy(uni) - e0) / e0));
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    pairs = f == counting_acc ? calls * ((long)N * (N - 1) / 2) : neighbour_pairs() - pairs;
+
+    double drift = 0;
+    if (reference) {
+        for (int i = 0; i < N; ++i) {
+            double dx = uni->p[i].x - reference[i].x;
+            double dy = uni->p[i].y - reference[i].y;
+            drift += dx*dx + dy*dy;
+        }
+        drift = sqrt(drift / N) / RADIUS;
+    }
+    printf("%-12s %8ld %14ld %10.2f %14.3E %12.3E\n", mode, steps, pairs, seconds, worst, drift);
+
+    Vector *p = uni->p;
+    uni->p = NULL;
+    destroy_integrator(ctx);
+    destroy_universe(uni);
+    return p;
+}
+
+// Scatter the objects anew a few times and advance the time past every Δt, so all
+// regular forces are recomputed with changed neighbour lists and nothing is
+// extrapolated. Returns the largest difference from acc(), relative to |a|.
+static double check(int N, int n) {
+    srand(2);
+    Universe *uni = create_random_universe(N);
+    Vector *a = calloc(N, sizeof(Vector));
+    Vector *b = calloc(N, sizeof(Vector));
+    double eta = get_neighbour_eta();
+    set_neighbours(n);
+    set_neighbour_eta(1e-9);
+    double worst = 0;
+    for (int round = 0; round < 5; ++round) {
+        for (int i = 0; i < N; ++i) {
+            uni->p[i] = (Vector) { uniform(-1e+11, 1e+11), uniform(-1e+11, 1e+11) };
+            uni->v[i] = (Vector) { uniform(-1e+3, 1e+3), uniform(-1e+3, 1e+3) };
+        }
+        uni->t = round * 1e+6;
+        acc_neighbour(uni, a);
+        acc(uni, b);
+        for (int i = 0; i < N; ++i) {
+            double d = length((Vector) { a[i].x - b[i].x, a[i].y - b[i].y });
+            worst = max(worst, d / length(b[i]));
+        }
+    }
+    set_neighbour_eta(eta);
+    reset_neighbours();
+    free(a);
+    free(b);
+    destroy_universe(uni);
+    return worst;
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 1000;
+    double crossings = argc > 2 ? atof(argv[2]) : 0.2;
+    double tol = argc > 3 ? atof(argv[3]) : 1e-8;
+    if (argc > 4) {
+        set_neighbour_eta(atof(argv[4]));
+    }
+
+    for (int n = 1; n <= 8; n *= 2) {
+        double worst = check(50, n);
+        if (!(worst < 1e-12)) {
+            printf("nb = %d: forces after new neighbour lists differ from acc() by %.3e\n", n, worst);
+            return 1;
+        }
+    }
+
+    // Soften below the typical distance between the stars in the core.
+    set_softening(0.3 * RADIUS / sqrt(N));
+    Universe *uni = create_cluster(N);
+    double mass = 0;
+    for (int i = 0; i < N; ++i) {
+        mass += uni->m[i];
+    }
+    double crossing = sqrt(RADIUS * RADIUS * RADIUS / (G * mass));
+    destroy_universe(uni);
+
+    printf("N = %d, %.2f crossing times of %.3e s, tol %.0e, eta %.3f\n\n",
+        N, crossings, crossing, tol, get_neighbour_eta());
+    printf("%-12s %8s %14s %10s %14s %12s\n", "mode", "steps", "pair terms", "seconds", "max |ΔE/E|", "drift");
+    Vector *reference = run("direct", counting_acc, N, crossings * crossing, tol, NULL);
+    int counts[] = { 8, 16, 32, 64, 128 };
+    for (int k = 0; k < 5; ++k) {
+        char mode[32];
+        snprintf(mode, sizeof(mode), "nb = %d", counts[k]);
+        set_neighbours(counts[k]);
+        free(run(mode, acc_neighbour, N, crossings * crossing, tol, reference));
+    }
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "parallel.h"
+#include "threadpool.h"
+#include "gravity.h"
+#include "stats.h"
+#include "vmath.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The lower triangle of pairs (j < i) is cut into square tiles which threads take
+// from a shared counter. Every thread adds both aᵢ and −aⱼ into its own copy of
+// the accelerations, so no two threads ever write to the same memory. The copies
+// are summed afterwards, which costs O(N ⋅ threads) against O(N²) for the pairs.
+
+#define MIN_TILE 64
+#define TILES_PER_THREAD 16
+
+typedef struct Job {
+    const Universe *uni;
+    Vector *a;
+    int tile;
+    long total;
+    atomic_long next;
+} Job;
+
+static Vector **partial = NULL;
+static int partial_threads = 0;
+static int partial_N = 0;
+
+static void reserve_partial(int threads, int N) {
+    if (threads <= partial_threads && N <= partial_N) {
+        return;
+    }
+    for (int t = 0; t < partial_threads; ++t) {
+        free(partial[t]);
+    }
+    free(partial);
+
+    partial_threads = max(threads, partial_threads);
+    partial_N = max(N, partial_N);
+    partial = calloc(partial_threads, sizeof(Vector*));
+    for (int t = 0; t < partial_threads; ++t) {
+        partial[t] = aligned_alloc(64, (partial_N * sizeof(Vector) + 63) / 64 * 64);
+    }
+}
+
+// All pairs with i in [i0, i1) and j in [j0, j1), or only j < i on the diagonal.
+static void pair_tile(const Universe *uni, Vector *a, int i0, int i1, int j0, int j1) {
+    double eps2 = get_softening() * get_softening();
+    for (int i = i0; i < i1; ++i) {
+        double px = uni->p[i].x;
+        double py = uni->p[i].y;
+        double mi = uni->m[i];
+        double ax = 0;
+        double ay = 0;
+
+        int end = (j0 == i0) ? i : j1;
+        for (int j = j0; j < end; ++j) {
+            double dx = uni->p[j].x - px;
+            double dy = uni->p[j].y - py;
+            double d3 = 1.0 / sqrt(dx*dx + dy*dy + eps2);
+            d3 = d3 * d3 * d3;
+
+            ax += d3 * uni->m[j] * dx;
+            ay += d3 * uni->m[j] * dy;
+
+            a[j].x -= d3 * mi * dx;
+            a[j].y -= d3 * mi * dy;
+        }
+
+        a[i].x += ax;
+        a[i].y += ay;
+    }
+}
+
+static void accumulate(void *arg, int tid, int nthreads) {
+    (void)nthreads;
+    Job *job = arg;
+    const Universe *uni = job->uni;
+    Vector *a = partial[tid];
+    memset(a, 0, sizeof(Vector) * uni->N);
+
+    for (;;) {
+        long k = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+        if (k >= job->total) {
+            break;
+        }
+        // Tile k of the lower triangle, row by row: k = I(I + 1)/2 + J with J ≤ I.
+        long I = (long)((sqrt(8.0 * k + 1) - 1) / 2);
+        while (I * (I + 1) / 2 > k) {
+            --I;
+        }
+        while ((I + 1) * (I + 2) / 2 <= k) {
+            ++I;
+        }
+        long J = k - I * (I + 1) / 2;
+
+        int i0 = I * job->tile;
+        int j0 = J * job->tile;
+        pair_tile(uni, a, i0, min(i0 + job->tile, uni->N), j0, min(j0 + job->tile, uni->N));
+    }
+}
+
+static void reduce(void *arg, int tid, int nthreads) {
+    Job *job = arg;
+    int N = job->uni->N;
+    int start = (long)N * tid / nthreads;
+    int end = (long)N * (tid + 1) / nthreads;
+
+    for (int i = start; i < end; ++i) {
+        double ax = 0;
+        double ay = 0;
+        for (int t = 0; t < nthreads; ++t) {
+            ax += partial[t][i].x;
+            ay += partial[t][i].y;
+        }
+        job->a[i].x = G * ax;
+        job->a[i].y = G * ay;
+    }
+}
+
+// Calculate the accelerations of the objects in a Universe on all threads.
+// ### aᵢ = ∑ⱼ mⱼ ⋅ (pⱼ − pᵢ) / d(pⱼ, pᵢ)³
+void acc_parallel(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_PARALLEL, (long)uni->N * (uni->N - 1) / 2);
+    int threads = get_num_threads();
+    if (threads == 1 || uni->N < 2 * MIN_TILE) {
+        acc(uni, a);
+        return;
+    }
+
+    // Enough tiles per thread to balance the load, but not so small that the
+    // loop overhead shows.
+    long per_side = (long)sqrt(2.0 * TILES_PER_THREAD * threads) + 1;
+    int tile = max((int)((uni->N + per_side - 1) / per_side), MIN_TILE);
+    long tiles = (uni->N + tile - 1) / tile;
+
+    reserve_partial(threads, uni->N);
+
+    Job job = { uni, a, tile, tiles * (tiles + 1) / 2, 0 };
+    parallel_run(accumulate, &job);
+    parallel_run(reduce, &job);
+}
@@ -0,0 +1,10 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "gravity.h"
+
+// Same result as acc() (up to summation order), using all threads of the pool.
+// The thread count is set with set_num_threads() from threadpool.h.
+void acc_parallel(const Universe *uni, Vector *a);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,287 @@
+#include "parareal.h"
+#include "backend.h"
+#include "integrate.h"
+#include "threadpool.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+Parareal* create_parareal(int N, int slices) {
+    Parareal *pr = calloc(1, sizeof(Parareal));
+    pr->N = N;
+    pr->slices = max(slices, 1);
+    pr->coarse = METHOD_RK4;
+    pr->coarse_steps = 8;
+    pr->coarse_tol = 1e-6;
+    pr->fine = METHOD_RKN67;
+    pr->fine_tol = 1e-10;
+    pr->tol = 1e-9;
+    pr->max_iterations = pr->slices;
+
+    size_t size = (size_t)(pr->slices + 1) * 2 * max(N, 1);
+    pr->u = calloc(size, sizeof(Vector));
+    pr->g = calloc(size, sizeof(Vector));
+    pr->f = calloc(size, sizeof(Vector));
+    pr->seconds = calloc(pr->slices, sizeof(double));
+    pr->steps = calloc(pr->slices, sizeof(long));
+    return pr;
+}
+
+void destroy_parareal(Parareal *pr) {
+    for (int w = 0; w < pr->workers; ++w) {
+        destroy_integrator(pr->ctx[w]);
+        free(pr->scratch[w].p);
+        free(pr->scratch[w].v);
+    }
+    free(pr->ctx);
+    free(pr->scratch);
+    free(pr->u);
+    free(pr->g);
+    free(pr->f);
+    free(pr->seconds);
+    free(pr->steps);
+    free(pr);
+}
+
+// An Integrator and a Universe for every thread of the pool. The fine slices run at
+// the same time, so the Integrators use the direct sum, whatever backend is selected:
+// the others keep their scratch space in static variables (see backend.h).
+static int reserve_workers(Parareal *pr, int workers) {
+    if (workers <= pr->workers) {
+        return 0;
+    }
+    Integrator **ctx = realloc(pr->ctx, sizeof(Integrator*) * workers);
+    Universe *scratch = realloc(pr->scratch, sizeof(Universe) * workers);
+    if (ctx) {
+        pr->ctx = ctx;
+    }
+    if (scratch) {
+        pr->scratch = scratch;
+    }
+    if (!ctx || !scratch) {
+        return -1;
+    }
+    for (int w = pr->workers; w < workers; ++w) {
+        pr->ctx[w] = create_integrator(pr->N);
+        integrator_set_backend(pr->ctx[w], find_force_backend("direct"));
+        pr->scratch[w] = (Universe) { pr->N, calloc(max(pr->N, 1), sizeof(Vector)),
+                                      calloc(max(pr->N, 1), sizeof(Vector)), NULL, 0 };
+    }
+    pr->workers = workers;
+    return 0;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The positions of the state at the start of slice k, followed by the velocities.
+static Vector* state(const Parareal *pr, Vector *states, int k) {
+    return states + (size_t)k * 2 * pr->N;
+}
+
+static double slice_start(const Parareal *pr, double t0, double t_end, int k) {
+    return k == pr->slices ? t_end : t0 + (t_end - t0) * k / pr->slices;
+}
+
+static void load(const Parareal *pr, Universe *u, Vector *s, double t) {
+    memcpy(u->p, s, sizeof(Vector) * pr->N);
+    memcpy(u->v, s + pr->N, sizeof(Vector) * pr->N);
+    u->t = t;
+}
+
+static void store(const Parareal *pr, const Universe *u, Vector *s) {
+    memcpy(s, u->p, sizeof(Vector) * pr->N);
+    memcpy(s + pr->N, u->v, sizeof(Vector) * pr->N);
+}
+
+// Advance u to t_end with a fresh start of the step size control. The correction
+// only converges if both propagators are smooth functions of the starting state, so
+// nothing may carry over from what the Integrator did before, not even a step size.
+// A fixed step method takes exactly steps steps. Returns the number of steps, or −1 if
+// the method failed.
+static long propagate(Integrator *ctx, Universe *u, double t_end, Method method, double tol, int steps) {
+    integrator_invalidate(ctx);
+    ctx->err_prev = 0;
+    ctx->tol = tol;
+    ctx->h = 0;
+    if (method_order(method) > 0) {
+        return integrate(ctx, u, t_end, tol, method);
+    }
+
+    double t0 = u->t;
+    ctx->h = INFINITY;
+    for (int s = 1; s <= steps; ++s) {
+        // Every step is clipped to land on the end of the next one.
+        if (integrate_step(ctx, u, s == steps ? t_end : t0 + (t_end - t0) * s / steps, method) == 0) {
+            return -1;
+        }
+    }
+    return steps;
+}
+
+static long coarse(const Parareal *pr, Integrator *ctx, Universe *u, double t_end) {
+    return propagate(ctx, u, t_end, pr->coarse, pr->coarse_tol, pr->coarse_steps);
+}
+
+typedef struct FineJob {
+    Parareal *pr;
+    double t0;
+    double t_end;
+    int first;
+} FineJob;
+
+// Every thread integrates every nthreads-th slice from the first one not yet exact.
+static void fine_slices(void *arg, int tid, int nthreads) {
+    FineJob *job = arg;
+    Parareal *pr = job->pr;
+    Universe *u = &pr->scratch[tid];
+
+    for (int k = job->first + tid; k < pr->slices; k += nthreads) {
+        double start = now();
+        load(pr, u, state(pr, pr->u, k), slice_start(pr, job->t0, job->t_end, k));
+        pr->steps[k] = propagate(pr->ctx[tid], u, slice_start(pr, job->t0, job->t_end, k + 1),
+            pr->fine, pr->fine_tol, 0);
+        store(pr, u, state(pr, pr->f, k + 1));
+        pr->seconds[k] = now() - start;
+    }
+}
+
+// Apply the correction to n Vectors of a slice: with the new coarse result g, the old
+// one in G and the fine result F, the start of the next slice in U becomes
+// ### U = g + F − G
+// and G becomes g. Returns the largest change of U relative to scale.
+static double correct(const Vector *g, Vector *G, const Vector *F, Vector *U, int n, double scale) {
+    double change = 0;
+    for (int i = 0; i < n; ++i) {
+        Vector next = { g[i].x + F[i].x - G[i].x, g[i].y + F[i].y - G[i].y };
+        double dx = next.x - U[i].x;
+        double dy = next.y - U[i].y;
+        change = max(change, sqrt(dx*dx + dy*dy) / scale);
+        G[i] = g[i];
+        U[i] = next;
+    }
+    return change;
+}
+
+// Replace n Vectors of U by F. Returns the largest change relative to scale.
+static double replace(const Vector *F, Vector *U, int n, double scale) {
+    double change = 0;
+    for (int i = 0; i < n; ++i) {
+        double dx = F[i].x - U[i].x;
+        double dy = F[i].y - U[i].y;
+        change = max(change, sqrt(dx*dx + dy*dy) / scale);
+        U[i] = F[i];
+    }
+    return change;
+}
+
+// The RMS distance of the objects from their mean position, and the same for the
+// velocities, to measure changes against.
+static void system_scale(const Universe *uni, double *size, double *speed) {
+    Vector cp = { 0, 0 }, cv = { 0, 0 };
+    for (int i = 0; i < uni->N; ++i) {
+        cp.x += uni->p[i].x / uni->N;
+        cp.y += uni->p[i].y / uni->N;
+        cv.x += uni->v[i].x / uni->N;
+        cv.y += uni->v[i].y / uni->N;
+    }
+    double s = 0, w = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        s += (uni->p[i].x - cp.x) * (uni->p[i].x - cp.x) + (uni->p[i].y - cp.y) * (uni->p[i].y - cp.y);
+        w += (uni->v[i].x - cv.x) * (uni->v[i].x - cv.x) + (uni->v[i].y - cv.y) * (uni->v[i].y - cv.y);
+    }
+    *size = s > 0 ? sqrt(s / uni->N) : 1;
+    *speed = w > 0 ? sqrt(w / uni->N) : 1;
+}
+
+int parareal_integrate(Parareal *pr, Universe *uni, double t_end) {
+    if (uni->N != pr->N || reserve_workers(pr, get_num_threads()) < 0) {
+        return -1;
+    }
+    for (int w = 0; w < pr->workers; ++w) {
+        pr->scratch[w].m = uni->m;
+    }
+    int K = pr->slices;
+    int N = pr->N;
+    double t0 = uni->t;
+    double size, speed;
+    system_scale(uni, &size, &speed);
+
+    Integrator *ctx = pr->ctx[0];
+    Universe *u = &pr->scratch[0];
+    double start = now();
+
+    // Iteration 0: the coarse sweep alone.
+    store(pr, uni, state(pr, pr->u, 0));
+    for (int k = 0; k < K; ++k) {
+        load(pr, u, state(pr, pr->u, k), slice_start(pr, t0, t_end, k));
+        if (coarse(pr, ctx, u, slice_start(pr, t0, t_end, k + 1)) < 0) {
+            return -1;
+        }
+        store(pr, u, state(pr, pr->g, k + 1));
+        store(pr, u, state(pr, pr->u, k + 1));
+    }
+    pr->critical = now() - start;
+    pr->fine_steps = 0;
+    pr->iterations = 0;
+
+    // The slices before first start from what the serial fine sweep gives, or from
+    // states that stopped changing.
+    int first = 0;
+    while (first < K && pr->iterations < pr->max_iterations) {
+        ++pr->iterations;
+        FineJob job = { pr, t0, t_end, first };
+        parallel_run(fine_slices, &job);
+
+        double slowest = 0;
+        for (int k = first; k < K; ++k) {
+            if (pr->steps[k] < 0) {
+                return -1;
+            }
+            pr->fine_steps += pr->steps[k];
+            slowest = max(slowest, pr->seconds[k]);
+        }
+        start = now();
+
+        // The first slice started from an exact state, so its fine result is taken as it
+        // is. Every slice after it whose start changed by at most tol counts as exact too.
+        double change = 0;
+        int exact = first + 1;
+        for (int k = first; k < K; ++k) {
+            Vector *G = state(pr, pr->g, k + 1);
+            Vector *F = state(pr, pr->f, k + 1);
+            Vector *U = state(pr, pr->u, k + 1);
+            if (k == first) {
+                change = max(change, replace(F, U, N, size));
+                change = max(change, replace(F + N, U + N, N, speed));
+                continue;
+            }
+            load(pr, u, state(pr, pr->u, k), slice_start(pr, t0, t_end, k));
+            if (coarse(pr, ctx, u, slice_start(pr, t0, t_end, k + 1)) < 0) {
+                return -1;
+            }
+            double moved = max(correct(u->p, G, F, U, N, size), correct(u->v, G + N, F + N, U + N, N, speed));
+            if (exact == k && moved <= pr->tol) {
+                exact = k + 1;
+            }
+            change = max(change, moved);
+        }
+        first = exact;
+        pr->change = change;
+        pr->critical += slowest + now() - start;
+
+        if (change <= pr->tol) {
+            break;
+        }
+    }
+
+    load(pr, uni, state(pr, pr->u, K), t_end);
+    return pr->iterations;
+}
@@ -0,0 +1,54 @@
+#ifndef PARAREAL_H
+#define PARAREAL_H
+
+#include "integrate.h"
+
+// Parallel in time integration for small systems over long times, where there are too
+// few pairs to share among the threads. The time to integrate over is cut into slices.
+// A cheap coarse propagator G sweeps through them serially, the accurate fine
+// propagator F integrates all slices at once from the starting points of the last
+// iteration, one slice per thread of the pool, and the next iteration corrects the
+// starting points with
+// ### Uₖ₊₁ ← G(Uₖ) + F(Uₖ') − G(Uₖ')
+// where Uₖ' are the starting points of the last iteration. After k iterations the first
+// k slices equal what F gives in one serial sweep, so the iteration ends after at most
+// slices iterations, but usually far earlier, once the starting points stop moving.
+// It only pays when G is much cheaper than F and the iteration converges in a few
+// iterations; orbits that G gets badly out of phase converge slowly. Both propagators
+// use the direct sum, the only backend that may run on several threads at once.
+typedef struct Parareal {
+    int N;
+    int slices;          // of the time given to parareal_integrate()
+    Method coarse;       // default METHOD_RK4
+    int coarse_steps;    // fixed steps of the coarse method per slice (default 8)
+    double coarse_tol;   // tolerance if the coarse method is adaptive (default 1e-6)
+    Method fine;         // default METHOD_RKN67
+    double fine_tol;     // default 1e-10
+    double tol;          // converged once no position or velocity moved by more than tol relative to the system (default 1e-9)
+    int max_iterations;  // default slices, at which the result is exact
+
+    // Of the last parareal_integrate():
+    int iterations;
+    long fine_steps;     // in all slices of all iterations
+    double change;       // of the starting points in the last iteration, relative to the system
+    double critical;     // seconds on the critical path: the coarse sweeps plus the slowest fine slice of every iteration
+
+    Vector *u;           // (slices + 1) * 2N: the positions and velocities at the start of every slice
+    Vector *g;           // the coarse result of every slice in the last iteration
+    Vector *f;           // the fine result of every slice in the last iteration
+    double *seconds;     // the wall time of every fine slice in the last iteration
+    long *steps;         // the steps of every fine slice in the last iteration, −1 if it failed
+    int workers;         // the number of Integrators and scratch Universes below
+    Integrator **ctx;
+    Universe *scratch;
+} Parareal;
+
+Parareal* create_parareal(int N, int slices);
+
+void destroy_parareal(Parareal *pr);
+
+// Advance the Universe from uni->t to t_end. Returns the number of iterations, or −1
+// if a propagator failed or the Universe no longer has N objects.
+int parareal_integrate(Parareal *pr, Universe *uni, double t_end);
+
+#endif /* PARAREAL_H */
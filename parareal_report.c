@@ -0,0 +1,127 @@
+#include "parareal.h"
+#include "integrate.h"
+#include "threadpool.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Parareal against the serial fine integration, rkn67 at a tolerance of 1e-12, for the
+// Earth-Moon system of energy_report and for a planetary system of 20 objects. The time
+// is integrated in windows, each cut into slices, with fixed steps of rk4 or with rkn45
+// at a tolerance of 1e-7 as the coarse propagator. The measured speedup depends on the
+// cores there are; the projected one divides the serial time by the critical path, the
+// time it would take with a thread for every slice. The difference is the largest
+// distance between the final positions of both runs, relative to the size of the system.
+// usage: parareal_report [years] [slices] [threads] [windows] [rk4 steps per slice]
+
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The Earth and the Moon on a slightly eccentric orbit, plus a distant, light third body.
+static Universe* create_moon_system(int N) {
+    (void)N;
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = 3;
+    uni->p = calloc(3, sizeof(Vector));
+    uni->v = calloc(3, sizeof(Vector));
+    uni->m = calloc(3, sizeof(double));
+
+    uni->m[0] = 5.9724e+24;
+    uni->m[1] = 0.07346e+24;
+    uni->p[1] = (Vector) { 0, 3.85e+8 };
+    uni->v[1] = (Vector) { 1.1e+3, 0 };
+    uni->m[2] = 1e+20;
+    uni->p[2] = (Vector) { 1.5e+9, 0 };
+    uni->v[2] = (Vector) { 0, 5e+2 };
+    return uni;
+}
+
+static Universe* create_planets(int N) {
+    srand(1);
+    return create_planetary_system(N);
+}
+
+static double t_end = 0;
+static const double fine_tol = 1e-12;
+
+static void run(const char *name, Universe* (*create)(int), int N, int slices, int windows, Method coarse, int coarse_steps) {
+    // The serial fine integration, in one go.
+    Universe *serial = create(N);
+    N = serial->N;
+    Integrator *ctx = create_integrator(N);
+    double e0 = total_energy(serial);
+    double start = now();
+    long steps = integrate(ctx, serial, t_end, fine_tol, METHOD_RKN67);
+    double serial_seconds = now() - start;
+    double serial_error = fabs((total_energy(serial) - e0) / e0);
+    destroy_integrator(ctx);
+
+    Universe *uni = create(N);
+    Parareal *pr = create_parareal(N, slices);
+    pr->coarse = coarse;
+    pr->coarse_steps = coarse_steps;
+    pr->coarse_tol = 1e-7;
+    pr->fine_tol = fine_tol;
+    long fine_steps = 0;
+    int iterations = 0;
+    double critical = 0;
+    start = now();
+    for (int w = 1; w <= windows; ++w) {
+        if (parareal_integrate(pr, uni, t_end * w / windows) < 0) {
+            printf("%-8s %-6s parareal failed in window %d\n", name, method_name(coarse), w);
+            return;
+        }
+        fine_steps += pr->fine_steps;
+        iterations += pr->iterations;
+        critical += pr->critical;
+    }
+    double seconds = now() - start;
+
+    // The size of the system, as parareal measures changes.
+    double size = 0;
+    Vector c = center_of_gravity(serial);
+    for (int i = 0; i < N; ++i) {
+        size += (serial->p[i].x - c.x) * (serial->p[i].x - c.x) + (serial->p[i].y - c.y) * (serial->p[i].y - c.y);
+    }
+    size = sqrt(size / N);
+    double difference = 0;
+    for (int i = 0; i < N; ++i) {
+        difference = max(difference, length((Vector) { uni->p[i].x - serial->p[i].x, uni->p[i].y - serial->p[i].y }));
+    }
+
+    printf("%-8s %-6s %10.2f %10ld %10ld %10.3f %10.3f %9.2f %9.2f %12.3E %12.3E %12.3E\n", name, method_name(coarse),
+        (double)iterations / windows, steps, fine_steps, serial_seconds, seconds,
+        serial_seconds / seconds, serial_seconds / critical,
+        serial_error, fabs((total_energy(uni) - e0) / e0), difference / size);
+
+    destroy_parareal(pr);
+    destroy_universe(uni);
+    destroy_universe(serial);
+}
+
+int main(int argc, char **argv) {
+    double years = argc > 1 ? atof(argv[1]) : 10;
+    int slices = argc > 2 ? atoi(argv[2]) : 16;
+    set_num_threads(argc > 3 ? atoi(argv[3]) : 0);
+    int windows = argc > 4 ? atoi(argv[4]) : 10;
+    int coarse_steps = argc > 5 ? atoi(argv[5]) : 16;
+    t_end = years * 365.25 * 86400;
+
+    printf("%.0f years in %d windows of %d slices, %d rk4 steps per slice, %d threads\n\n",
+        years, windows, slices, coarse_steps, get_num_threads());
+    printf("%-8s %-6s %10s %10s %10s %10s %10s %9s %9s %12s %12s %12s\n", "system", "coarse", "iterations",
+        "serial", "parareal", "serial s", "parareal s", "speedup", "projected",
+        "serial ΔE/E", "parareal ΔE/E", "difference");
+    run("moon", create_moon_system, 3, slices, windows, METHOD_RK4, coarse_steps);
+    run("moon", create_moon_system, 3, slices, windows, METHOD_RKN45, coarse_steps);
+    run("planets", create_planets, 20, slices, windows, METHOD_RK4, coarse_steps);
+    run("planets", create_planets, 20, slices, windows, METHOD_RKN45, coarse_steps);
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "pm.h"
+#include "gravity.h"
+#include "threadpool.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The mass is assigned to an n × n mesh around all objects, and the potential is the
+// convolution of the mesh with the kernel 1/d. Note that in this Universe 1/d is not
+// the Green's function of the 2D Poisson equation, so there is no Poisson equation to
+// solve in Fourier space; the convolution is computed with FFTs directly instead.
+// Isolated boundaries come from padding the mesh to 2n × 2n with zeros, so that the
+// periodic convolution never wraps around. The FFT of the kernel only depends on the
+// mesh size and is computed once, in units of cells; a mesh of width h scales it by 1/h.
+//
+// The accelerations are the gradient of the potential by central differences of the
+// fourth order, interpolated back to the objects with the same weights as the mass.
+
+static int grid = 256;
+static Assignment assignment = PM_TSC;
+
+void set_pm_grid(int n) {
+    grid = 16;
+    while (grid < n) {
+        grid *= 2;
+    }
+}
+
+int get_pm_grid(void) {
+    return grid;
+}
+
+void set_pm_assignment(Assignment scheme) {
+    assignment = scheme;
+}
+
+// Everything below belongs to the padded size `padded` and is kept between calls.
+static int padded = 0;
+static double *twiddle;  // e^(−2πik / padded), complex
+static double *kernel;   // FFT of the kernel, real since the kernel is even
+static double *mesh;     // padded × padded, complex
+static double *psi;      // ∑ⱼ mⱼ / d on the first grid × grid cells
+static double *gx, *gy;
+
+// The mean of 1/d over a cell around the origin, in units of cells.
+// ### ∫∫ 1/d = 4 ⋅ ln(1 + √2)
+static const double SELF = 3.52549434807817;
+
+static double kernel_at(int dx, int dy) {
+    return dx == 0 && dy == 0 ? SELF : 1.0 / sqrt(dx*dx + dy*dy);
+}
+
+// In-place radix-2 FFT of M complex values. sign = 1 is forward, sign = −1 inverse
+// without the 1/M.
+static void fft(double *z, int M, int sign) {
+    for (int i = 1, j = 0; i < M; ++i) {
+        int bit = M >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double re = z[2*i], im = z[2*i + 1];
+            z[2*i] = z[2*j];
+            z[2*i + 1] = z[2*j + 1];
+            z[2*j] = re;
+            z[2*j + 1] = im;
+        }
+    }
+
+    for (int len = 2; len <= M; len <<= 1) {
+        int stride = M / len;
+        for (int i = 0; i < M; i += len) {
+            for (int k = 0; k < len / 2; ++k) {
+                double wr = twiddle[2 * k * stride];
+                double wi = sign * twiddle[2 * k * stride + 1];
+                double *a = z + 2 * (i + k);
+                double *b = z + 2 * (i + k + len / 2);
+                double tr = b[0] * wr - b[1] * wi;
+                double ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+static void prepare(void) {
+    int M = 2 * grid;
+    if (M == padded) {
+        return;
+    }
+    padded = M;
+    twiddle = realloc(twiddle, M * sizeof(double));
+    kernel = realloc(kernel, (size_t)M * M * sizeof(double));
+    mesh = realloc(mesh, (size_t)M * M * 2 * sizeof(double));
+    psi = realloc(psi, (size_t)grid * grid * sizeof(double));
+    gx = realloc(gx, (size_t)grid * grid * sizeof(double));
+    gy = realloc(gy, (size_t)grid * grid * sizeof(double));
+
+    for (int k = 0; k < M / 2; ++k) {
+        twiddle[2*k] = cos(2 * M_PI * k / M);
+        twiddle[2*k + 1] = -sin(2 * M_PI * k / M);
+    }
+
+    // Offsets of M/2 and more wrap around to negative ones.
+    for (int iy = 0; iy < M; ++iy) {
+        for (int ix = 0; ix < M; ++ix) {
+            double *z = mesh + 2 * ((size_t)iy * M + ix);
+            z[0] = kernel_at(ix < M/2 ? ix : ix - M, iy < M/2 ? iy : iy - M);
+            z[1] = 0;
+        }
+    }
+    for (int iy = 0; iy < M; ++iy) {
+        fft(mesh + 2 * (size_t)iy * M, M, 1);
+    }
+    double *column = malloc(2 * M * sizeof(double));
+    for (int ix = 0; ix < M; ++ix) {
+        for (int iy = 0; iy < M; ++iy) {
+            column[2*iy] = mesh[2 * ((size_t)iy * M + ix)];
+            column[2*iy + 1] = mesh[2 * ((size_t)iy * M + ix) + 1];
+        }
+        fft(column, M, 1);
+        for (int iy = 0; iy < M; ++iy) {
+            kernel[(size_t)iy * M + ix] = column[2*iy];
+        }
+    }
+    free(column);
+}
+
+// The first cell of the stencil of an object at u, in units of cells from the first
+// cell centre, and the weights of the 2 or 3 cells from there.
+static int weights(double u, double *w) {
+    if (assignment == PM_CIC) {
+        int i = (int)floor(u);
+        double f = u - i;
+        w[0] = 1 - f;
+        w[1] = f;
+        return i;
+    }
+    int i = (int)floor(u + 0.5);
+    double d = u - i;
+    w[0] = 0.5 * (0.5 - d) * (0.5 - d);
+    w[1] = 0.75 - d * d;
+    w[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    return i - 1;
+}
+
+typedef struct Pass {
+    const Universe *uni;
+    Vector *a;
+    double *pot;
+    double left, bottom;  // lower left corner of the mesh
+    double h;             // width of a cell
+} Pass;
+
+static void forward_rows(void *arg, int tid, int nthreads) {
+    (void)arg;
+    for (int iy = grid * tid / nthreads; iy < grid * (tid + 1) / nthreads; ++iy) {
+        fft(mesh + 2 * (size_t)iy * padded, padded, 1);
+    }
+}
+
+// Each column goes forward, is multiplied with the kernel, and goes back. The rows of
+// the padding are zero, so they were left out of forward_rows(). Columns are copied
+// out BLOCK at a time, so that every row is read in whole cache lines.
+#define BLOCK 8
+
+static void convolve_columns(void *arg, int tid, int nthreads) {
+    (void)arg;
+    int M = padded;
+    int blocks = M / BLOCK;
+    double *column = malloc(2 * M * BLOCK * sizeof(double));
+    for (int k = blocks * tid / nthreads; k < blocks * (tid + 1) / nthreads; ++k) {
+        int x0 = k * BLOCK;
+        for (int iy = 0; iy < M; ++iy) {
+            const double *row = mesh + 2 * ((size_t)iy * M + x0);
+            for (int b = 0; b < BLOCK; ++b) {
+                column[2 * (b * M + iy)] = row[2*b];
+                column[2 * (b * M + iy) + 1] = row[2*b + 1];
+            }
+        }
+        for (int b = 0; b < BLOCK; ++b) {
+            double *z = column + 2 * b * M;
+            fft(z, M, 1);
+            for (int iy = 0; iy < M; ++iy) {
+                z[2*iy] *= kernel[(size_t)iy * M + x0 + b];
+                z[2*iy + 1] *= kernel[(size_t)iy * M + x0 + b];
+            }
+            fft(z, M, -1);
+        }
+        for (int iy = 0; iy < grid; ++iy) {
+            double *row = mesh + 2 * ((size_t)iy * M + x0);
+            for (int b = 0; b < BLOCK; ++b) {
+                row[2*b] = column[2 * (b * M + iy)];
+                row[2*b + 1] = column[2 * (b * M + iy) + 1];
+            }
+        }
+    }
+    free(column);
+}
+
+static void inverse_rows(void *arg, int tid, int nthreads) {
+    const Pass *pass = arg;
+    double scale = 1.0 / ((double)padded * padded * pass->h);
+    for (int iy = grid * tid / nthreads; iy < grid * (tid + 1) / nthreads; ++iy) {
+        double *row = mesh + 2 * (size_t)iy * padded;
+        fft(row, padded, -1);
+        for (int ix = 0; ix < grid; ++ix) {
+            psi[iy * grid + ix] = row[2*ix] * scale;
+        }
+    }
+}
+
+// ### ∂ψ/∂x ≈ (8 (ψᵢ₊₁ − ψᵢ₋₁) − (ψᵢ₊₂ − ψᵢ₋₂)) / 12h
+static void gradient(void *arg, int tid, int nthreads) {
+    const Pass *pass = arg;
+    int n = grid;
+    for (int iy = 2 + (n - 4) * tid / nthreads; iy < 2 + (n - 4) * (tid + 1) / nthreads; ++iy) {
+        for (int ix = 2; ix < n - 2; ++ix) {
+            const double *c = psi + iy * n + ix;
+            gx[iy * n + ix] = (8 * (c[1] - c[-1]) - (c[2] - c[-2])) / (12 * pass->h);
+            gy[iy * n + ix] = (8 * (c[n] - c[-n]) - (c[2*n] - c[-2*n])) / (12 * pass->h);
+        }
+    }
+}
+
+static void interpolate(void *arg, int tid, int nthreads) {
+    const Pass *pass = arg;
+    const Universe *uni = pass->uni;
+    int s = assignment == PM_CIC ? 2 : 3;
+
+    for (int i = uni->N * tid / nthreads; i < uni->N * (tid + 1) / nthreads; ++i) {
+        double wx[3], wy[3];
+        int ix = weights((uni->p[i].x - pass->left) / pass->h - 0.5, wx);
+        int iy = weights((uni->p[i].y - pass->bottom) / pass->h - 0.5, wy);
+
+        double ax = 0, ay = 0, f = 0;
+        for (int y = 0; y < s; ++y) {
+            for (int x = 0; x < s; ++x) {
+                int c = (iy + y) * grid + ix + x;
+                double w = wx[x] * wy[y];
+                ax += w * gx[c];
+                ay += w * gy[c];
+                f += w * psi[c];
+            }
+        }
+        pass->a[i] = (Vector) { G * ax, G * ay };
+
+        if (pass->pot) {
+            // The object's own mass on the mesh, seen through its own stencil.
+            double self = 0;
+            for (int y1 = 0; y1 < s; ++y1) for (int x1 = 0; x1 < s; ++x1) {
+                for (int y2 = 0; y2 < s; ++y2) for (int x2 = 0; x2 < s; ++x2) {
+                    self += wx[x1] * wy[y1] * wx[x2] * wy[y2] * kernel_at(x1 - x2, y1 - y2);
+                }
+            }
+            pass->pot[i] = -G * (f - uni->m[i] * self / pass->h);
+        }
+    }
+}
+
+void acc_pot_pm(const Universe *uni, Vector *a, double *pot) {
+    STATS_KERNEL(STATS_PM, 0);
+    if (uni->N == 0) {
+        return;
+    }
+    prepare();
+
+    double xmin = uni->p[0].x, xmax = uni->p[0].x;
+    double ymin = uni->p[0].y, ymax = uni->p[0].y;
+    for (int i = 1; i < uni->N; ++i) {
+        xmin = min(xmin, uni->p[i].x);
+        xmax = max(xmax, uni->p[i].x);
+        ymin = min(ymin, uni->p[i].y);
+        ymax = max(ymax, uni->p[i].y);
+    }
+
+    // Leave 4 cells at every edge for the stencils of the weights and the gradient.
+    double h = (max(xmax - xmin, ymax - ymin) + 1e-9) / (grid - 8);
+    Pass pass = { uni, a, pot, (xmin + xmax) / 2 - grid / 2 * h, (ymin + ymax) / 2 - grid / 2 * h, h };
+
+    memset(mesh, 0, (size_t)padded * padded * 2 * sizeof(double));
+    int s = assignment == PM_CIC ? 2 : 3;
+    for (int i = 0; i < uni->N; ++i) {
+        double wx[3], wy[3];
+        int ix = weights((uni->p[i].x - pass.left) / pass.h - 0.5, wx);
+        int iy = weights((uni->p[i].y - pass.bottom) / pass.h - 0.5, wy);
+        for (int y = 0; y < s; ++y) {
+            for (int x = 0; x < s; ++x) {
+                mesh[2 * ((size_t)(iy + y) * padded + ix + x)] += uni->m[i] * wx[x] * wy[y];
+            }
+        }
+    }
+
+    parallel_run(forward_rows, &pass);
+    parallel_run(convolve_columns, &pass);
+    parallel_run(inverse_rows, &pass);
+    parallel_run(gradient, &pass);
+    parallel_run(interpolate, &pass);
+}
+
+void acc_pm(const Universe *uni, Vector *a) {
+    acc_pot_pm(uni, a, NULL);
+}
@@ -0,0 +1,28 @@
+#ifndef PM_H
+#define PM_H
+
+#include "gravity.h"
+
+// How the mass of an object is spread over the mesh, and how the forces are read back.
+typedef enum Assignment {
+    PM_CIC,  // cloud in cell, the 2 × 2 nearest cells
+    PM_TSC,  // triangular shaped cloud, the 3 × 3 nearest cells
+} Assignment;
+
+// Set the number of mesh cells per side, rounded up to a power of two. Defaults to 256.
+void set_pm_grid(int n);
+
+int get_pm_grid(void);
+
+// Defaults to PM_TSC.
+void set_pm_assignment(Assignment scheme);
+
+// Calculate the accelerations on a mesh over all objects. Forces between objects less
+// than a few cells apart are smoothed out, so this suits large, smooth distributions.
+void acc_pm(const Universe *uni, Vector *a);
+
+// The same, and the potential at every object without its own contribution.
+// ### φᵢ = − ∑ⱼ G ⋅ mⱼ / d(pⱼ, pᵢ)
+void acc_pot_pm(const Universe *uni, Vector *a, double *pot);
+
+#endif /* PM_H */
@@ -0,0 +1,135 @@
+#include "gravity.h"
+#include "fmm.h"
+#include "pm.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Accuracy and speed of the particle-mesh solver for a range of mesh sizes, on an
+// exponential disc of equal masses, compared against the direct sum acc(). The force
+// of the nearest neighbours is as large as the mean field for any N here, and the mesh
+// smooths it out by design, so the per-object errors stay large. The profile error is
+// the largest error of the mean radial acceleration in rings, which is the smooth field
+// that the mesh is meant to carry.
+// usage: pm_report [N]
+
+
+static double seconds_per_call(acc_fn f, const Universe *uni, Vector *a) {
+    int calls = 0;
+    clock_t start = clock();
+    do {
+        f(uni, a);
+        ++calls;
+    } while (clock() - start < CLOCKS_PER_SEC / 4);
+    return (double)(clock() - start) / CLOCKS_PER_SEC / calls;
+}
+
+#define RINGS 24
+
+// The mean radial acceleration in rings of width R / 4, for the rings with enough objects.
+static void radial_profile(const Universe *uni, const Vector *a, double *profile, int *count) {
+    for (int k = 0; k < RINGS; ++k) {
+        profile[k] = 0;
+        count[k] = 0;
+    }
+    for (int i = 0; i < uni->N; ++i) {
+        double r = length(uni->p[i]);
+        int k = min((int)(r / 1e+20 * 4), RINGS - 1);
+        profile[k] += (a[i].x * uni->p[i].x + a[i].y * uni->p[i].y) / r;
+        ++count[k];
+    }
+    for (int k = 0; k < RINGS; ++k) {
+        profile[k] /= max(count[k], 1);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// A disc with surface density ~ e^(−r / R) out to 6 R.
+static Universe* create_disc(int N) {
+    const double R = 1e+20;
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = N;
+    uni->p = calloc(N, sizeof(Vector));
+    uni->v = calloc(N, sizeof(Vector));
+    uni->m = calloc(N, sizeof(double));
+
+    for (int i = 0; i < N; ++i) {
+        double r;
+        do {
+            // The radius of e^(−r) r is the sum of two exponential variates.
+            r = -R * (log(uniform(0, 1)) + log(uniform(0, 1)));
+        } while (r > 6 * R);
+        double phi = uniform(0, 2 * M_PI);
+        uni->p[i] = (Vector) { r * cos(phi), r * sin(phi) };
+        uni->m[i] = 1e+41 / N;
+    }
+    return uni;
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 20000;
+
+    Universe *uni = create_disc(N);
+    Vector *exact = calloc(N, sizeof(Vector));
+    Vector *approx = calloc(N, sizeof(Vector));
+    double *errors = calloc(N, sizeof(double));
+
+    double direct_time = seconds_per_call(acc, uni, exact);
+    printf("N = %d, direct acc(): %.3f ms per call\n\n", N, direct_time * 1e+3);
+    printf("scheme  grid   ms/call  speedup   median err      90%% err  profile err\n");
+
+    double exact_profile[RINGS], profile[RINGS];
+    int count[RINGS];
+    radial_profile(uni, exact, exact_profile, count);
+
+    for (int scheme = PM_CIC; scheme <= PM_TSC; ++scheme) {
+        set_pm_assignment(scheme);
+        for (int n = 64; n <= 1024; n *= 2) {
+            set_pm_grid(n);
+            double time = seconds_per_call(acc_pm, uni, approx);
+
+            for (int i = 0; i < N; ++i) {
+                double dx = approx[i].x - exact[i].x;
+                double dy = approx[i].y - exact[i].y;
+                errors[i] = sqrt(dx*dx + dy*dy) / length(exact[i]);
+            }
+            qsort(errors, N, sizeof(double), compare_doubles);
+
+            radial_profile(uni, approx, profile, count);
+            double profile_err = 0;
+            for (int k = 0; k < RINGS; ++k) {
+                if (count[k] >= 100) {
+                    profile_err = max(profile_err, fabs(profile[k] / exact_profile[k] - 1));
+                }
+            }
+
+            printf("%-6s %5d %9.3f %8.2f %12.3E %12.3E %12.3E\n",
+                scheme == PM_CIC ? "CIC" : "TSC", n, time * 1e+3, direct_time / time,
+                errors[N / 2], errors[N * 9 / 10], profile_err);
+        }
+    }
+
+    double *pot = calloc(N, sizeof(double));
+    acc_pot_pm(uni, approx, pot);
+    double energy = 0;
+    for (int i = 0; i < N; ++i) {
+        energy += uni->m[i] * pot[i] / 2;
+    }
+    double exact_energy = gravitational_energy_fmm(uni);
+    printf("\nenergy error of the TSC potentials at grid %d: %.3E\n",
+        get_pm_grid(), fabs(energy - exact_energy) / fabs(exact_energy));
+
+    free(pot);
+    free(errors);
+    free(approx);
+    free(exact);
+    destroy_universe(uni);
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include "regularize.h"
+#include "integrate.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+Regularizer* create_regularizer(int N) {
+    Regularizer *reg = calloc(1, sizeof(Regularizer));
+    reg->cap = max(N, 1);
+    reg->reduced.p = calloc(reg->cap, sizeof(Vector));
+    reg->reduced.v = calloc(reg->cap, sizeof(Vector));
+    reg->reduced.m = calloc(reg->cap, sizeof(double));
+    reg->binaries = calloc(reg->cap / 2 + 1, sizeof(Binary));
+    reg->partner = calloc(reg->cap, sizeof(int));
+    reg->previous = calloc(reg->cap, sizeof(int));
+    reg->nearest = calloc(reg->cap, sizeof(double));
+    for (int i = 0; i < reg->cap; ++i) {
+        reg->previous[i] = -1;
+    }
+    reg->gamma = 1e-5;
+    reg->kicks = 64;
+    return reg;
+}
+
+void destroy_regularizer(Regularizer *reg) {
+    free(reg->reduced.p);
+    free(reg->reduced.v);
+    free(reg->reduced.m);
+    free(reg->binaries);
+    free(reg->partner);
+    free(reg->previous);
+    free(reg->nearest);
+    free(reg);
+}
+
+static void reserve(Regularizer *reg, int N) {
+    if (N <= reg->cap) {
+        return;
+    }
+    reg->reduced.p = realloc(reg->reduced.p, N * sizeof(Vector));
+    reg->reduced.v = realloc(reg->reduced.v, N * sizeof(Vector));
+    reg->reduced.m = realloc(reg->reduced.m, N * sizeof(double));
+    reg->binaries = realloc(reg->binaries, (N / 2 + 1) * sizeof(Binary));
+    reg->partner = realloc(reg->partner, N * sizeof(int));
+    reg->previous = realloc(reg->previous, N * sizeof(int));
+    reg->nearest = realloc(reg->nearest, N * sizeof(double));
+    for (int i = reg->cap; i < N; ++i) {
+        reg->previous[i] = -1;
+    }
+    reg->cap = N;
+}
+
+// The gradient of the acceleration at c caused by all objects but skip1 and skip2,
+// so that a(c + q) ≈ a(c) + T q for small q.
+// ### T = ∑ₖ G ⋅ mₖ ⋅ (3 ⋅ d dᵀ / |d|⁵ − I / |d|³),  d = pₖ − c
+static void tidal_tensor(const Universe *uni, int skip1, int skip2, Vector c, double *T) {
+    T[0] = T[1] = T[2] = 0;
+    for (int k = 0; k < uni->N; ++k) {
+        if (k == skip1 || k == skip2) {
+            continue;
+        }
+        double dx = uni->p[k].x - c.x;
+        double dy = uni->p[k].y - c.y;
+        double d2 = dx*dx + dy*dy;
+        double d3 = 1.0 / (d2 * sqrt(d2));
+        double d5 = 3 * d3 / d2;
+        T[0] += uni->m[k] * (d5 * dx*dx - d3);
+        T[1] += uni->m[k] * (d5 * dx*dy);
+        T[2] += uni->m[k] * (d5 * dy*dy - d3);
+    }
+    T[0] *= G;
+    T[1] *= G;
+    T[2] *= G;
+}
+
+// The largest eigenvalue of the symmetric 2 x 2 tensor, in absolute value.
+static double tensor_norm(const double *T) {
+    double mean = (T[0] + T[2]) / 2;
+    double radius = sqrt((T[0] - T[2]) * (T[0] - T[2]) / 4 + T[1] * T[1]);
+    return fabs(mean) + radius;
+}
+
+// Pairs of mutual nearest neighbours with positive masses, bound to each other,
+// whose apocentre feels a tidal acceleration of less than gamma times their own
+// attraction there. The search for neighbours costs N² / 2 distances, each one
+// offered to both of its objects.
+static void find_binaries(Regularizer *reg, const Universe *uni) {
+    int *nearest = reg->partner;
+    double *best = reg->nearest;
+    for (int i = 0; i < uni->N; ++i) {
+        best[i] = INFINITY;
+        nearest[i] = -1;
+    }
+    for (int i = 0; i < uni->N; ++i) {
+        for (int j = i + 1; j < uni->N; ++j) {
+            double dx = uni->p[j].x - uni->p[i].x;
+            double dy = uni->p[j].y - uni->p[i].y;
+            double d2 = dx*dx + dy*dy;
+            if (d2 < best[i]) {
+                best[i] = d2;
+                nearest[i] = j;
+            }
+            if (d2 < best[j]) {
+                best[j] = d2;
+                nearest[j] = i;
+            }
+        }
+    }
+
+    reg->count = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        int j = nearest[i];
+        if (j <= i || nearest[j] != i || uni->m[i] <= 0 || uni->m[j] <= 0) {
+            continue;
+        }
+        Vector q = { uni->p[j].x - uni->p[i].x, uni->p[j].y - uni->p[i].y };
+        Vector w = { uni->v[j].x - uni->v[i].x, uni->v[j].y - uni->v[i].y };
+        double mu = G * (uni->m[i] + uni->m[j]);
+        // ### E = |w|² / 2 − μ / |q|,  a = −μ / 2E
+        double energy = (w.x*w.x + w.y*w.y) / 2 - mu / length(q);
+        if (!(energy < 0) || isinf(energy)) {
+            continue;
+        }
+        double a = -mu / (2 * energy);
+
+        double M = uni->m[i] + uni->m[j];
+        Vector c = {
+            (uni->m[i] * uni->p[i].x + uni->m[j] * uni->p[j].x) / M,
+            (uni->m[i] * uni->p[i].y + uni->m[j] * uni->p[j].y) / M
+        };
+        double T[3];
+        tidal_tensor(uni, i, j, c, T);
+        // ### γ = |T| ⋅ 2a / (μ / (2a)²)
+        if (tensor_norm(T) * 8 * a*a*a / mu >= reg->gamma) {
+            continue;
+        }
+        reg->binaries[reg->count++] = (Binary) { .i = i, .j = j, .mu = mu, .energy = energy };
+    }
+
+    for (int i = 0; i < uni->N; ++i) {
+        reg->partner[i] = -1;
+    }
+    for (int b = 0; b < reg->count; ++b) {
+        reg->partner[reg->binaries[b].i] = reg->binaries[b].j;
+        reg->partner[reg->binaries[b].j] = reg->binaries[b].i;
+    }
+}
+
+// The relative position and velocity of a binary in Levi-Civita coordinates.
+// ### q = L(u) u,  w = 2 L(u) u' / |u|²,  L(u) = [u₁ −u₂; u₂ u₁]
+static void to_levi_civita(Binary *b, Vector q, Vector w) {
+    double r = length(q);
+    if (q.x >= 0) {
+        b->u.x = sqrt((r + q.x) / 2);
+        b->u.y = q.y / (2 * b->u.x);
+    } else {
+        b->u.y = copysign(sqrt((r - q.x) / 2), q.y);
+        b->u.x = q.y / (2 * b->u.y);
+    }
+    // ### u' = L(u)ᵀ w / 2
+    b->du.x = (b->u.x * w.x + b->u.y * w.y) / 2;
+    b->du.y = (-b->u.y * w.x + b->u.x * w.y) / 2;
+}
+
+static void from_levi_civita(const Binary *b, Vector *q, Vector *w) {
+    double r = b->u.x * b->u.x + b->u.y * b->u.y;
+    *q = (Vector) { b->u.x * b->u.x - b->u.y * b->u.y, 2 * b->u.x * b->u.y };
+    *w = (Vector) {
+        2 * (b->u.x * b->du.x - b->u.y * b->du.y) / r,
+        2 * (b->u.y * b->du.x + b->u.x * b->du.y) / r
+    };
+}
+
+// Without perturbations u'' = (E / 2) u, a harmonic oscillator for E < 0. With
+// k = −E / 2 its solution is u(τ) = u₀ ⋅ C + u₀' ⋅ S:
+// ### C = cos(√k τ),  S = sin(√k τ) / √k    (cosh and sinh for k < 0)
+static void oscillator(double k, double tau, double *C, double *S) {
+    if (k > 0) {
+        double w = sqrt(k);
+        *C = cos(w * tau);
+        *S = sin(w * tau) / w;
+    } else if (k < 0) {
+        double w = sqrt(-k);
+        *C = cosh(w * tau);
+        *S = sinh(w * tau) / w;
+    } else {
+        *C = 1;
+        *S = tau;
+    }
+}
+
+// ### ∫₀^τ S² = (τ − C S) / 2k = ∑ₙ₌₁ (−1)ⁿ⁺¹ 2²ⁿ⁻¹ kⁿ⁻¹ τ²ⁿ⁺¹ / (2n + 1)!
+// The series avoids the cancellation of the closed form for small k τ².
+static double integral_S2(double k, double tau, double C, double S) {
+    if (fabs(k) * tau*tau > 0.1) {
+        return (tau - C * S) / (2 * k);
+    }
+    double term = tau*tau*tau / 3;
+    double sum = term;
+    for (int n = 1; n < 20 && fabs(term) > 1e-17 * fabs(sum); ++n) {
+        term *= -4 * k * tau*tau / ((2*n + 2) * (2*n + 3));
+        sum += term;
+    }
+    return sum;
+}
+
+// The physical time that passes during the fictitious time τ, on the unperturbed orbit.
+// ### t(τ) = ∫₀^τ |u|² = |u₀|² (τ + C S) / 2 + (u₀ ⋅ u₀') S² + |u₀'|² ∫₀^τ S²
+static double kepler_time(const Binary *b, double tau) {
+    double k = -b->energy / 2;
+    double C, S;
+    oscillator(k, tau, &C, &S);
+    double uu = b->u.x * b->u.x + b->u.y * b->u.y;
+    double ud = b->u.x * b->du.x + b->u.y * b->du.y;
+    double dd = b->du.x * b->du.x + b->du.y * b->du.y;
+    return uu * (tau + C * S) / 2 + ud * S*S + dd * integral_S2(k, tau, C, S);
+}
+
+static double kepler_distance(const Binary *b, double tau) {
+    double C, S;
+    oscillator(-b->energy / 2, tau, &C, &S);
+    double x = b->u.x * C + b->du.x * S;
+    double y = b->u.y * C + b->du.y * S;
+    return x*x + y*y;
+}
+
+// Move along the unperturbed orbit by τ.
+static void kepler_drift(Binary *b, double tau) {
+    double k = -b->energy / 2;
+    double C, S;
+    oscillator(k, tau, &C, &S);
+    Vector u = {
+        b->u.x * C + b->du.x * S,
+        b->u.y * C + b->du.y * S
+    };
+    b->du = (Vector) {
+        b->du.x * C - k * b->u.x * S,
+        b->du.y * C - k * b->u.y * S
+    };
+    b->u = u;
+}
+
+// The fictitious time τ after which the physical time dt has passed. t(τ) grows
+// monotonically, so Newton's method is kept inside a bracket that bisection shrinks.
+static double kepler_tau(const Binary *b, double dt) {
+    if (dt == 0) {
+        return 0;
+    }
+    double guess = dt / max(kepler_distance(b, 0), 1e-300);
+    double lo = 0, hi = 0;
+    if (dt > 0) {
+        for (hi = guess; kepler_time(b, hi) < dt; hi *= 2) {
+            lo = hi;
+        }
+    } else {
+        for (lo = guess; kepler_time(b, lo) > dt; lo *= 2) {
+            hi = lo;
+        }
+    }
+
+    double tau = guess;
+    for (int n = 0; n < 100; ++n) {
+        double f = kepler_time(b, tau) - dt;
+        if (fabs(f) <= 1e-15 * fabs(dt)) {
+            break;
+        }
+        if (f > 0) {
+            hi = tau;
+        } else {
+            lo = tau;
+        }
+        double next = tau - f / kepler_distance(b, tau);
+        tau = next > lo && next < hi ? next : (lo + hi) / 2;
+    }
+    return tau;
+}
+
+// The tides of the rest of the system over dτ, with T interpolated to the time of the kick.
+// ### u'' = (E / 2) u + |u|² / 2 ⋅ L(u)ᵀ P,  P = T q
+static void tidal_kick(Binary *b, double dtau, const double *T0, const double *T1, double s) {
+    double T[3] = {
+        (1 - s) * T0[0] + s * T1[0],
+        (1 - s) * T0[1] + s * T1[1],
+        (1 - s) * T0[2] + s * T1[2]
+    };
+    double r = b->u.x * b->u.x + b->u.y * b->u.y;
+    Vector q = { b->u.x * b->u.x - b->u.y * b->u.y, 2 * b->u.x * b->u.y };
+    Vector P = { T[0] * q.x + T[1] * q.y, T[1] * q.x + T[2] * q.y };
+    double f = dtau * r / 2;
+    b->du.x += f * (b->u.x * P.x + b->u.y * P.y);
+    b->du.y += f * (-b->u.y * P.x + b->u.x * P.y);
+    // ### E = (2 |u'|² − μ) / |u|²
+    b->energy = (2 * (b->du.x * b->du.x + b->du.y * b->du.y) - b->mu) / r;
+}
+
+// Advance the relative motion of a binary by the physical time h: kick, exact Kepler
+// drift, kick, a fixed number of times per orbit, then a last drift without kicks
+// that ends exactly at h.
+static long advance_binary(Binary *b, double h, const double *T1, int kicks) {
+    long drifts = 0;
+    double t = 0;
+    while (t < h) {
+        double k = -b->energy / 2;
+        double dtau = k > 0 ? M_PI / sqrt(k) / kicks : kepler_tau(b, h - t) / kicks;
+        if (kepler_time(b, dtau) >= h - t) {
+            dtau = kepler_tau(b, h - t);
+        }
+        tidal_kick(b, dtau / 2, b->tidal0, T1, t / h);
+        t += kepler_time(b, dtau);
+        kepler_drift(b, dtau);
+        tidal_kick(b, dtau / 2, b->tidal0, T1, min(t / h, 1.0));
+        drifts++;
+    }
+    // The kicks changed the orbit a little after the length of the drift was chosen.
+    kepler_drift(b, kepler_tau(b, h - t));
+    return drifts + 1;
+}
+
+double regularized_step(Regularizer *reg, Integrator *ctx, Universe *uni, double t_end, Method method) {
+    reserve(reg, uni->N);
+    find_binaries(reg, uni);
+
+    // Replace every binary by its centre of mass, in the place of its first object.
+    Universe *red = &reg->reduced;
+    red->N = 0;
+    red->t = uni->t;
+    int b = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        int j = reg->partner[i];
+        if (j < 0) {
+            red->p[red->N] = uni->p[i];
+            red->v[red->N] = uni->v[i];
+            red->m[red->N] = uni->m[i];
+        } else if (i < j) {
+            Binary *bin = &reg->binaries[b++];
+            double M = uni->m[i] + uni->m[j];
+            red->p[red->N] = (Vector) {
+                (uni->m[i] * uni->p[i].x + uni->m[j] * uni->p[j].x) / M,
+                (uni->m[i] * uni->p[i].y + uni->m[j] * uni->p[j].y) / M
+            };
+            red->v[red->N] = (Vector) {
+                (uni->m[i] * uni->v[i].x + uni->m[j] * uni->v[j].x) / M,
+                (uni->m[i] * uni->v[i].y + uni->m[j] * uni->v[j].y) / M
+            };
+            red->m[red->N] = M;
+            bin->slot = red->N;
+            to_levi_civita(bin,
+                (Vector) { uni->p[j].x - uni->p[i].x, uni->p[j].y - uni->p[i].y },
+                (Vector) { uni->v[j].x - uni->v[i].x, uni->v[j].y - uni->v[i].y });
+        } else {
+            continue;
+        }
+        red->N++;
+    }
+
+    // The forces kept by the Integrator are only good for the same objects.
+    if (memcmp(reg->partner, reg->previous, uni->N * sizeof(int)) != 0) {
+        integrator_invalidate(ctx);
+        memcpy(reg->previous, reg->partner, uni->N * sizeof(int));
+    }
+
+    for (b = 0; b < reg->count; ++b) {
+        Binary *bin = &reg->binaries[b];
+        tidal_tensor(red, bin->slot, -1, red->p[bin->slot], bin->tidal0);
+    }
+
+    double h = integrate_step(ctx, red, t_end, method);
+    if (h == 0) {
+        return 0;
+    }
+
+    for (b = 0; b < reg->count; ++b) {
+        Binary *bin = &reg->binaries[b];
+        double T1[3];
+        tidal_tensor(red, bin->slot, -1, red->p[bin->slot], T1);
+        reg->kepler_steps += advance_binary(bin, h, T1, reg->kicks);
+        reg->regularized++;
+    }
+
+    // Back to the objects, the binaries around their centres of mass. They come in
+    // the order of their first objects, like the slots.
+    int slot = 0;
+    b = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        int j = reg->partner[i];
+        if (j < 0) {
+            uni->p[i] = red->p[slot];
+            uni->v[i] = red->v[slot];
+            slot++;
+        } else if (i < j) {
+            Binary *bin = &reg->binaries[b++];
+            Vector q, w;
+            from_levi_civita(bin, &q, &w);
+            double M = uni->m[i] + uni->m[j];
+            Vector c = red->p[slot];
+            Vector vc = red->v[slot];
+            uni->p[i] = (Vector) { c.x - uni->m[j] / M * q.x, c.y - uni->m[j] / M * q.y };
+            uni->p[j] = (Vector) { c.x + uni->m[i] / M * q.x, c.y + uni->m[i] / M * q.y };
+            uni->v[i] = (Vector) { vc.x - uni->m[j] / M * w.x, vc.y - uni->m[j] / M * w.y };
+            uni->v[j] = (Vector) { vc.x + uni->m[i] / M * w.x, vc.y + uni->m[i] / M * w.y };
+            slot++;
+        }
+    }
+    uni->t = red->t;
+    return h;
+}
@@ -0,0 +1,52 @@
+#ifndef REGULARIZE_H
+#define REGULARIZE_H
+
+#include "integrate.h"
+
+// One tight binary, integrated in Levi-Civita coordinates during a step. With the
+// relative position q = pⱼ − pᵢ as the complex number u², the Kepler motion in the
+// fictitious time τ, dt = |q| dτ, becomes a harmonic oscillator without the 1/d³
+// singularity, which regularized_step() advances exactly.
+typedef struct Binary {
+    int i, j;           // i < j, the indices in the Universe
+    int slot;           // the index of the centre of mass in the reduced Universe
+    double mu;          // G (mᵢ + mⱼ)
+    double energy;      // of the relative motion per unit of reduced mass
+    Vector u, du;       // Levi-Civita coordinates and their τ derivatives
+    double tidal0[3];   // the tidal tensor xx, xy, yy at the centre of mass at the start of the step
+} Binary;
+
+// Levi-Civita regularization of tight binaries. At the start of every step, pairs
+// of mutual nearest neighbours that are bound and only weakly perturbed are replaced
+// by their centres of mass. The Integrator steps this reduced Universe with the
+// large steps the rest of the system allows, while the relative motion of each pair
+// follows the exact Kepler solution in Levi-Civita coordinates, with the tides of
+// the rest of the system applied as kicks a fixed number of times per orbit.
+typedef struct Regularizer {
+    int cap;
+    Universe reduced;   // single objects and centres of mass of binaries
+    Binary *binaries;
+    int count;          // binaries in the last step
+    int *partner;       // the other object of the binary of every object, or −1
+    int *previous;      // partner in the step before, to notice when it changes
+    double *nearest;    // the squared distance to the nearest neighbour, while searching
+
+    double gamma;       // the largest tidal perturbation, relative to the binary's own force (default 1e-5)
+    int kicks;          // tidal kicks per orbit (default 64)
+
+    long regularized;   // binary steps taken so far
+    long kepler_steps;  // drifts along Kepler orbits so far
+} Regularizer;
+
+Regularizer* create_regularizer(int N);
+
+void destroy_regularizer(Regularizer *reg);
+
+// Take one step like integrate_step(), with tight binaries regularized. The
+// Integrator steps the reduced Universe, so use total_energy() on uni instead of
+// integrator_conserved() to monitor it. The binaries feel the rest of the system to
+// quadrupole order and are seen by it as point masses, and the force within a
+// binary is never softened. Returns the size of the step, or 0 if it failed.
+double regularized_step(Regularizer *reg, Integrator *ctx, Universe *uni, double t_end, Method method);
+
+#endif /* REGULARIZE_H */
@@ -0,0 +1,106 @@
+#include "regularize.h"
+#include "integrate.h"
+#include "gravity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// A tight, eccentric binary in a planetary system, integrated with rkn45 at the
+// same tolerance with and without Levi-Civita regularization. The energy is
+// measured with total_energy() once per day; the semi-major axis of the binary
+// shows whether its orbit stayed accurate.
+// usage: regularize_report [N] [days] [tol] [eccentricity]
+
+
+static long calls = 0;
+
+static void counting_acc(const Universe *uni, Vector *a) {
+    ++calls;
+    acc(uni, a);
+}
+
+static void counting_acc_pot(const Universe *uni, Vector *a, double *pot) {
+    ++calls;
+    acc_pot(uni, a, pot);
+}
+
+// Objects 1 and 2 of a planetary system become a binary of two Earth-like masses
+// with a semi-major axis of 1e7 m, at pericentre, on a circular orbit at 1 AU.
+static Universe* create_system(int N, double e) {
+    const double AU = 1.496e+11;
+    srand(1);
+    Universe *uni = create_planetary_system(N);
+    double m = 3e+24;
+    double a = 1e+7;
+    double mu = G * 2 * m;
+    double speed = sqrt(G * uni->m[0] / AU);
+    double vp = sqrt(mu / a * (1 + e) / (1 - e));
+
+    uni->m[1] = uni->m[2] = m;
+    uni->p[1] = (Vector) { AU - a * (1 - e) / 2, 0 };
+    uni->p[2] = (Vector) { AU + a * (1 - e) / 2, 0 };
+    uni->v[1] = (Vector) { 0, speed - vp / 2 };
+    uni->v[2] = (Vector) { 0, speed + vp / 2 };
+    return uni;
+}
+
+static double semi_major_axis(const Universe *uni) {
+    double dx = uni->p[2].x - uni->p[1].x;
+    double dy = uni->p[2].y - uni->p[1].y;
+    double wx = uni->v[2].x - uni->v[1].x;
+    double wy = uni->v[2].y - uni->v[1].y;
+    double mu = G * (uni->m[1] + uni->m[2]);
+    return -mu / (wx*wx + wy*wy - 2 * mu / sqrt(dx*dx + dy*dy));
+}
+
+static void run(const char *mode, int regularized, int N, double days, double tol, double e) {
+    Universe *uni = create_system(N, e);
+    Integrator *ctx = create_integrator(N);
+    integrator_set_acc(ctx, counting_acc);
+    integrator_set_acc_pot(ctx, counting_acc_pot);
+    ctx->tol = tol;
+    Regularizer *reg = create_regularizer(N);
+    calls = 0;
+
+    double e0 = total_energy(uni);
+    double a0 = semi_major_axis(uni);
+    double worst = 0;
+    long steps = 0;
+    clock_t start = clock();
+    for (double day = 86400; day <= days * 86400; day += 86400) {
+        while (uni->t < day) {
+            double h = regularized
+                ? regularized_step(reg, ctx, uni, day, METHOD_RKN45)
+                : integrate_step(ctx, uni, day, METHOD_RKN45);
+            if (h == 0) {
+                printf("%-12s step size collapsed at day %.1f\n", mode, uni->t / 86400);
+                return;
+            }
+            steps++;
+        }
+        worst = max(worst, fabs((total_energy(uni) - e0) / e0));
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-12s %10ld %12ld %12ld %10.2f %14.3E %12.3E\n", mode, steps, calls, reg->kepler_steps,
+        seconds, worst, fabs(semi_major_axis(uni) - a0) / a0);
+    destroy_regularizer(reg);
+    destroy_integrator(ctx);
+    destroy_universe(uni);
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 50;
+    double days = argc > 2 ? atof(argv[2]) : 30;
+    double tol = argc > 3 ? atof(argv[3]) : 1e-10;
+    double e = argc > 4 ? atof(argv[4]) : 0.9;
+
+    printf("N = %d, %.0f days, tol %.0e, binary eccentricity %.2f\n\n", N, days, tol, e);
+    printf("%-12s %10s %12s %12s %10s %14s %12s\n",
+        "mode", "steps", "acc calls", "kepler", "seconds", "max |ΔE/E|", "|Δa/a|");
+    run("direct", 0, N, days, tol, e);
+    run("regularized", 1, N, days, tol, e);
+    return 0;
+}
@@ -0,0 +1,303 @@
+#include "snapshot.h"
+#include "gravity.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static size_t vector_size(uint32_t flags) {
+    return flags & SNAPSHOT_FLOAT32 ? 2 * sizeof(float) : sizeof(Vector);
+}
+
+static size_t record_size(int64_t N, uint32_t flags) {
+    return sizeof(SnapshotHeader) + N * (2 * vector_size(flags) + sizeof(double));
+}
+
+static void fill_header(SnapshotHeader *header, const Universe *uni, const Integrator *ctx,
+                        int method, uint32_t flags) {
+    memset(header, 0, sizeof(SnapshotHeader));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->flags = flags;
+    header->N = uni->N;
+    header->t = uni->t;
+    header->h = ctx ? ctx->h : 0;
+    header->err_prev = ctx ? ctx->err_prev : 0;
+    header->method = method;
+}
+
+// Write all of buf, retrying short writes.
+static int write_all(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Make a rename in the directory of path durable. Failing that only risks the old
+// name surviving a power loss, so errors are ignored.
+static void sync_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+    int fd = dir ? open(dir, O_RDONLY) : -1;
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// The snapshot goes to a temporary file that replaces path only once it is complete
+// and on disk, so neither a crash nor a power loss while writing a checkpoint destroys
+// the previous one.
+int save_snapshot(const char *path, const Universe *uni, const Integrator *ctx, int method) {
+    size_t length = strlen(path);
+    char *tmp = malloc(length + 5);
+    memcpy(tmp, path, length);
+    memcpy(tmp + length, ".tmp", 5);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
+    }
+
+    SnapshotHeader header;
+    fill_header(&header, uni, ctx, method, 0);
+    int error = write_all(fd, &header, sizeof(header))
+        || write_all(fd, uni->p, uni->N * sizeof(Vector))
+        || write_all(fd, uni->v, uni->N * sizeof(Vector))
+        || write_all(fd, uni->m, uni->N * sizeof(double));
+    // Without the fsync() the rename could reach the disk before the data, and path
+    // would name a truncated file after a power loss.
+    error = error || fsync(fd) != 0;
+    error |= close(fd) != 0;
+    if (!error) {
+        error = rename(tmp, path) != 0;
+    }
+    if (!error) {
+        sync_directory(path);
+    }
+    if (error) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return error ? -1 : 0;
+}
+
+static void read_vectors(Vector *out, const char *data, int64_t N, uint32_t flags) {
+    if (flags & SNAPSHOT_FLOAT32) {
+        const float *f = (const float*)data;
+        for (int64_t i = 0; i < N; ++i) {
+            out[i] = (Vector) { f[2*i], f[2*i + 1] };
+        }
+    } else {
+        memcpy(out, data, N * sizeof(Vector));
+    }
+}
+
+Universe* load_snapshot(const char *path, Integrator *ctx, int *method) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    madvise(data, st.st_size, MADV_WILLNEED);
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SNAPSHOT_VERSION
+        || header.N < 0 || header.N > 0x7fffffff
+        || (size_t)st.st_size < record_size(header.N, header.flags)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    int64_t N = header.N;
+    Universe *uni = calloc(1, sizeof(Universe));
+    uni->N = N;
+    uni->t = header.t;
+    uni->p = malloc(max(N, 1) * sizeof(Vector));
+    uni->v = malloc(max(N, 1) * sizeof(Vector));
+    uni->m = malloc(max(N, 1) * sizeof(double));
+
+    const char *p = data + sizeof(header);
+    read_vectors(uni->p, p, N, header.flags);
+    p += N * vector_size(header.flags);
+    read_vectors(uni->v, p, N, header.flags);
+    p += N * vector_size(header.flags);
+    memcpy(uni->m, p, N * sizeof(double));
+    munmap(data, st.st_size);
+
+    if (ctx) {
+        integrator_resize(ctx, N);
+        ctx->h = header.h;
+        ctx->err_prev = header.err_prev;
+    }
+    if (method) {
+        *method = header.method;
+    }
+    return uni;
+}
+
+struct TrajectoryWriter {
+    int fd;
+    uint32_t flags;
+    int stride;
+    long calls;
+    int failed;
+
+    // write_frame() fills the buffers in turn. A full buffer belongs to the writer
+    // thread until it has been written.
+    char *buffer[2];
+    size_t size[2];
+    size_t cap[2];
+    int full[2];
+    int next;
+    int stopping;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static void* writer_main(void *arg) {
+    TrajectoryWriter *w = arg;
+    int k = 0;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->full[k] && !w->stopping) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (!w->full[k]) {
+            break;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        int error = write_all(w->fd, w->buffer[k], w->size[k]);
+
+        pthread_mutex_lock(&w->lock);
+        w->failed |= error;
+        w->full[k] = 0;
+        pthread_cond_broadcast(&w->changed);
+        k ^= 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+TrajectoryWriter* open_trajectory(const char *path, uint32_t flags, int stride) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    TrajectoryWriter *w = calloc(1, sizeof(TrajectoryWriter));
+    w->fd = fd;
+    w->flags = flags;
+    w->stride = max(stride, 1);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        close(fd);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+// Lay out a frame of uni in a buffer, converting to floats if asked to.
+static void pack(TrajectoryWriter *w, int k, const Universe *uni) {
+    size_t size = record_size(uni->N, w->flags);
+    if (size > w->cap[k]) {
+        free(w->buffer[k]);
+        w->buffer[k] = malloc(size);
+        w->cap[k] = size;
+    }
+    w->size[k] = size;
+
+    char *p = w->buffer[k];
+    fill_header((SnapshotHeader*)p, uni, NULL, -1, w->flags);
+    p += sizeof(SnapshotHeader);
+
+    const Vector *vectors[2] = { uni->p, uni->v };
+    for (int a = 0; a < 2; ++a) {
+        if (w->flags & SNAPSHOT_FLOAT32) {
+            float *f = (float*)p;
+            for (int i = 0; i < uni->N; ++i) {
+                f[2*i] = (float)vectors[a][i].x;
+                f[2*i + 1] = (float)vectors[a][i].y;
+            }
+        } else {
+            memcpy(p, vectors[a], uni->N * sizeof(Vector));
+        }
+        p += uni->N * vector_size(w->flags);
+    }
+    memcpy(p, uni->m, uni->N * sizeof(double));
+}
+
+int write_frame(TrajectoryWriter *w, const Universe *uni) {
+    if (w->calls++ % w->stride != 0) {
+        return 0;
+    }
+
+    int k = w->next;
+    pthread_mutex_lock(&w->lock);
+    while (w->full[k]) {
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+    int failed = w->failed;
+    pthread_mutex_unlock(&w->lock);
+
+    pack(w, k, uni);
+
+    pthread_mutex_lock(&w->lock);
+    w->full[k] = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    w->next ^= 1;
+    return failed ? -1 : 0;
+}
+
+int close_trajectory(TrajectoryWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    w->stopping = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    int failed = w->failed | (close(w->fd) != 0);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    free(w->buffer[0]);
+    free(w->buffer[1]);
+    free(w);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "gravity.h"
+#include "integrate.h"
+
+#include <stdint.h>
+
+// A snapshot file is a 64 byte header followed by the positions, the velocities and
+// the masses of all objects, in native byte order. A trajectory file is a sequence
+// of snapshots, one per frame, so the first frame can be read like any snapshot.
+
+#define SNAPSHOT_MAGIC "NBODYSNP"
+#define SNAPSHOT_VERSION 1
+
+// Positions and velocities are stored as pairs of floats instead of Vectors.
+// Masses are always stored as doubles.
+#define SNAPSHOT_FLOAT32 1
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int64_t N;
+    double t;
+    double h;          // the step size the integrator would take next
+    double err_prev;   // the error of the last accepted step, for the PI controller
+    int32_t method;    // the Method the run uses, or -1
+    uint32_t reserved[3];
+} SnapshotHeader;
+
+_Static_assert(sizeof(SnapshotHeader) == 64, "the snapshot header must be 64 bytes");
+
+// Write the Universe, and the step size control of ctx if not NULL, to path.
+// Continuing from a snapshot with load_snapshot() is bit for bit the same as not
+// stopping at all. Returns 0, or -1 if the file could not be written.
+int save_snapshot(const char *path, const Universe *uni, const Integrator *ctx, int method);
+
+// Read a snapshot into a new Universe, and restore the step size control of ctx if
+// not NULL and the method if not NULL. The file is mapped into memory instead of
+// read through a buffer. Returns NULL if the file is missing or not a snapshot.
+Universe* load_snapshot(const char *path, Integrator *ctx, int *method);
+
+typedef struct TrajectoryWriter TrajectoryWriter;
+
+// Start a trajectory file with a writer thread. Every stride-th call of write_frame()
+// is stored, with the given flags. Returns NULL if the file could not be created.
+TrajectoryWriter* open_trajectory(const char *path, uint32_t flags, int stride);
+
+// Copy the Universe into a frame buffer and return; the writer thread writes it
+// while the simulation goes on. There are two buffers, so this only waits when the
+// disk falls more than a frame behind. Returns -1 if an earlier write failed.
+int write_frame(TrajectoryWriter *w, const Universe *uni);
+
+// Write the last frame and close the file. Returns 0, or -1 if any write failed.
+int close_trajectory(TrajectoryWriter *w);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,248 @@
+#include "soa.h"
+#include "gravity.h"
+#include "stats.h"
+#include "vmath.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int padded(int N) {
+    return (N + SOA_WIDTH - 1) / SOA_WIDTH * SOA_WIDTH;
+}
+
+static double* alloc_aligned(int cap) {
+    // aligned_alloc doesn't like a size of 0.
+    size_t size = max(cap, SOA_WIDTH) * sizeof(double);
+    double *p = aligned_alloc(SOA_ALIGN, size);
+    memset(p, 0, size);
+    return p;
+}
+
+static double* realloc_aligned(double *old, int old_cap, int cap) {
+    double *p = alloc_aligned(cap);
+    memcpy(p, old, min(old_cap, cap) * sizeof(double));
+    free(old);
+    return p;
+}
+
+UniverseSoA* create_universe_soa(int N) {
+    UniverseSoA *soa = calloc(1, sizeof(UniverseSoA));
+    soa->N = N;
+    soa->cap = padded(N);
+    soa->x = alloc_aligned(soa->cap);
+    soa->y = alloc_aligned(soa->cap);
+    soa->vx = alloc_aligned(soa->cap);
+    soa->vy = alloc_aligned(soa->cap);
+    soa->m = alloc_aligned(soa->cap);
+    return soa;
+}
+
+void destroy_universe_soa(UniverseSoA *soa) {
+    free(soa->x);
+    free(soa->y);
+    free(soa->vx);
+    free(soa->vy);
+    free(soa->m);
+    free(soa);
+}
+
+void resize_universe_soa(UniverseSoA *soa, int N) {
+    int cap = padded(N);
+    if (cap != soa->cap) {
+        soa->x = realloc_aligned(soa->x, soa->cap, cap);
+        soa->y = realloc_aligned(soa->y, soa->cap, cap);
+        soa->vx = realloc_aligned(soa->vx, soa->cap, cap);
+        soa->vy = realloc_aligned(soa->vy, soa->cap, cap);
+        soa->m = realloc_aligned(soa->m, soa->cap, cap);
+        soa->cap = cap;
+    }
+
+    // Keep the padding massless.
+    for (int i = N; i < soa->cap; ++i) {
+        soa->x[i] = soa->y[i] = soa->vx[i] = soa->vy[i] = soa->m[i] = 0;
+    }
+    soa->N = N;
+}
+
+void universe_to_soa(const Universe *uni, UniverseSoA *soa) {
+    if (soa->N != uni->N) {
+        resize_universe_soa(soa, uni->N);
+    }
+    for (int i = 0; i < uni->N; ++i) {
+        soa->x[i] = uni->p[i].x;
+        soa->y[i] = uni->p[i].y;
+        soa->vx[i] = uni->v[i].x;
+        soa->vy[i] = uni->v[i].y;
+        soa->m[i] = uni->m[i];
+    }
+}
+
+void soa_to_universe(const UniverseSoA *soa, Universe *uni) {
+    for (int i = 0; i < soa->N; ++i) {
+        uni->p[i] = (Vector) { soa->x[i], soa->y[i] };
+        uni->v[i] = (Vector) { soa->vx[i], soa->vy[i] };
+        uni->m[i] = soa->m[i];
+    }
+}
+
+// All kernels below compute the full N² sum instead of using aᵢⱼ = −aⱼᵢ like acc().
+// That doubles the flops, but removes the scattered writes to aⱼ so every lane is independent.
+// Pairs with d = 0 (the object itself and the padding at the origin) are masked out
+// before the softening is added.
+
+static void acc_soa_scalar(const UniverseSoA *soa, double *ax, double *ay) {
+    double eps2 = get_softening() * get_softening();
+    for (int i = 0; i < soa->N; ++i) {
+        double sx = 0;
+        double sy = 0;
+        for (int j = 0; j < soa->N; ++j) {
+            double dx = soa->x[j] - soa->x[i];
+            double dy = soa->y[j] - soa->y[i];
+            double r2 = dx*dx + dy*dy;
+            if (r2 == 0) {
+                continue;
+            }
+            double d3 = 1.0 / sqrt(r2 + eps2);
+            d3 = d3 * d3 * d3;
+
+            sx += d3 * soa->m[j] * dx;
+            sy += d3 * soa->m[j] * dy;
+        }
+        ax[i] = G * sx;
+        ay[i] = G * sy;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void acc_soa_avx2(const UniverseSoA *soa, double *ax, double *ay) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d eps2 = _mm256_set1_pd(get_softening() * get_softening());
+
+    for (int i = 0; i < soa->N; ++i) {
+        __m256d xi = _mm256_set1_pd(soa->x[i]);
+        __m256d yi = _mm256_set1_pd(soa->y[i]);
+        __m256d sx = zero;
+        __m256d sy = zero;
+
+        for (int j = 0; j < soa->cap; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_load_pd(soa->x + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_load_pd(soa->y + j), yi);
+            __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+            __m256d d1 = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(r2, eps2)));
+            __m256d d3 = _mm256_mul_pd(_mm256_mul_pd(d1, d1), d1);
+            __m256d w = _mm256_mul_pd(d3, _mm256_load_pd(soa->m + j));
+            w = _mm256_and_pd(w, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+
+            sx = _mm256_fmadd_pd(w, dx, sx);
+            sy = _mm256_fmadd_pd(w, dy, sy);
+        }
+
+        double bx[4], by[4];
+        _mm256_storeu_pd(bx, sx);
+        _mm256_storeu_pd(by, sy);
+        ax[i] = G * ((bx[0] + bx[1]) + (bx[2] + bx[3]));
+        ay[i] = G * ((by[0] + by[1]) + (by[2] + by[3]));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void acc_soa_avx512(const UniverseSoA *soa, double *ax, double *ay) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d three = _mm512_set1_pd(3.0);
+    const __m512d eps2 = _mm512_set1_pd(get_softening() * get_softening());
+
+    for (int i = 0; i < soa->N; ++i) {
+        __m512d xi = _mm512_set1_pd(soa->x[i]);
+        __m512d yi = _mm512_set1_pd(soa->y[i]);
+        __m512d sx = zero;
+        __m512d sy = zero;
+
+        for (int j = 0; j < soa->cap; j += 8) {
+            __m512d dx = _mm512_sub_pd(_mm512_load_pd(soa->x + j), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_load_pd(soa->y + j), yi);
+            __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+            __mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+            r2 = _mm512_add_pd(r2, eps2);
+            // 14-bit estimate, refined twice with Newton's method: d ← d ⋅ (3 − r² ⋅ d²) / 2.
+            __m512d d1 = _mm512_rsqrt14_pd(r2);
+            d1 = _mm512_mul_pd(_mm512_mul_pd(half, d1), _mm512_fnmadd_pd(_mm512_mul_pd(r2, d1), d1, three));
+            d1 = _mm512_mul_pd(_mm512_mul_pd(half, d1), _mm512_fnmadd_pd(_mm512_mul_pd(r2, d1), d1, three));
+            __m512d d3 = _mm512_mul_pd(_mm512_mul_pd(d1, d1), d1);
+            __m512d w = _mm512_maskz_mul_pd(nonzero, d3, _mm512_load_pd(soa->m + j));
+
+            sx = _mm512_fmadd_pd(w, dx, sx);
+            sy = _mm512_fmadd_pd(w, dy, sy);
+        }
+
+        ax[i] = G * _mm512_reduce_add_pd(sx);
+        ay[i] = G * _mm512_reduce_add_pd(sy);
+    }
+}
+
+typedef void (*acc_soa_fn)(const UniverseSoA *soa, double *ax, double *ay);
+
+static acc_soa_fn kernel = NULL;
+static const char *kernel_name = NULL;
+
+static void select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel = acc_soa_avx512;
+        kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        kernel = acc_soa_avx2;
+        kernel_name = "avx2";
+    } else {
+        kernel = acc_soa_scalar;
+        kernel_name = "scalar";
+    }
+}
+
+const char* acc_soa_path(void) {
+    if (NULL == kernel) {
+        select_kernel();
+    }
+    return kernel_name;
+}
+
+void acc_soa(const UniverseSoA *soa, double *ax, double *ay) {
+    if (NULL == kernel) {
+        select_kernel();
+    }
+    kernel(soa, ax, ay);
+
+    for (int i = soa->N; i < soa->cap; ++i) {
+        ax[i] = ay[i] = 0;
+    }
+}
+
+static UniverseSoA *scratch = NULL;
+static double *scratch_ax = NULL;
+static double *scratch_ay = NULL;
+static int scratch_cap = 0;
+
+void acc_vectorized(const Universe *uni, Vector *a) {
+    STATS_KERNEL(STATS_VECTORIZED, (long)uni->N * (uni->N - 1) / 2);
+    if (NULL == scratch) {
+        scratch = create_universe_soa(uni->N);
+    }
+    universe_to_soa(uni, scratch);
+
+    if (scratch->cap != scratch_cap) {
+        free(scratch_ax);
+        free(scratch_ay);
+        scratch_cap = scratch->cap;
+        scratch_ax = alloc_aligned(scratch_cap);
+        scratch_ay = alloc_aligned(scratch_cap);
+    }
+
+    acc_soa(scratch, scratch_ax, scratch_ay);
+    for (int i = 0; i < uni->N; ++i) {
+        a[i] = (Vector) { scratch_ax[i], scratch_ay[i] };
+    }
+}
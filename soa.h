@@ -0,0 +1,44 @@
+#ifndef SOA_H
+#define SOA_H
+
+#include "gravity.h"
+
+// Arrays are padded to a multiple of SOA_WIDTH doubles (one 512-bit register)
+// and aligned to SOA_ALIGN bytes. Padding entries have zero mass.
+#define SOA_WIDTH 8
+#define SOA_ALIGN 64
+
+// Structure-of-arrays version of Universe, for the vectorized kernels.
+typedef struct UniverseSoA {
+    int N;
+    int cap;  // padded length of every array
+    double *x;
+    double *y;
+    double *vx;
+    double *vy;
+    double *m;
+} UniverseSoA;
+
+UniverseSoA* create_universe_soa(int N);
+
+void destroy_universe_soa(UniverseSoA *soa);
+
+// Grow or shrink the arrays, keeping the first min(N, soa->N) objects.
+void resize_universe_soa(UniverseSoA *soa, int N);
+
+void universe_to_soa(const Universe *uni, UniverseSoA *soa);
+
+void soa_to_universe(const UniverseSoA *soa, Universe *uni);
+
+// The name of the kernel acc_soa() dispatches to: "avx512", "avx2" or "scalar".
+const char* acc_soa_path(void);
+
+// Calculate the accelerations of the objects in a UniverseSoA. ax and ay must hold soa->cap doubles.
+// Every path sums the same terms in a different order than acc(), so the results agree
+// with acc() up to rounding: |Δaᵢ| ≤ 1e-13 ⋅ G ∑ⱼ |mⱼ| / d(pⱼ, pᵢ)².
+void acc_soa(const UniverseSoA *soa, double *ax, double *ay);
+
+// Same contract as acc(), going through a cached UniverseSoA.
+void acc_vectorized(const Universe *uni, Vector *a);
+
+#endif /* SOA_H */
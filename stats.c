@@ -0,0 +1,349 @@
+#include "stats.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *kernel_names[STATS_KERNELS] = {
+    [STATS_DIRECT]      = "direct",
+    [STATS_DIRECT_POT]  = "direct_pot",
+    [STATS_DIRECT_JERK] = "direct_jerk",
+    [STATS_PARTIAL]     = "partial",
+    [STATS_PARALLEL]    = "parallel",
+    [STATS_VECTORIZED]  = "vectorized",
+    [STATS_MIXED]       = "mixed",
+    [STATS_BARNES_HUT]  = "barnes_hut",
+    [STATS_FMM]         = "fmm",
+    [STATS_PM]          = "pm",
+    [STATS_NEIGHBOUR]   = "neighbour",
+};
+
+const char* stats_kernel_name(StatsKernel kernel) {
+    return kernel_names[kernel];
+}
+
+static _Atomic double energy_error = 0;
+static _Atomic double energy_error_max = 0;
+
+void stats_energy(double relative_error) {
+    atomic_store_explicit(&energy_error, relative_error, memory_order_relaxed);
+    double largest = atomic_load_explicit(&energy_error_max, memory_order_relaxed);
+    while (fabs(relative_error) > largest &&
+           !atomic_compare_exchange_weak(&energy_error_max, &largest, fabs(relative_error))) {
+    }
+}
+
+#ifdef GRAVITY_NO_STATS
+
+void stats_read(Stats *stats) {
+    memset(stats, 0, sizeof(Stats));
+    stats->energy_error = energy_error;
+    stats->energy_error_max = energy_error_max;
+}
+
+void stats_reset(void) {
+    energy_error = energy_error_max = 0;
+}
+
+#else
+
+_Thread_local StatsBlock *stats_local = NULL;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The counters of all blocks added up, in ticks.
+typedef struct Totals {
+    long calls[STATS_KERNELS];
+    long ticks[STATS_KERNELS];
+    long pairs;
+    long accepted;
+    long rejected;
+    long step_sizes[STATS_BUCKETS];
+    double step_size_sum;
+    long step_ticks;
+    long stage_ticks;
+} Totals;
+
+// All blocks ever registered. Blocks of threads that exited stay, with their counts.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static StatsBlock *blocks = NULL;
+
+// The time stamp counter and the clock at the first registration, to convert ticks to seconds.
+static unsigned long long start_ticks;
+static double start_time;
+static double reset_time;
+
+// The totals at the last stats_reset().
+static Totals base;
+
+StatsBlock* stats_register(void) {
+    StatsBlock *b = calloc(1, sizeof(StatsBlock));
+    pthread_mutex_lock(&lock);
+    if (NULL == blocks) {
+        start_ticks = stats_ticks();
+        start_time = reset_time = now();
+    }
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&lock);
+    stats_local = b;
+    return b;
+}
+
+#define LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+
+// The caller holds the lock.
+static void sum_blocks(Totals *sum) {
+    memset(sum, 0, sizeof(Totals));
+    for (StatsBlock *b = blocks; b; b = b->next) {
+        for (int k = 0; k < STATS_KERNELS; ++k) {
+            sum->calls[k] += LOAD(b->calls[k]);
+            sum->ticks[k] += LOAD(b->ticks[k]);
+        }
+        for (int k = 0; k < STATS_BUCKETS; ++k) {
+            sum->step_sizes[k] += LOAD(b->step_sizes[k]);
+        }
+        sum->pairs += LOAD(b->pairs);
+        sum->accepted += LOAD(b->accepted);
+        sum->rejected += LOAD(b->rejected);
+        sum->step_size_sum += LOAD(b->step_size_sum);
+        sum->step_ticks += LOAD(b->step_ticks);
+        sum->stage_ticks += LOAD(b->stage_ticks);
+    }
+}
+
+// Seconds per tick, measured against the clock since the first registration.
+static double tick_seconds(void) {
+    if (NULL == blocks) {
+        return 0;
+    }
+    double t = now();
+    // Too short a baseline gives a poor estimate; stats_read() is rare enough to wait.
+    while (t - start_time < 0.01) {
+        t = now();
+    }
+    unsigned long long ticks = stats_ticks();
+    return (t - start_time) / (double)(ticks - start_ticks);
+}
+
+void stats_read(Stats *stats) {
+    Totals sum;
+    memset(stats, 0, sizeof(Stats));
+
+    pthread_mutex_lock(&lock);
+    sum_blocks(&sum);
+    double seconds_per_tick = tick_seconds();
+    stats->seconds = blocks ? now() - reset_time : 0;
+
+    for (int k = 0; k < STATS_KERNELS; ++k) {
+        stats->kernel_calls[k] = sum.calls[k] - base.calls[k];
+        stats->kernel_seconds[k] = (sum.ticks[k] - base.ticks[k]) * seconds_per_tick;
+        stats->acc_calls += stats->kernel_calls[k];
+    }
+    for (int k = 0; k < STATS_BUCKETS; ++k) {
+        stats->step_sizes[k] = sum.step_sizes[k] - base.step_sizes[k];
+    }
+    stats->pairs = sum.pairs - base.pairs;
+    stats->accepted = sum.accepted - base.accepted;
+    stats->rejected = sum.rejected - base.rejected;
+    stats->step_size_sum = sum.step_size_sum - base.step_size_sum;
+    stats->step_seconds = (sum.step_ticks - base.step_ticks) * seconds_per_tick;
+    stats->stage_seconds = (sum.stage_ticks - base.stage_ticks) * seconds_per_tick;
+    pthread_mutex_unlock(&lock);
+
+    stats->energy_error = energy_error;
+    stats->energy_error_max = energy_error_max;
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&lock);
+    sum_blocks(&base);
+    reset_time = now();
+    pthread_mutex_unlock(&lock);
+    energy_error = energy_error_max = 0;
+}
+
+#endif /* GRAVITY_NO_STATS */
+
+// The upper end of step size bucket b, in seconds.
+static double bucket_end(int b) {
+    return ldexp(1, b - 31);
+}
+
+static void write_json(FILE *f, const Stats *s) {
+    fprintf(f, "{\n  \"seconds\": %.6f,\n  \"acc_calls\": %ld,\n  \"pairs\": %ld,\n",
+        s->seconds, s->acc_calls, s->pairs);
+    fprintf(f, "  \"kernels\": {");
+    int first = 1;
+    for (int k = 0; k < STATS_KERNELS; ++k) {
+        if (s->kernel_calls[k] == 0) {
+            continue;
+        }
+        fprintf(f, "%s\n    \"%s\": {\"calls\": %ld, \"seconds\": %.6g}", first ? "" : ",",
+            kernel_names[k], s->kernel_calls[k], s->kernel_seconds[k]);
+        first = 0;
+    }
+    fprintf(f, "%s},\n", first ? "" : "\n  ");
+    fprintf(f, "  \"accepted\": %ld,\n  \"rejected\": %ld,\n", s->accepted, s->rejected);
+    fprintf(f, "  \"step_seconds\": %.6g,\n  \"stage_seconds\": %.6g,\n", s->step_seconds, s->stage_seconds);
+    fprintf(f, "  \"step_size_sum\": %.17g,\n", s->step_size_sum);
+
+    // The non-empty buckets of the histogram, as [upper end, count].
+    fprintf(f, "  \"step_sizes\": [");
+    first = 1;
+    for (int b = 0; b < STATS_BUCKETS; ++b) {
+        if (s->step_sizes[b] == 0) {
+            continue;
+        }
+        if (b == STATS_BUCKETS - 1) {
+            fprintf(f, "%s[null, %ld]", first ? "" : ", ", s->step_sizes[b]);
+        } else {
+            fprintf(f, "%s[%.17g, %ld]", first ? "" : ", ", bucket_end(b), s->step_sizes[b]);
+        }
+        first = 0;
+    }
+    fprintf(f, "],\n");
+    fprintf(f, "  \"energy_error\": %.6e,\n  \"energy_error_max\": %.6e\n}\n",
+        s->energy_error, s->energy_error_max);
+}
+
+static void write_prometheus(FILE *f, const Stats *s) {
+    fprintf(f, "# HELP gravity_acc_calls_total Calls of the force kernels.\n");
+    fprintf(f, "# TYPE gravity_acc_calls_total counter\n");
+    for (int k = 0; k < STATS_KERNELS; ++k) {
+        fprintf(f, "gravity_acc_calls_total{kernel=\"%s\"} %ld\n", kernel_names[k], s->kernel_calls[k]);
+    }
+    fprintf(f, "# HELP gravity_kernel_seconds_total Wall time in the force kernels.\n");
+    fprintf(f, "# TYPE gravity_kernel_seconds_total counter\n");
+    for (int k = 0; k < STATS_KERNELS; ++k) {
+        fprintf(f, "gravity_kernel_seconds_total{kernel=\"%s\"} %.9g\n", kernel_names[k], s->kernel_seconds[k]);
+    }
+    fprintf(f, "# HELP gravity_pair_interactions_total Pair terms summed by the direct kernels.\n");
+    fprintf(f, "# TYPE gravity_pair_interactions_total counter\n");
+    fprintf(f, "gravity_pair_interactions_total %ld\n", s->pairs);
+    fprintf(f, "# HELP gravity_steps_total Steps of integrate_step().\n");
+    fprintf(f, "# TYPE gravity_steps_total counter\n");
+    fprintf(f, "gravity_steps_total{result=\"accepted\"} %ld\n", s->accepted);
+    fprintf(f, "gravity_steps_total{result=\"rejected\"} %ld\n", s->rejected);
+    fprintf(f, "# HELP gravity_step_seconds_total Wall time in integrate_step().\n");
+    fprintf(f, "# TYPE gravity_step_seconds_total counter\n");
+    fprintf(f, "gravity_step_seconds_total %.9g\n", s->step_seconds);
+    fprintf(f, "# HELP gravity_stage_seconds_total Wall time in integrate_step() outside the force kernels.\n");
+    fprintf(f, "# TYPE gravity_stage_seconds_total counter\n");
+    fprintf(f, "gravity_stage_seconds_total %.9g\n", s->stage_seconds);
+
+    fprintf(f, "# HELP gravity_step_size_seconds Simulated time per accepted step.\n");
+    fprintf(f, "# TYPE gravity_step_size_seconds histogram\n");
+    long count = 0;
+    for (int b = 0; b < STATS_BUCKETS - 1; ++b) {
+        count += s->step_sizes[b];
+        fprintf(f, "gravity_step_size_seconds_bucket{le=\"%.17g\"} %ld\n", bucket_end(b), count);
+    }
+    count += s->step_sizes[STATS_BUCKETS - 1];
+    fprintf(f, "gravity_step_size_seconds_bucket{le=\"+Inf\"} %ld\n", count);
+    fprintf(f, "gravity_step_size_seconds_sum %.17g\n", s->step_size_sum);
+    fprintf(f, "gravity_step_size_seconds_count %ld\n", count);
+
+    fprintf(f, "# HELP gravity_energy_error The last relative energy error.\n");
+    fprintf(f, "# TYPE gravity_energy_error gauge\n");
+    fprintf(f, "gravity_energy_error %.9g\n", s->energy_error);
+    fprintf(f, "# HELP gravity_energy_error_max The largest magnitude of the relative energy error.\n");
+    fprintf(f, "# TYPE gravity_energy_error_max gauge\n");
+    fprintf(f, "gravity_energy_error_max %.9g\n", s->energy_error_max);
+}
+
+int stats_write(FILE *f, StatsFormat format) {
+    Stats s;
+    stats_read(&s);
+    if (format == STATS_PROMETHEUS) {
+        write_prometheus(f, &s);
+    } else {
+        write_json(f, &s);
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+static struct {
+    char *path;
+    char *tmp;
+    double interval;
+    StatsFormat format;
+    int running;
+    int stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t stop;
+} dump = { .lock = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER };
+
+static void dump_once(void) {
+    FILE *f = fopen(dump.tmp, "w");
+    if (NULL == f) {
+        return;
+    }
+    int error = stats_write(f, dump.format);
+    error |= fclose(f);
+    if (error) {
+        remove(dump.tmp);
+    } else {
+        rename(dump.tmp, dump.path);
+    }
+}
+
+static void* dump_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&dump.lock);
+    while (!dump.stopping) {
+        pthread_mutex_unlock(&dump.lock);
+        dump_once();
+        pthread_mutex_lock(&dump.lock);
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        double t = until.tv_nsec * 1e-9 + dump.interval;
+        until.tv_sec += (time_t)t;
+        until.tv_nsec = (long)((t - floor(t)) * 1e+9);
+        while (!dump.stopping && pthread_cond_timedwait(&dump.stop, &dump.lock, &until) == 0) {
+        }
+    }
+    pthread_mutex_unlock(&dump.lock);
+    dump_once();
+    return NULL;
+}
+
+int stats_start_dump(const char *path, double interval, StatsFormat format) {
+    stats_stop_dump();
+    dump.path = strdup(path);
+    dump.tmp = malloc(strlen(path) + 5);
+    sprintf(dump.tmp, "%s.tmp", path);
+    dump.interval = interval;
+    dump.format = format;
+    dump.stopping = 0;
+    if (pthread_create(&dump.thread, NULL, dump_main, NULL) != 0) {
+        free(dump.path);
+        free(dump.tmp);
+        return -1;
+    }
+    dump.running = 1;
+    return 0;
+}
+
+void stats_stop_dump(void) {
+    if (!dump.running) {
+        return;
+    }
+    pthread_mutex_lock(&dump.lock);
+    dump.stopping = 1;
+    pthread_cond_broadcast(&dump.stop);
+    pthread_mutex_unlock(&dump.lock);
+    pthread_join(dump.thread, NULL);
+    dump.running = 0;
+    free(dump.path);
+    free(dump.tmp);
+}
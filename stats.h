@@ -0,0 +1,255 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+// Counters and timers of the force kernels and of integrate_step(), cheap enough to
+// leave on in production runs. Every thread counts into a block of its own, so the
+// counting takes no lock and no atomic read-modify-write; stats_read() adds up the
+// blocks. Time is taken from the time stamp counter. Short steps and kernel calls are
+// only timed every STATS_SAMPLE-th time, and the time of such a sample counts for all
+// the calls since the last one.
+//
+// Build with -DGRAVITY_NO_STATS to compile the instrumentation out. The functions
+// below still exist and report zeros.
+
+// The instrumented force calculations. A kernel that calls another one, like
+// acc_parallel() calling acc() for small N, counts as the outer one only.
+typedef enum StatsKernel {
+    STATS_DIRECT,       // acc()
+    STATS_DIRECT_POT,   // acc_pot()
+    STATS_DIRECT_JERK,  // acc_jerk()
+    STATS_PARTIAL,      // acc_partial()
+    STATS_PARALLEL,     // acc_parallel()
+    STATS_VECTORIZED,   // acc_vectorized()
+    STATS_MIXED,        // acc_mixed()
+    STATS_BARNES_HUT,   // acc_barnes_hut()
+    STATS_FMM,          // acc_fmm(), acc_pot_fmm()
+    STATS_PM,           // acc_pm(), acc_pot_pm()
+    STATS_NEIGHBOUR,    // acc_neighbour()
+    STATS_KERNELS
+} StatsKernel;
+
+// The step size histogram has a bucket per power of 2: bucket b counts the accepted
+// steps with 2^(b − 32) ≤ h < 2^(b − 31) seconds. The first and last bucket also
+// count the steps below and above.
+#define STATS_BUCKETS 64
+
+// Short steps and kernel calls are timed once per this many.
+#define STATS_SAMPLE 64
+
+// Steps and kernel calls that take more ticks than this are timed every time.
+#define STATS_LONG (1 << 16)
+
+typedef struct Stats {
+    long kernel_calls[STATS_KERNELS];
+    double kernel_seconds[STATS_KERNELS];
+    long acc_calls;          // the sum of kernel_calls
+    long pairs;              // pair terms summed by the direct kernels; the tree and mesh methods add none
+    long accepted;           // steps of integrate_step()
+    long rejected;
+    long step_sizes[STATS_BUCKETS];
+    double step_size_sum;    // of the accepted steps, in simulated seconds
+    double step_seconds;     // wall time in integrate_step()
+    double stage_seconds;    // of which outside the force kernels: stage updates, error norm, copies
+    double energy_error;     // the last value given to stats_energy()
+    double energy_error_max; // the largest magnitude given to stats_energy()
+    double seconds;          // since the first counted event or stats_reset()
+} Stats;
+
+typedef enum StatsFormat {
+    STATS_JSON,
+    STATS_PROMETHEUS,   // the text exposition format, e.g. for the textfile collector of node_exporter
+} StatsFormat;
+
+// Add up the counters of all threads, since the last stats_reset().
+void stats_read(Stats *stats);
+
+// Start counting from 0 again.
+void stats_reset(void);
+
+// Record the relative energy error of the running simulation, e.g. from integrator_conserved().
+void stats_energy(double relative_error);
+
+// Write the counters in the given format. Returns 0, or -1 if writing failed.
+int stats_write(FILE *f, StatsFormat format);
+
+// Rewrite the file at path every interval seconds from a thread of its own, by
+// writing a new file and renaming it over the old one, so that readers never see
+// half a file. Returns 0, or -1 if the thread could not be started.
+int stats_start_dump(const char *path, double interval, StatsFormat format);
+
+// Write the file a last time and stop the thread of stats_start_dump().
+void stats_stop_dump(void);
+
+const char* stats_kernel_name(StatsKernel kernel);
+
+// The instrumentation, used by the kernels and integrate_step():
+//     STATS_KERNEL(kernel, pairs);  at the top of a kernel, counts the call and times it
+//     STATS_STEP();                 at the top of integrate_step(), times the step
+//     stats_accepted(h), stats_rejected()
+
+#ifdef GRAVITY_NO_STATS
+
+#define STATS_KERNEL(kernel, pairs) ((void)0)
+#define STATS_STEP() ((void)0)
+
+static inline void stats_accepted(double h) {
+    (void)h;
+}
+
+static inline void stats_rejected(void) {
+}
+
+#else
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline unsigned long long stats_ticks(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+static inline unsigned long long stats_ticks(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+#endif
+
+// The counters of one thread. Only the thread itself writes them, with relaxed
+// atomic stores, so that stats_read() can read them at any time.
+typedef struct StatsBlock {
+    _Atomic long calls[STATS_KERNELS];
+    _Atomic long ticks[STATS_KERNELS];
+    _Atomic long pairs;
+    _Atomic long accepted;
+    _Atomic long rejected;
+    _Atomic long step_sizes[STATS_BUCKETS];
+    _Atomic double step_size_sum;
+    _Atomic long step_ticks;
+    _Atomic long stage_ticks;
+
+    // Private to the thread.
+    int depth;          // of nested kernel calls
+    int in_step;
+    long step_weight;   // while in a timed step: the number of steps it stands for
+    long inside;        // ticks of the kernel calls in the timed step
+    long kernel_since, kernel_period;
+    long step_since, step_period;
+    struct StatsBlock *next;
+} StatsBlock;
+
+extern _Thread_local StatsBlock *stats_local;
+
+// Allocate the block of the calling thread.
+StatsBlock* stats_register(void);
+
+typedef struct StatsScope {
+    StatsBlock *block;
+    int kernel;                // -1 for a nested kernel call
+    long weight;               // 0 if not timed
+    unsigned long long start;
+} StatsScope;
+
+static inline void stats_add(_Atomic long *counter, long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static inline StatsBlock* stats_block(void) {
+    StatsBlock *b = stats_local;
+    return b ? b : stats_register();
+}
+
+static inline StatsScope stats_kernel_begin(StatsKernel kernel, long pairs) {
+    StatsBlock *b = stats_block();
+    StatsScope s = { b, kernel, 0, 0 };
+    if (b->depth++ > 0) {
+        s.kernel = -1;
+        return s;
+    }
+    stats_add(&b->calls[kernel], 1);
+    stats_add(&b->pairs, pairs);
+
+    // Within a step, the kernels are timed along with the step.
+    if (b->in_step) {
+        s.weight = b->step_weight;
+    } else if (++b->kernel_since >= b->kernel_period) {
+        s.weight = b->kernel_since;
+        b->kernel_since = 0;
+    }
+    if (s.weight) {
+        s.start = stats_ticks();
+    }
+    return s;
+}
+
+static inline void stats_kernel_end(StatsScope *s) {
+    StatsBlock *b = s->block;
+    --b->depth;
+    if (s->kernel < 0 || !s->weight) {
+        return;
+    }
+    long t = stats_ticks() - s->start;
+    stats_add(&b->ticks[s->kernel], t * s->weight);
+    if (b->in_step) {
+        b->inside += t;
+    } else {
+        b->kernel_period = t < STATS_LONG ? STATS_SAMPLE : 1;
+    }
+}
+
+static inline StatsScope stats_step_begin(void) {
+    StatsBlock *b = stats_block();
+    StatsScope s = { b, 0, 0, 0 };
+    b->in_step = 1;
+    if (++b->step_since >= b->step_period) {
+        s.weight = b->step_weight = b->step_since;
+        b->step_since = 0;
+        b->inside = 0;
+        s.start = stats_ticks();
+    }
+    return s;
+}
+
+static inline void stats_step_end(StatsScope *s) {
+    StatsBlock *b = s->block;
+    b->in_step = 0;
+    b->step_weight = 0;
+    if (!s->weight) {
+        return;
+    }
+    long t = stats_ticks() - s->start;
+    stats_add(&b->step_ticks, t * s->weight);
+    stats_add(&b->stage_ticks, (t - b->inside) * s->weight);
+    b->step_period = t < STATS_LONG ? STATS_SAMPLE : 1;
+}
+
+static inline void stats_accepted(double h) {
+    StatsBlock *b = stats_block();
+    stats_add(&b->accepted, 1);
+
+    // The binary exponent of h picks the bucket.
+    union { double d; unsigned long long u; } bits = { h };
+    int e = (int)((bits.u >> 52) & 0x7ff) - 1023;
+    int bucket = e + 32 < 0 ? 0 : e + 32 >= STATS_BUCKETS ? STATS_BUCKETS - 1 : e + 32;
+    stats_add(&b->step_sizes[bucket], 1);
+    atomic_store_explicit(&b->step_size_sum,
+        atomic_load_explicit(&b->step_size_sum, memory_order_relaxed) + h, memory_order_relaxed);
+}
+
+static inline void stats_rejected(void) {
+    stats_add(&stats_block()->rejected, 1);
+}
+
+#define STATS_KERNEL(kernel, pairs) \
+    StatsScope stats_scope __attribute__((cleanup(stats_kernel_end))) = stats_kernel_begin(kernel, pairs)
+
+#define STATS_STEP() \
+    StatsScope stats_scope __attribute__((cleanup(stats_step_end))) = stats_step_begin()
+
+#endif /* GRAVITY_NO_STATS */
+
+#endif /* STATS_H */
@@ -1,17 +1,195 @@
 #include "steppers.h"
+#include "backend.h"
 #include "gravity.h"
 #include "vmath.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 
+// Buffers start on a 64 byte boundary, so their length is rounded up to 4 Vectors.
+#define BUFFER_ALIGN 64
+#define BUFFER_ROUND (BUFFER_ALIGN / sizeof(Vector))
+
+Integrator* create_integrator(int N) {
+    Integrator *ctx = calloc(1, sizeof(Integrator));
+    ctx->acc = force_backend()->acc;
+    ctx->acc_pot = force_backend()->acc_pot;
+    ctx->acc_jerk = acc_jerk;
+    ctx->tol = 1e-9;
+    ctx->safety = 0.9;
+    ctx->h_min = 0;
+    ctx->h_max = INFINITY;
+    ctx->eta = 0.02;
+    integrator_reserve(ctx, N, STEPPER_BUFFERS);
+    ctx->N = N;
+    return ctx;
+}
+
+void destroy_integrator(Integrator *ctx) {
+    free(ctx->mem);
+    free(ctx->saved);
+    free(ctx);
+}
+
+void integrator_set_acc(Integrator *ctx, acc_fn f) {
+    ctx->acc = f ? f : acc;
+    ctx->acc_pot = ctx->acc == acc ? acc_pot : NULL;
+    integrator_invalidate(ctx);
+}
+
+void integrator_set_backend(Integrator *ctx, const ForceBackend *backend) {
+    ctx->acc = backend->acc;
+    ctx->acc_pot = backend->acc_pot;
+    integrator_invalidate(ctx);
+}
+
+void integrator_set_acc_pot(Integrator *ctx, acc_pot_fn f) {
+    ctx->acc_pot = f;
+    integrator_invalidate(ctx);
+}
+
+void integrator_set_acc_jerk(Integrator *ctx, acc_jerk_fn f) {
+    ctx->acc_jerk = f ? f : acc_jerk;
+    ctx->hermite_valid = 0;
+}
+
+void integrator_reserve(Integrator *ctx, int N, int buffers) {
+    if (N <= ctx->cap && buffers <= ctx->buffers) {
+        return;
+    }
+    int cap = max(N, ctx->cap);
+    cap = (cap + BUFFER_ROUND - 1) / BUFFER_ROUND * BUFFER_ROUND;
+    buffers = max(buffers, ctx->buffers);
+
+    // The buffers only hold scratch data between the stages of one step, so there is nothing to copy.
+    free(ctx->mem);
+    ctx->mem = aligned_alloc(BUFFER_ALIGN, max(cap, 1) * buffers * sizeof(Vector));
+    if (cap != ctx->cap) {
+        // The saved state lives across steps, so it must not move when a stepper needs more buffers.
+        free(ctx->saved);
+        ctx->saved = aligned_alloc(BUFFER_ALIGN, max(cap, 1) * 6 * sizeof(Vector));
+        ctx->fsal = ctx->saved + 2 * cap;
+        ctx->pot = (double*)(ctx->saved + 3 * cap);
+        ctx->hermite = ctx->saved + 4 * cap;
+        ctx->fsal_valid = 0;
+        ctx->pot_valid = 0;
+        ctx->hermite_valid = 0;
+    }
+    ctx->cap = cap;
+    ctx->buffers = buffers;
+}
+
+void integrator_resize(Integrator *ctx, int N) {
+    integrator_reserve(ctx, N, ctx->buffers);
+    ctx->N = N;
+    ctx->fsal_valid = 0;
+    ctx->pot_valid = 0;
+    ctx->hermite_valid = 0;
+}
+
+void integrator_invalidate(Integrator *ctx) {
+    ctx->fsal_valid = 0;
+    ctx->pot_valid = 0;
+    ctx->hermite_valid = 0;
+}
+
+static Vector* buffer(const Integrator *ctx, int k) {
+    return ctx->mem + (size_t)k * ctx->cap;
+}
+
+// Make sure the buffers fit the Universe. This only allocates when it has grown.
+static void prepare(Integrator *ctx, const Universe *uni, int buffers) {
+    if (uni->N != ctx->N || buffers > ctx->buffers) {
+        integrator_reserve(ctx, uni->N, buffers);
+        ctx->fsal_valid &= uni->N == ctx->N;
+        ctx->pot_valid &= uni->N == ctx->N;
+        ctx->hermite_valid &= uni->N == ctx->N;
+        ctx->N = uni->N;
+    }
+}
+
+// The force evaluation at the end of a step, at time t. With ctx->monitor set it keeps
+// the potentials for integrator_conserved().
+static void acc_end(Integrator *ctx, const Universe *uni, Vector *a, double t) {
+    if (ctx->monitor && ctx->acc_pot) {
+        ctx->acc_pot(uni, a, ctx->pot);
+        ctx->pot_t = t;
+        ctx->pot_valid = 1;
+    } else {
+        ctx->acc(uni, a);
+    }
+}
+
+// The accelerations at the current positions. They are kept from the last step
+// (first same as last) as long as the time of the Universe matches.
+static Vector* current_acc(Integrator *ctx, const Universe *uni) {
+    if (!ctx->fsal_valid || ctx->fsal_t != uni->t) {
+        ctx->acc(uni, ctx->fsal);
+        ctx->fsal_t = uni->t;
+        ctx->fsal_valid = 1;
+    }
+    return ctx->fsal;
+}
+
+Conserved integrator_conserved(Integrator *ctx, const Universe *uni) {
+    Conserved c = { 0 };
+    if (uni->N != ctx->N) {
+        integrator_resize(ctx, uni->N);
+    }
 
-void step_euler(Universe *uni, double h) {
+    if (!ctx->pot_valid || ctx->pot_t != uni->t) {
+        if (ctx->acc_pot) {
+            // The accelerations come along, and kick-first steppers can start from them.
+            ctx->acc_pot(uni, ctx->fsal, ctx->pot);
+            ctx->fsal_t = ctx->pot_t = uni->t;
+            ctx->fsal_valid = ctx->pot_valid = 1;
+        } else {
+            c.potential = gravitational_energy(uni);
+        }
+    }
+    if (ctx->pot_valid && ctx->pot_t == uni->t) {
+        // ### Eg = ∑ᵢ mᵢ ⋅ φᵢ / 2
+        for (int i = 0; i < uni->N; ++i) {
+            c.potential += uni->m[i] * ctx->pot[i] / 2;
+        }
+    }
+
+    c.kinetic = kinetic_energy(uni);
+    c.energy = c.kinetic + c.potential;
+    c.momentum = momentum(uni);
+    c.angular_momentum = angular_momentum(uni);
+    return c;
+}
+
+// The largest local position error e = coeff ⋅ |fa − fb| of any object, relative to
+// ctx->tol times the distance the object moved during the step. Bounding the error
+// per unit of distance travelled keeps it independent of the frame and the size of
+// the system. Steps with an error up to 1 are acceptable.
+static double error_norm(const Integrator *ctx, const Universe *uni, const Vector *p0,
+                         const Vector *fa, const Vector *fb, double coeff) {
+    double error = 0;
+    for (int i = 0; i < uni->N; ++i) {
+        double ex = fa[i].x - fb[i].x;
+        double ey = fa[i].y - fb[i].y;
+        double e2 = ex*ex + ey*ey;
+        if (e2 == 0) {
+            continue;
+        }
+        double dx = uni->p[i].x - p0[i].x;
+        double dy = uni->p[i].y - p0[i].y;
+        error = max(error, sqrt(e2 / (dx*dx + dy*dy)));
+    }
+    return fabs(coeff) * error / ctx->tol;
+}
+
+void step_euler(Integrator *ctx, Universe *uni, double h) {
     // v_i += a_i * h
     // x_i += v_i * h
 
-    Vector a[uni->N];
-    acc(uni, a);
+    prepare(ctx, uni, 1);
+    Vector *a = buffer(ctx, 0);
+    ctx->acc(uni, a);
 
     for (int i = 0; i < uni->N; ++i) {
         uni->v[i].x += a[i].x * h;
@@ -20,24 +198,28 @@ void step_euler(Universe *uni, double h) {
         uni->v[i].y += a[i].y * h;
         uni->p[i].y += uni->v[i].y * h;
     }
+    uni->t += h;
 }
 
-void step_rk4(Universe *uni, double h) {
-    Vector k1v[uni->N], k2v[uni->N], k3v[uni->N], k4v[uni->N];
-    Vector k1x[uni->N], k2x[uni->N], k3x[uni->N], k4x[uni->N];
+void step_rk4(Integrator *ctx, Universe *uni, double h) {
+    prepare(ctx, uni, 9);
+    Vector *k1v = buffer(ctx, 0), *k2v = buffer(ctx, 1), *k3v = buffer(ctx, 2), *k4v = buffer(ctx, 3);
+    Vector *k1x = buffer(ctx, 4), *k2x = buffer(ctx, 5), *k3x = buffer(ctx, 6), *k4x = buffer(ctx, 7);
 
-    Vector p[uni->N];
+    Vector *p = buffer(ctx, 8);
     memcpy(p, uni->p, sizeof(Vector) * uni->N);
+    double t = uni->t;
 
     // k1v = acc(uni)
-    acc(uni, k1v);
+    ctx->acc(uni, k1v);
     // k1x = v
     memcpy(k1x, uni->v, sizeof(Vector) * uni->N);
 
     // k2v = acc(uni + k1x * h / 2)
     vmul(uni->p, k1x, h / 2, uni->N);
     vadd(uni->p, uni->p, p, uni->N);
-    acc(uni, k2v);
+    uni->t = t + h / 2;
+    ctx->acc(uni, k2v);
 
     // k2x = v + k1v * h / 2
     vmul(k2x, k1v, h / 2, uni->N);
@@ -46,7 +228,7 @@ void step_rk4(Universe *uni, double h) {
     // k3v = acc(uni + k2x * h / 2)
     vmul(uni->p, k2x, h / 2, uni->N);
     vadd(uni->p, uni->p, p, uni->N);
-    acc(uni, k3v);
+    ctx->acc(uni, k3v);
 
     // k3x = v + k2v * h / 2
     vmul(k3x, k2v, h / 2, uni->N);
@@ -55,7 +237,8 @@ void step_rk4(Universe *uni, double h) {
     // k4v = acc(uni + k3x * h)
     vmul(uni->p, k3x, h, uni->N);
     vadd(uni->p, uni->p, p, uni->N);
-    acc(uni, k4v);
+    uni->t = t + h;
+    ctx->acc(uni, k4v);
 
     // k4x = v + k3v * h
     vmul(k4x, k3v, h, uni->N);
@@ -72,71 +255,21 @@ void step_rk4(Universe *uni, double h) {
     }
 }
 
-double step_rkn45(Universe *uni, double h) {
-    double tol = 1e-12;
-    double safety = 0.5; // 50%
-
-    Vector k0[uni->N], k1[uni->N], k2[uni->N], k3[uni->N], k4[uni->N];
-
-    Vector p[uni->N];
-    memcpy(p, uni->p, sizeof(Vector) * uni->N);
-
-    // k0 = acc(uni)
-    acc(uni, k0);
-
-    // k1 = acc(uni.p + uni.v*h/3 + h*h*k0/18)
-    for (int i = 0; i < uni->N; ++i) {
-        uni->p[i].x = p[i].x + uni->v[i].x * h/3 + k0[i].x * h*h/18;
-        uni->p[i].y = p[i].y + uni->v[i].y * h/3 + k0[i].y * h*h/18;
-    }
-    acc(uni, k1);
-
-    // k2 = acc(uni.p + uni.v * 2/3h + k1 * h*h*2/9)
-    for (int i = 0; i < uni->N; ++i) {
-        uni->p[i].x = p[i].x + uni->v[i].x * h*2/3 + k1[i].x * 2*h*h/9;
-        uni->p[i].y = p[i].y + uni->v[i].y * h*2/3 + k1[i].y * 2*h*h/9;
-    }
-    acc(uni, k2);
-
-    // k3 = acc(uni.p + h*uni.v + h*h*(k0/3 + k2/6))
-    for (int i = 0; i < uni->N; ++i) {
-        uni->p[i].x = p[i].x + uni->v[i].x * h + (k0[i].x * 2 + k2[i].x) * h*h/6;
-        uni->p[i].y = p[i].y + uni->v[i].y * h + (k0[i].y * 2 + k2[i].y) * h*h/6;
-    }
-    acc(uni, k3);
-
-    // uni.p = uni.p + h*uni.v + h*h*(k0*13/120 + k1*3/10 + k2*3/40 + k3/60)
-    for (int i = 0; i < uni->N; ++i) {
-        uni->p[i].x = p[i].x + uni->v[i].x * h + (k0[i].x * 13 + k1[i].x * 36 + k2[i].x * 9 + k3[i].x * 2) * h*h/120;
-        uni->p[i].y = p[i].y + uni->v[i].y * h + (k0[i].y * 13 + k1[i].y * 36 + k2[i].y * 9 + k3[i].y * 2) * h*h/120;
-    }
-    // k4 = acc(uni.p)
-    acc(uni, k4);
-
-    // uni.v = uni.v + (k0 + 3k1 + 3k2 + k3) * h/8
-    for (int i = 0; i < uni->N; ++i) {
-        uni->v[i].x += (k0[i].x + k1[i].x * 3 + k2[i].x * 3 + k3[i].x) * h/8;
-        uni->v[i].y += (k0[i].y + k1[i].y * 3 + k2[i].y * 3 + k3[i].y) * h/8;
-    }
-
-    double error = 0;
-    for (int i = 0; i < uni->N; ++i) {
-        error += distance(k3[i], k4[i]);
-    }
-    error *= h*h/60;
-    return h * pow(tol * safety / error, 0.2);
-}
-
-double step_rkn_tableau(Universe *uni, double h, const NBT_t *tableau) {
-    double tol = 1e-9;
-    double safety = 0.5; // 50%
+// step_rkn45(), step_rkn67() and step_rkn87(), unrolled from their tableaux by gen_rkn.py.
+#include "rkn_generated.inc"
 
+double step_rkn_tableau(Integrator *ctx, Universe *uni, double h, const NBT_t *tableau) {
     int tk = tableau->kappa;
 
-    Vector f[tk + 2][uni->N];
+    prepare(ctx, uni, tk + 2);
+    Vector *p = buffer(ctx, 0);
+    Vector *f[tk + 1];
+    for (int kappa = 0; kappa < tk + 1; ++kappa) {
+        f[kappa] = buffer(ctx, kappa + 1);
+    }
 
-    Vector p[uni->N];
     memcpy(p, uni->p, sizeof(Vector) * uni->N);
+    double t = uni->t;
 
     for (int kappa = 0; kappa < tk + 1; ++kappa) {
         int start_ind = kappa * (kappa - 1) / 2;
@@ -150,111 +283,216 @@ double step_rkn_tableau(Universe *uni, double h, const NBT_t *tableau) {
             uni->p[i].x = p[i].x + h * tableau->alpha[kappa] * uni->v[i].x + h*h * Tx;
             uni->p[i].y = p[i].y + h * tableau->alpha[kappa] * uni->v[i].y + h*h * Ty;
         }
-        acc(uni, f[kappa]);
+        uni->t = t + h * tableau->alpha[kappa];
+        if (kappa < tk) {
+            ctx->acc(uni, f[kappa]);
+        } else {
+            acc_end(ctx, uni, f[kappa], uni->t);
+        }
     }
 
     for (int i = 0; i < uni->N; ++i) {
-        for (int kappa = 0; kappa < tk + 1; ++kappa) {
+        for (int kappa = 0; kappa < tk; ++kappa) {
             uni->v[i].x += h * f[kappa][i].x * tableau->cdot[kappa];
             uni->v[i].y += h * f[kappa][i].y * tableau->cdot[kappa];
         }
     }
+    uni->t = t + h;
 
-    double error = 0;
-    for (int i = 0; i < uni->N; ++i) {
-        error += distance(f[tk][i], f[tk + 1][i]);
-    }
-    error *= h*h * tableau->gamma[tk*(tk + 3) / 2];
-    return h * pow(tol * safety / error, 1 / (tk + 1));
+    // The last stage is evaluated at the new position. The embedded solution uses it
+    // in place of the stage before, whose weight is the last entry of gamma.
+    return error_norm(ctx, uni, p, f[tk - 1], f[tk], h*h * tableau->gamma[tk*(tk + 1)/2 - 1]);
 }
 
-double step_rkn45_tableau(Universe *uni, double h) {
+double step_rkn45_tableau(Integrator *ctx, Universe *uni, double h) {
     static const double alpha[5] = { 0, 1.0/3, 2.0/3, 1, 1 };
     static const double gamma[10] = { 1.0/18, 0, 2.0/9, 1.0/3, 0, 1.0/6, 13.0/120, 3.0/10, 3.0/40, 1.0/60 };
     static const double cdot[4] = { 1.0/8, 3.0/8, 3.0/8, 1.0/8 };
     static const NBT_t tableau = { 4, alpha, gamma, cdot };
-    return step_rkn_tableau(uni, h, &tableau);
+    return step_rkn_tableau(ctx, uni, h, &tableau);
 }
 
-double step_rkn67(Universe *uni, double h) {
-    double tol = 1e-9;
-    double safety = 0.5; // 50%
+// A sequence of kick-drift-kick leapfrog steps with sizes w[0] ⋅ h, ..., w[n-1] ⋅ h.
+// Every substep costs one force evaluation, at the position it ends on.
+static void kdk_composition(Integrator *ctx, Universe *uni, double h, const double *w, int n) {
+    prepare(ctx, uni, 0);
+    Vector *a = current_acc(ctx, uni);
+    double t = uni->t;
+    double elapsed = 0;
+
+    for (int k = 0; k < n; ++k) {
+        double hk = w[k] * h;
+        elapsed += hk;
+        for (int i = 0; i < uni->N; ++i) {
+            // v = v + a * h/2
+            // x = x + v * h
+            uni->v[i].x += a[i].x * hk/2;
+            uni->v[i].y += a[i].y * hk/2;
+            uni->p[i].x += uni->v[i].x * hk;
+            uni->p[i].y += uni->v[i].y * hk;
+        }
 
-    Vector k0[uni->N], k1[uni->N], k2[uni->N], k3[uni->N];
-    Vector k4[uni->N], k5[uni->N], k6[uni->N], k7[uni->N];
+        if (k < n - 1) {
+            uni->t = t + elapsed;
+            ctx->acc(uni, a);
+        } else {
+            uni->t = t + h;
+            acc_end(ctx, uni, a, t + h);
+        }
 
-    Vector p[uni->N];
-    memcpy(p, uni->p, sizeof(Vector) * uni->N);
+        // v = v + a(x) * h/2
+        for (int i = 0; i < uni->N; ++i) {
+            uni->v[i].x += a[i].x * hk/2;
+            uni->v[i].y += a[i].y * hk/2;
+        }
+    }
 
-    acc(uni, k0);
+    uni->t = t + h;
+    ctx->fsal_t = uni->t;
+}
 
-    for (int i = 0; i < uni->N; ++i) {
-        uni->p[i].x = p[i].x + uni->v[i].x * h/10 + k0[i].x * h*h/200;
-        uni->p[i].y = p[i].y + uni->v[i].y * h/10 + k0[i].y * h*h/200;
-    }
-    acc(uni, k1);
+void step_leapfrog(Integrator *ctx, Universe *uni, double h) {
+    static const double w[1] = { 1 };
+    kdk_composition(ctx, uni, h, w, 1);
+}
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x + k1[i].x * 2) / 150;
-        double Ty = (k0[i].y + k1[i].y * 2) / 150;
-        uni->p[i].x = p[i].x + uni->v[i].x * h/5 + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h/5 + Ty * h*h;
-    }
-    acc(uni, k2);
+// Yoshida (1990): the symmetric triple jump w₁, w₀, w₁ cancels the third order error of leapfrog.
+void step_yoshida4(Integrator *ctx, Universe *uni, double h) {
+    static const double w1 = 1.3512071919596576;   // 1 / (2 − ∛2)
+    static const double w0 = -1.7024143839193153;  // −∛2 / (2 − ∛2)
+    static const double w[3] = { w1, w0, w1 };
+    kdk_composition(ctx, uni, h, w, 3);
+}
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x + k2[i].x*2) * 2/75;
-        double Ty = (k0[i].y + k2[i].y*2) * 2/75;
-        uni->p[i].x = p[i].x + uni->v[i].x * h*2/5 + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h*2/5 + Ty * h*h;
-    }
-    acc(uni, k3);
+// Yoshida (1990), solution A of the seven stage sixth order composition.
+void step_yoshida6(Integrator *ctx, Universe *uni, double h) {
+    static const double w1 = -1.17767998417887;
+    static const double w2 = 0.235573213359357;
+    static const double w3 = 0.784513610477560;
+    static const double w0 = 1.31518632068391;  // 1 − 2(w₁ + w₂ + w₃)
+    static const double w[7] = { w3, w2, w1, w0, w1, w2, w3 };
+    kdk_composition(ctx, uni, h, w, 7);
+}
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x + k2[i].x*2 + k3[i].x) * 9/200;
-        double Ty = (k0[i].y + k2[i].y*2 + k3[i].y) * 9/200;
-        uni->p[i].x = p[i].x + uni->v[i].x * h*3/5 + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h*3/5 + Ty * h*h;
-    }
-    acc(uni, k4);
+// Forest & Ruth (1990) in its drift-first form. Its three force evaluations are
+// in the middle of the step, so unlike the kick-first methods there is nothing to
+// carry over to the next step.
+void step_forest_ruth(Integrator *ctx, Universe *uni, double h) {
+    static const double theta = 1.3512071919596576;  // 1 / (2 − ∛2)
+    static const double drift[4] = { theta / 2, (1 - theta) / 2, (1 - theta) / 2, theta / 2 };
+    static const double kick[3] = { theta, 1 - 2 * theta, theta };
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x*199 - k1[i].x*456 + k2[i].x*1410 - k3[i].x*357 + k4[i].x*356) / 3600;
-        double Ty = (k0[i].y*199 - k1[i].y*456 + k2[i].y*1410 - k3[i].y*357 + k4[i].y*356) / 3600;
-        uni->p[i].x = p[i].x + uni->v[i].x * h*4/5 + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h*4/5 + Ty * h*h;
-    }
-    acc(uni, k5);
+    prepare(ctx, uni, 1);
+    Vector *a = buffer(ctx, 0);
+    double t = uni->t;
+    double elapsed = 0;
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (-k0[i].x*179 + k1[i].x*816 - k3[i].x*444 + k4[i].x*876 - k5[i].x*157) / 1824;
-        double Ty = (-k0[i].y*179 + k1[i].y*816 - k3[i].y*444 + k4[i].y*876 - k5[i].y*157) / 1824;
+    for (int k = 0; k < 4; ++k) {
+        for (int i = 0; i < uni->N; ++i) {
+            uni->p[i].x += uni->v[i].x * drift[k] * h;
+            uni->p[i].y += uni->v[i].y * drift[k] * h;
+        }
+        if (k == 3) {
+            break;
+        }
 
-        uni->p[i].x = p[i].x + uni->v[i].x * h + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h + Ty * h*h;
+        elapsed += drift[k] * h;
+        uni->t = t + elapsed;
+        ctx->acc(uni, a);
+        for (int i = 0; i < uni->N; ++i) {
+            uni->v[i].x += a[i].x * kick[k] * h;
+            uni->v[i].y += a[i].y * kick[k] * h;
+        }
     }
-    acc(uni, k6);
 
-    for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x*122 + k2[i].x*475 + k3[i].x*100 + k4[i].x*250 + k5[i].x*50 + k6[i].x*11) / 2016;
-        double Ty = (k0[i].y*122 + k2[i].y*475 + k3[i].y*100 + k4[i].y*250 + k5[i].y*50 + k6[i].y*11) / 2016;
+    uni->t = t + h;
+}
 
-        uni->p[i].x = p[i].x + uni->v[i].x * h + Tx * h*h;
-        uni->p[i].y = p[i].y + uni->v[i].y * h + Ty * h*h;
+// The accelerations and jerks at the current positions and velocities. They are kept
+// from the last Hermite step as long as the time of the Universe matches.
+static Vector* current_acc_jerk(Integrator *ctx, const Universe *uni) {
+    if (!ctx->hermite_valid || ctx->hermite_t != uni->t) {
+        ctx->acc_jerk(uni, ctx->hermite, ctx->hermite + ctx->cap);
+        ctx->hermite_t = uni->t;
+        ctx->hermite_valid = 1;
     }
-    acc(uni, k7);
+    return ctx->hermite;
+}
+
+double hermite_initial_step(Integrator *ctx, const Universe *uni) {
+    prepare(ctx, uni, 4);
+    Vector *a = current_acc_jerk(ctx, uni);
+    Vector *jerk = a + ctx->cap;
 
+    double h = INFINITY;
     for (int i = 0; i < uni->N; ++i) {
-        double Tx = (k0[i].x*19 + k2[i].x*75 + k3[i].x*50 + k4[i].x*50 + k5[i].x*75 + k6[i].x*19) / 288;
-        double Ty = (k0[i].y*19 + k2[i].y*75 + k3[i].y*50 + k4[i].y*50 + k5[i].y*75 + k6[i].y*19) / 288;
-        uni->v[i].x += h * Tx;
-        uni->v[i].y += h * Ty;
+        double la = length(a[i]);
+        double lj = length(jerk[i]);
+        if (la > 0 && lj > 0) {
+            h = min(h, ctx->eta / 2 * la / lj);
+        }
     }
+    return isfinite(h) ? h : 0;
+}
 
-    double error = 0;
+// Makino & Aarseth (1992), in the time symmetric form of the corrector.
+double step_hermite(Integrator *ctx, Universe *uni, double h) {
+    prepare(ctx, uni, 4);
+    Vector *p0 = buffer(ctx, 0), *v0 = buffer(ctx, 1);
+    Vector *a1 = buffer(ctx, 2), *j1 = buffer(ctx, 3);
+    Vector *a0 = current_acc_jerk(ctx, uni);
+    Vector *j0 = a0 + ctx->cap;
+    double t = uni->t;
+
+    memcpy(p0, uni->p, sizeof(Vector) * uni->N);
+    memcpy(v0, uni->v, sizeof(Vector) * uni->N);
+
+    // Predict with the Taylor series to the jerk:
+    // ### p = p₀ + v₀ h + a₀ h²/2 + ȧ₀ h³/6
+    // ### v = v₀ + a₀ h + ȧ₀ h²/2
     for (int i = 0; i < uni->N; ++i) {
-        error += distance(k6[i], k7[i]);
+        uni->p[i].x += (v0[i].x + (a0[i].x / 2 + j0[i].x * h / 6) * h) * h;
+        uni->p[i].y += (v0[i].y + (a0[i].y / 2 + j0[i].y * h / 6) * h) * h;
+        uni->v[i].x += (a0[i].x + j0[i].x * h / 2) * h;
+        uni->v[i].y += (a0[i].y + j0[i].y * h / 2) * h;
     }
-    error *= h*h * 11/2016;
-    return h * pow(safety * tol / error, 1/7);
-}
\ No newline at end of file
+    uni->t = t + h;
+    ctx->acc_jerk(uni, a1, j1);
+
+    // Correct with the forces at both ends:
+    // ### v = v₀ + (a₀ + a₁) h/2 + (ȧ₀ − ȧ₁) h²/12
+    // ### p = p₀ + (v₀ + v) h/2 + (a₀ − a₁) h²/12
+    // The cubic through a and ȧ at both ends gives the higher derivatives at the end,
+    // for the next step size:
+    // ### a⁽²⁾ = (6 (a₀ − a₁) + (2 ȧ₀ + 4 ȧ₁) h) / h²
+    // ### a⁽³⁾ = (12 (a₀ − a₁) + 6 (ȧ₀ + ȧ₁) h) / h³
+    double next = INFINITY;
+    for (int i = 0; i < uni->N; ++i) {
+        double dx = a0[i].x - a1[i].x;
+        double dy = a0[i].y - a1[i].y;
+
+        uni->v[i].x = v0[i].x + (a0[i].x + a1[i].x) * h / 2 + (j0[i].x - j1[i].x) * h * h / 12;
+        uni->v[i].y = v0[i].y + (a0[i].y + a1[i].y) * h / 2 + (j0[i].y - j1[i].y) * h * h / 12;
+        uni->p[i].x = p0[i].x + (v0[i].x + uni->v[i].x) * h / 2 + dx * h * h / 12;
+        uni->p[i].y = p0[i].y + (v0[i].y + uni->v[i].y) * h / 2 + dy * h * h / 12;
+
+        Vector a2 = { (6 * dx + (2 * j0[i].x + 4 * j1[i].x) * h) / (h * h),
+                      (6 * dy + (2 * j0[i].y + 4 * j1[i].y) * h) / (h * h) };
+        Vector a3 = { (12 * dx + 6 * (j0[i].x + j1[i].x) * h) / (h * h * h),
+                      (12 * dy + 6 * (j0[i].y + j1[i].y) * h) / (h * h * h) };
+        double la = length(a1[i]), lj = length(j1[i]);
+        double l2 = length(a2), l3 = length(a3);
+        double step = sqrt(ctx->eta * (la * l2 + lj * lj) / (lj * l3 + l2 * l2));
+        // Objects without any force give 0 / 0, and are left out.
+        if (step > 0 && step < next) {
+            next = step;
+        }
+    }
+
+    // The forces at the predicted state stand in for those at the corrected one.
+    memcpy(ctx->hermite, a1, sizeof(Vector) * uni->N);
+    memcpy(ctx->hermite + ctx->cap, j1, sizeof(Vector) * uni->N);
+    ctx->hermite_t = uni->t;
+    ctx->hermite_valid = 1;
+    return isfinite(next) ? next : 2 * h;
+}
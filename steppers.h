@@ -2,6 +2,7 @@
 #define STEPPERS_H
 
 #include "gravity.h"
+#include "backend.h"
 
 typedef struct NystromButcherTableau {
     int kappa;  // The order of the tableau
@@ -10,14 +11,142 @@ typedef struct NystromButcherTableau {
     const double *cdot;
 } NBT_t;
 
-void step_euler(Universe *uni, double h);
+// The conserved quantities of a Universe.
+typedef struct Conserved {
+    double kinetic;
+    double potential;
+    double energy;            // kinetic + potential
+    Vector momentum;
+    double angular_momentum;  // around the origin, the z component
+} Conserved;
 
-void step_rk4(Universe *uni, double h);
+// The number of N-sized buffers the built-in steppers need at most.
+#define STEPPER_BUFFERS 12
 
-double step_rkn45(Universe *uni, double h);
+// State shared by the steppers between steps: the force calculation and the
+// scratch buffers for the stages. Create one per Universe and reuse it for every
+// step, so that stepping never allocates and never puts N-sized arrays on the stack.
+typedef struct Integrator {
+    int N;        // the number of objects the buffers are in use for
+    int cap;      // the length of every buffer, at least N
+    int buffers;  // the number of buffers
+    Vector *mem;  // buffers * cap Vectors, every buffer aligned to 64 bytes
+    acc_fn acc;   // the force calculation, that of force_backend() by default
+    acc_pot_fn acc_pot;  // the same forces and the potentials, that of force_backend() by default, or NULL
+    acc_jerk_fn acc_jerk;  // the forces and their time derivatives for step_hermite(), acc_jerk() by default
 
-double step_rkn67(Universe *uni, double h);
+    // Step size control, used by the adaptive steppers and integrate().
+    double tol;       // tolerated local error per distance travelled (default 1e-9)
+    double safety;    // fraction of the predicted optimal step to take (default 0.9)
+    double h;         // the next step size, 0 to let integrate() pick one
+    double h_min;     // integrate() fails rather than take smaller steps (default 0)
+    double h_max;     // integrate() never takes larger steps (default ∞)
+    double eta;       // the accuracy parameter of Aarseth's criterion in step_hermite() (default 0.02)
+    double err_prev;  // the error of the last accepted step, for the PI controller
+    long accepted;
+    long rejected;
+    Vector *saved;    // 2 * cap Vectors to restore p and v from after a rejected step
 
-double step_rkn45_tableau(Universe *uni, double h);
+    // With monitor set, steppers whose last force evaluation is at the end of the step
+    // use acc_pot for it, which makes integrator_conserved() almost free.
+    int monitor;
+    double *pot;      // the potentials at time pot_t
+    double pot_t;
+    int pot_valid;
+
+    // The accelerations at the end of the last step of a kick-first symplectic stepper,
+    // reused as the first force evaluation of the next step.
+    Vector *fsal;
+    double fsal_t;    // the time they belong to
+    int fsal_valid;
+
+    // The accelerations and jerks at the end of the last step of step_hermite(),
+    // the start of the next step.
+    Vector *hermite;  // 2 * cap Vectors: the accelerations, then the jerks
+    double hermite_t;
+    int hermite_valid;
+} Integrator;
+
+Integrator* create_integrator(int N);
+
+void destroy_integrator(Integrator *ctx);
+
+// Select the force calculation used by all steppers. NULL selects the direct sum acc().
+// This and the two below drop the forces kept from earlier steps.
+void integrator_set_acc(Integrator *ctx, acc_fn f);
+
+// Select the forces and potentials of a backend.
+void integrator_set_backend(Integrator *ctx, const ForceBackend *backend);
+
+// Select the combined force and potential calculation, which must compute the same
+// forces as the one of integrator_set_acc(). NULL makes integrator_conserved() fall
+// back to the O(N²) gravitational_energy().
+void integrator_set_acc_pot(Integrator *ctx, acc_pot_fn f);
+
+// Select the combined force and jerk calculation of step_hermite(). NULL selects acc_jerk().
+void integrator_set_acc_jerk(Integrator *ctx, acc_jerk_fn f);
+
+// Make room for at least N objects and the given number of buffers.
+void integrator_reserve(Integrator *ctx, int N, int buffers);
+
+// Change the number of objects, e.g. after objects were added to or removed from the Universe.
+void integrator_resize(Integrator *ctx, int N);
+
+// Forget the accelerations kept between steps. Call this after changing
+// positions or masses of the Universe outside of a stepper.
+void integrator_invalidate(Integrator *ctx);
+
+// The energy, momentum and angular momentum of the Universe. Right after a step of
+// rkn45, rkn67, a tableau or a kick-first symplectic stepper with ctx->monitor set this
+// costs O(N); otherwise it evaluates ctx->acc_pot once.
+Conserved integrator_conserved(Integrator *ctx, const Universe *uni);
+
+void step_euler(Integrator *ctx, Universe *uni, double h);
+
+void step_rk4(Integrator *ctx, Universe *uni, double h);
+
+// The embedded RKN steppers return their error estimate relative to ctx->tol.
+// A step with an error above 1 should be rejected, see integrate(). rkn45 and rkn67
+// evaluate their last stage at the end of the step, and keep it for the next step
+// when the error is at most 1, so a step costs 4 and 7 calls to acc. rkn87 is
+// Fehlberg's 7(8) pair in Nyström form, 12 calls to acc per step; at tight tolerances
+// its 8th order more than makes up for them. They are generated by gen_rkn.py.
+
+double step_rkn45(Integrator *ctx, Universe *uni, double h);
+
+double step_rkn67(Integrator *ctx, Universe *uni, double h);
+
+double step_rkn87(Integrator *ctx, Universe *uni, double h);
+
+double step_rkn_tableau(Integrator *ctx, Universe *uni, double h, const NBT_t *tableau);
+
+double step_rkn45_tableau(Integrator *ctx, Universe *uni, double h);
+
+// Symplectic steppers for long runs: their energy error stays bounded instead of drifting.
+// They use a fixed h, and the kick-first ones reuse the last force evaluation of the
+// previous step, so a step costs 1 (leapfrog), 3 (yoshida4, forest_ruth) or 7 (yoshida6) calls to acc.
+
+void step_leapfrog(Integrator *ctx, Universe *uni, double h);
+
+void step_yoshida4(Integrator *ctx, Universe *uni, double h);
+
+void step_yoshida6(Integrator *ctx, Universe *uni, double h);
+
+void step_forest_ruth(Integrator *ctx, Universe *uni, double h);
+
+// The 4th order Hermite predictor-corrector: one call to ctx->acc_jerk per step, which
+// gives the accelerations and jerks at the predicted positions and velocities, and
+// the accelerations and jerks at both ends of the step give the corrector. The forces
+// come from ctx->acc_jerk alone; ctx->acc is not used. Returns the step size Aarseth's
+// criterion picks for the next step, the smallest over all objects of
+// ### Δtᵢ = √(η ⋅ (|a| |a⁽²⁾| + |ȧ|²) / (|ȧ| |a⁽³⁾| + |a⁽²⁾|²))
+// with the derivatives at the end of the step and η = ctx->eta, or 2h if no object
+// feels a force.
+double step_hermite(Integrator *ctx, Universe *uni, double h);
+
+// The step size to start step_hermite() with when it kept no forces from a step that
+// ended at uni->t: the smallest over all objects of η / 2 ⋅ |a| / |ȧ|, or 0 if no
+// object accelerates. Evaluates ctx->acc_jerk, and keeps the result for the step.
+double hermite_initial_step(Integrator *ctx, const Universe *uni);
 
 #endif /* STEPPERS_H */
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t *workers = NULL;
+static int nthreads = 0;      // 0 until the pool is first used
+static long generation = 0;   // incremented for every parallel_run
+static long spawn_generation = 0;
+static int running = 0;       // workers still busy with the current generation
+static int stopping = 0;
+
+static parallel_fn job_fn = NULL;
+static void *job_arg = NULL;
+
+static _Thread_local int inside_pool = 0;
+
+static void* worker_main(void *arg) {
+    int tid = (int)(long)arg;
+    long seen = spawn_generation;
+    inside_pool = 1;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (generation == seen && !stopping) {
+            pthread_cond_wait(&work_ready, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        seen = generation;
+        parallel_fn fn = job_fn;
+        void *arg = job_arg;
+        int n = nthreads;
+        pthread_mutex_unlock(&lock);
+
+        fn(arg, tid, n);
+
+        pthread_mutex_lock(&lock);
+        if (--running == 0) {
+            pthread_cond_signal(&work_done);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void stop_workers(void) {
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&lock);
+
+    for (int t = 1; t < nthreads; ++t) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    workers = NULL;
+    stopping = 0;
+}
+
+static void start_workers(int n) {
+    nthreads = n;
+    spawn_generation = generation;
+    workers = calloc(n, sizeof(pthread_t));
+    for (int t = 1; t < n; ++t) {
+        pthread_create(&workers[t], NULL, worker_main, (void*)(long)t);
+    }
+}
+
+void set_num_threads(int n) {
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        n = n > 0 ? n : 1;
+    }
+    if (n == nthreads) {
+        return;
+    }
+    if (nthreads > 0) {
+        stop_workers();
+    }
+    start_workers(n);
+}
+
+int get_num_threads(void) {
+    if (0 == nthreads) {
+        set_num_threads(0);
+    }
+    return nthreads;
+}
+
+void parallel_run(parallel_fn fn, void *arg) {
+    int n = get_num_threads();
+    if (n == 1 || inside_pool) {
+        fn(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job_fn = fn;
+    job_arg = arg;
+    running = n - 1;
+    ++generation;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&lock);
+
+    inside_pool = 1;
+    fn(arg, 0, n);
+    inside_pool = 0;
+
+    pthread_mutex_lock(&lock);
+    while (running > 0) {
+        pthread_cond_wait(&work_done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,18 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// A fixed set of worker threads that lives for the whole program, so that
+// kernels called many times per step don't pay for creating threads.
+
+typedef void (*parallel_fn)(void *arg, int tid, int nthreads);
+
+// Set the number of threads, including the calling thread. 0 uses all online CPUs.
+void set_num_threads(int n);
+
+int get_num_threads(void);
+
+// Call fn(arg, tid, nthreads) once for every tid in [0, nthreads) and wait for all of them.
+// The calling thread runs tid 0. Calls from inside fn run serially with nthreads = 1.
+void parallel_run(parallel_fn fn, void *arg);
+
+#endif /* THREADPOOL_H */
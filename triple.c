@@ -0,0 +1,60 @@
+#include "triple.h"
+#include "gravity.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TripleBuffer* create_triple_buffer(int N) {
+    TripleBuffer *tb = calloc(1, sizeof(TripleBuffer));
+    if (NULL == tb) {
+        return NULL;
+    }
+    for (int k = 0; k < 3; ++k) {
+        tb->frames[k].p = calloc(max(N, 1), sizeof(Vector));
+        tb->frames[k].m = calloc(max(N, 1), sizeof(double));
+        if (NULL == tb->frames[k].p || NULL == tb->frames[k].m) {
+            destroy_triple_buffer(tb);
+            return NULL;
+        }
+    }
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+    return tb;
+}
+
+void destroy_triple_buffer(TripleBuffer *tb) {
+    for (int k = 0; k < 3; ++k) {
+        free(tb->frames[k].p);
+        free(tb->frames[k].m);
+    }
+    free(tb);
+}
+
+Frame* triple_back(TripleBuffer *tb) {
+    return &tb->frames[tb->back];
+}
+
+void triple_store(TripleBuffer *tb, const Universe *uni) {
+    Frame *f = triple_back(tb);
+    f->N = uni->N;
+    f->t = uni->t;
+    memcpy(f->p, uni->p, uni->N * sizeof(Vector));
+    memcpy(f->m, uni->m, uni->N * sizeof(double));
+}
+
+void triple_publish(TripleBuffer *tb) {
+    // Release: the reader that takes the frame sees everything written to it.
+    int old = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_FRESH, memory_order_acq_rel);
+    tb->back = old & ~TRIPLE_FRESH;
+}
+
+const Frame* triple_front(TripleBuffer *tb) {
+    if (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_FRESH) {
+        // Acquire: the frame is complete. The writer may only publish in between, in
+        // which case the frame taken is newer still.
+        int old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+        tb->front = old & ~TRIPLE_FRESH;
+    }
+    return &tb->frames[tb->front];
+}
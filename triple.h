@@ -0,0 +1,52 @@
+#ifndef TRIPLE_H
+#define TRIPLE_H
+
+#include "gravity.h"
+
+#include <stdatomic.h>
+
+// What the simulation thread hands to the renderer: a consistent copy of the
+// positions and masses after some step, and how far the run has come.
+typedef struct Frame {
+    int N;
+    Vector *p;
+    double *m;
+    double t;             // simulation time
+    long steps;           // accepted steps so far
+    double energy_error;  // relative to the start
+} Frame;
+
+// A lock-free triple buffer of Frames for one writer and one reader thread. The
+// writer fills its back frame and publishes it, the reader takes the newest
+// published frame; neither ever waits for the other. Of the three frames one
+// belongs to the writer, one to the reader, and the third is the one in the middle,
+// exchanged atomically together with a bit that says whether it is newer than the
+// reader's.
+typedef struct TripleBuffer {
+    Frame frames[3];
+    int back;             // the writer's frame
+    int front;            // the reader's frame
+    _Atomic int middle;   // the index of the middle frame, | TRIPLE_FRESH if it was published since the last read
+} TripleBuffer;
+
+#define TRIPLE_FRESH 4
+
+// Three frames with room for N objects each. Returns NULL if out of memory.
+TripleBuffer* create_triple_buffer(int N);
+
+void destroy_triple_buffer(TripleBuffer *tb);
+
+// The frame the writer may fill. It stays the writer's until triple_publish().
+Frame* triple_back(TripleBuffer *tb);
+
+// Copy the positions, masses and time of the Universe into the back frame.
+void triple_store(TripleBuffer *tb, const Universe *uni);
+
+// Make the back frame the newest one; the writer gets another back frame.
+void triple_publish(TripleBuffer *tb);
+
+// The newest published frame. It stays valid until the next call; with nothing
+// published since the last call, it is the same frame again.
+const Frame* triple_front(TripleBuffer *tb);
+
+#endif /* TRIPLE_H */
@@ -22,4 +22,18 @@ void vadd(Vector *out, const Vector *m, const Vector *n, size_t N) {
         out[i].x = m[i].x + n[i].x;
         out[i].y = m[i].y + n[i].y;
     }
-}
\ No newline at end of file
+}
+
+// Versions of vmul and vadd for one component of a UniverseSoA.
+// Call them once for the x and once for the y array.
+void vmul_soa(double *out, const double *m, double k, size_t N) {
+    for (size_t i = 0; i < N; ++i) {
+        out[i] = m[i] * k;
+    }
+}
+
+void vadd_soa(double *out, const double *m, const double *n, size_t N) {
+    for (size_t i = 0; i < N; ++i) {
+        out[i] = m[i] + n[i];
+    }
+}
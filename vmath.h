@@ -19,4 +19,8 @@ void vadd(Vector *out, const Vector *m, const Vector *n, size_t N);
 
 void vmul(Vector *out, const Vector *m, double k, size_t N);
 
+void vadd_soa(double *out, const double *m, const double *n, size_t N);
+
+void vmul_soa(double *out, const double *m, double k, size_t N);
+
 #endif /* VMATH_H */
\ No newline at end of file